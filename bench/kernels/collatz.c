@@ -0,0 +1,32 @@
+/* The C twin of collatz.lisa: integer arithmetic, the total Collatz
+ * stopping time of a range, repeated over shifted ranges. The step is
+ * branch-free like the Lisa one. Lisa divides signed integers and its
+ * multiplications wrap, hence the unsigned products. */
+#include <stdint.h>
+
+static int collatz_steps(int32_t n) {
+  int steps = 0;
+  while (n != 1) {
+    int32_t half = n / 2;
+    int32_t odd = n - 2 * half;
+    n = (int32_t)((1u - odd) * (uint32_t)half + (uint32_t)odd * (1u + 3u * (uint32_t)n));
+    steps = steps + 1;
+  }
+  return steps;
+}
+
+static int total_steps(int from, int count) {
+  int total = 0;
+  for (int i = 0; i < count; ++i) {
+    total = total + collatz_steps(from + i);
+  }
+  return total;
+}
+
+int main(void) {
+  int total = 0;
+  for (int rep = 0; rep < 10; ++rep) {
+    total = total + total_steps(rep + 1, 100000);
+  }
+  return total - 256 * (total / 256);
+}
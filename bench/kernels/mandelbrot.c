@@ -0,0 +1,33 @@
+/* The C twin of mandelbrot.lisa: a larger float workload, the escape
+ * times of a 1000x1000 grid. */
+static int escape(double cr, double ci, int limit) {
+  double x = 0.0;
+  double y = 0.0;
+  int n = 0;
+  while (n < limit && x * x + y * y < 4.0) {
+    double xt = x * x - y * y + cr;
+    y = 2.0 * (x * y) + ci;
+    x = xt;
+    n = n + 1;
+  }
+  return n;
+}
+
+static int mandelbrot(int size, double step, int limit) {
+  int total = 0;
+  double ci = -1.5;
+  for (int j = 0; j < size; ++j) {
+    double cr = -2.0;
+    for (int i = 0; i < size; ++i) {
+      total = total + escape(cr, ci, limit);
+      cr = cr + step;
+    }
+    ci = ci + step;
+  }
+  return total;
+}
+
+int main(void) {
+  int total = mandelbrot(1000, 0.003, 500);
+  return total - 256 * (total / 256);
+}
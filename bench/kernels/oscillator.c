@@ -0,0 +1,29 @@
+/* The C twin of oscillator.lisa: structs passed by value through an
+ * overloaded operator, a harmonic oscillator integrated with symplectic
+ * Euler, whose radius stays near 1. */
+typedef struct {
+  double x, y;
+} vec;
+
+static vec add(vec a, vec b) {
+  return (vec){a.x + b.x, a.y + b.y};
+}
+
+static vec scale(vec v, double s) {
+  return (vec){v.x * s, v.y * s};
+}
+
+static double simulate(int steps, double dt) {
+  vec p = {1.0, 0.0};
+  vec v = {0.0, 1.0};
+  for (int i = 0; i < steps; ++i) {
+    v = add(v, scale(p, 0.0 - dt));
+    p = add(p, scale(v, dt));
+  }
+  return p.x * p.x + p.y * p.y;
+}
+
+int main(void) {
+  double r2 = simulate(100000000, 0.00001);
+  return 0.99 < r2 && r2 < 1.01;
+}
@@ -0,0 +1,17 @@
+/* The C twin of pi.lisa: float math in the style of
+ * samples/circle-area.lisa, pi as the midpoint rule for the integral of
+ * 4/(1+x^2) over [0, 1]. */
+static double pi_sum(int steps, double h) {
+  double sum = 0.0;
+  double x = 0.5 * h;
+  for (int i = 0; i < steps; ++i) {
+    sum = sum + 4.0 / (1.0 + x * x);
+    x = x + h;
+  }
+  return sum * h;
+}
+
+int main(void) {
+  double pi = pi_sum(50000000, 0.00000002);
+  return 3.14159 < pi && pi < 3.1416;
+}
@@ -0,0 +1,158 @@
+#include <lisa/lexer.hpp>
+#include <lisa/parser.hpp>
+#include <lisa/type_checker.hpp>
+#include <lisa/evaluator.hpp>
+#include <lisa/compiler.hpp>
+#include <fmt/format.h>
+#include <string_theory/string>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Times each phase of the front end on (def f (x 'i32) (+ x (+ x ... x)))
+// nested `depth` levels deep, and again at twice the depth. Every phase
+// walks the tree with an explicit stack, so its time should grow linearly
+// with the depth. The exit code is 1 if a phase fails, or if doubling the
+// depth multiplies its time by more than the threshold allows.
+
+using ST::string;
+
+struct bench_options {
+  std::size_t runs = 5;
+  std::size_t depth = 50000;
+  double threshold = 3.0;
+};
+
+// The best times of the phases, in milliseconds.
+struct phase_times {
+  double tokenize = 0;
+  double parse = 0;
+  double type_check = 0;
+  double fold = 0;
+  double repr = 0;
+  double compile = 0;
+  double destroy = 0;
+  bool failed = false;
+};
+
+auto nested_input(std::size_t depth) -> string {
+  std::string code = "(def f (x 'i32) ";
+  for(std::size_t i = 0; i < depth; ++i) {
+    code += "(+ x ";
+  }
+  code += "x";
+  code += std::string(depth, ')');
+  code += ")\n(def main () (f 1))\n";
+  return string(code.c_str(), code.size());
+}
+
+auto measure(const string &code, std::size_t runs) -> phase_times {
+  using clock = std::chrono::steady_clock;
+  auto ms = [](clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+  };
+  auto best = [](double &slot, double t, std::size_t run) {
+    slot = run == 0 ? t : std::min(slot, t);
+  };
+
+  phase_times times;
+  for(std::size_t run = 0; run < runs; ++run) {
+    auto src = lisa::source(code);
+
+    auto start = clock::now();
+    auto tokens = lisa::lexer().tokenize(src);
+    best(times.tokenize, ms(start), run);
+
+    auto parser = lisa::parser();
+    parser.max_depth = code.size();
+    start = clock::now();
+    auto ast = parser.parse(src, tokens);
+    best(times.parse, ms(start), run);
+
+    auto checker = lisa::type_checker();
+    start = clock::now();
+    checker.type_check(*ast);
+    best(times.type_check, ms(start), run);
+
+    if (!parser.errors.empty() || !checker.errors.empty()) {
+      times.failed = true;
+      return times;
+    }
+
+    start = clock::now();
+    lisa::evaluator(checker.fn_table).fold(*ast);
+    best(times.fold, ms(start), run);
+
+    start = clock::now();
+    auto text = ast->repr();
+    best(times.repr, ms(start), run);
+
+    auto compiler = lisa::compiler();
+    start = clock::now();
+    compiler.compile(checker.fn_table);
+    compiler.compile(*ast);
+    best(times.compile, ms(start), run);
+
+    start = clock::now();
+    ast.reset();
+    best(times.destroy, ms(start), run);
+  }
+  return times;
+}
+
+auto main(int argc, const char* argv[]) -> int {
+  auto options = bench_options();
+  for(int i = 1; i < argc; ++i) {
+    auto arg = string(argv[i]);
+    if (arg.starts_with("--runs=")) {
+      options.runs = std::max(1ull, arg.substr(7).to_ulong_long());
+    }
+    else if (arg.starts_with("--depth=")) {
+      options.depth = std::max(1ull, arg.substr(8).to_ulong_long());
+    }
+    else if (arg.starts_with("--threshold=")) {
+      options.threshold = arg.substr(12).to_double();
+    }
+  }
+
+  auto base = measure(nested_input(options.depth), options.runs);
+  auto doubled = measure(nested_input(options.depth * 2), options.runs);
+  if (base.failed || doubled.failed) {
+    fmt::print("error: the nested input does not compile\n");
+    return 1;
+  }
+
+  struct row {
+    const char* name;
+    double base;
+    double doubled;
+  };
+  std::vector<row> rows{
+    {"tokenize", base.tokenize, doubled.tokenize},
+    {"parse", base.parse, doubled.parse},
+    {"type_check", base.type_check, doubled.type_check},
+    {"fold", base.fold, doubled.fold},
+    {"repr", base.repr, doubled.repr},
+    {"compile", base.compile, doubled.compile},
+    {"destroy", base.destroy, doubled.destroy},
+  };
+
+  fmt::print("{:<16} {:>12} {:>12} {:>8}\n", "phase",
+      fmt::format("{} (ms)", options.depth), fmt::format("{} (ms)", options.depth * 2), "growth");
+  bool failed = false;
+  for(auto &&r : rows) {
+    // Phases that take well under a millisecond are too noisy to judge.
+    auto growth = r.doubled / std::max(r.base, 0.01);
+    auto slow = r.doubled >= 1.0 && growth > options.threshold;
+    failed = failed || slow;
+    fmt::print("{:<16} {:>12.1f} {:>12.1f} {:>8.2f}{}\n",
+        r.name, r.base, r.doubled, growth, slow ? "  REGRESSION" : "");
+  }
+
+  if (failed) {
+    fmt::print("Some phases grow more than {:.2f}x when the depth doubles\n", options.threshold);
+  }
+  return failed ? 1 : 0;
+}
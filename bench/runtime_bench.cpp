@@ -0,0 +1,210 @@
+#include <lisa/lexer.hpp>
+#include <lisa/parser.hpp>
+#include <lisa/type_checker.hpp>
+#include <lisa/evaluator.hpp>
+#include <lisa/compiler.hpp>
+#include <lisa/file.hpp>
+#include <lisa/driver_interface.hpp>
+#include <fmt/format.h>
+#include <string_theory/string>
+#include <tl/expected.hpp>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Builds every kernel of the kernel directory twice, from its .lisa file
+// with liblisa and from its .c twin with the system C compiler, runs both
+// executables a number of times and compares their best run times. The
+// exit code is 1 if a kernel fails to build, if the two executables
+// disagree on their exit code, or if the Lisa one is slower than the
+// threshold allows.
+
+namespace fs = std::filesystem;
+using ST::string;
+using tl::expected;
+using tl::make_unexpected;
+
+extern char** environ;
+
+struct bench_options {
+  std::size_t runs = 5;
+  double threshold = 1.25;
+  std::uint32_t opt_level = 2;
+  std::string cc = std::getenv("CC") ? std::getenv("CC") : "cc";
+  std::string filter;
+  fs::path kernels = LISA_BENCH_KERNELS;
+};
+
+struct timing {
+  double best_ms;
+  int status;
+};
+
+auto first_error(const lisa::source &src, const std::vector<lisa::error> &errors) -> string {
+  auto &e = errors.front();
+  return ST::format("{}: {}", src.pos_of(e.pos).to_str(), e.msg);
+}
+
+auto build_lisa(const fs::path &in, const fs::path &out, std::uint32_t opt_level) -> expected<void, string> {
+  auto code = lisa::read_file(in.c_str());
+  if (!code) {
+    return make_unexpected(code.error());
+  }
+  auto src = lisa::source(*code);
+  auto tokens = lisa::lexer().tokenize(src);
+
+  auto parser = lisa::parser();
+  auto ast = parser.parse(src, tokens);
+  if (!parser.errors.empty()) {
+    return make_unexpected(first_error(src, parser.errors));
+  }
+
+  auto checker = lisa::type_checker();
+  checker.type_check(*ast);
+  if (!checker.errors.empty()) {
+    return make_unexpected(first_error(src, checker.errors));
+  }
+  lisa::evaluator(checker.fn_table).fold(*ast);
+
+  auto compiler = lisa::compiler();
+  compiler.options.opt_level = opt_level;
+  compiler.compile(checker.fn_table);
+  compiler.compile(*ast);
+  compiler.optimize();
+  return lisa::make_executable(out.c_str(), compiler);
+}
+
+auto build_c(const std::string &cc, const fs::path &in, const fs::path &out) -> expected<void, string> {
+  auto cmd = fmt::format("{} -O2 -o {} {} -lm", cc, out.string(), in.string());
+  if (std::system(cmd.c_str()) != 0) {
+    return make_unexpected(string(fmt::format("{} failed", cmd).c_str()));
+  }
+  return {};
+}
+
+// Runs the executable `runs` times with its output discarded and keeps the
+// best wall time and the exit code of the last run.
+auto measure(const fs::path &exe, std::size_t runs) -> expected<timing, string> {
+  timing result{0, 0};
+  for(std::size_t i = 0; i < runs; ++i) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char* argv[] = {const_cast<char *>(exe.c_str()), nullptr};
+    pid_t pid;
+    auto start = std::chrono::steady_clock::now();
+    auto failed = posix_spawn(&pid, exe.c_str(), &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (failed) {
+      return make_unexpected(string(fmt::format("Cannot run {}", exe.string()).c_str()));
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (!WIFEXITED(status)) {
+      return make_unexpected(string(fmt::format("{} crashed", exe.string()).c_str()));
+    }
+    result.best_ms = i == 0 ? elapsed.count() : std::min(result.best_ms, elapsed.count());
+    result.status = WEXITSTATUS(status);
+  }
+  return result;
+}
+
+auto main(int argc, const char* argv[]) -> int {
+  auto options = bench_options();
+  for(int i = 1; i < argc; ++i) {
+    auto arg = string(argv[i]);
+    if (arg.starts_with("--runs=")) {
+      options.runs = std::max(1ull, arg.substr(7).to_ulong_long());
+    }
+    else if (arg.starts_with("--threshold=")) {
+      options.threshold = arg.substr(12).to_double();
+    }
+    else if (arg.starts_with("--cc=")) {
+      options.cc = arg.substr(5).c_str();
+    }
+    else if (arg.starts_with("--filter=")) {
+      options.filter = arg.substr(9).c_str();
+    }
+    else if (arg.size() == 3 && arg.starts_with("-O") && arg[2] >= '0' && arg[2] <= '3') {
+      options.opt_level = arg[2] - '0';
+    }
+    else {
+      options.kernels = argv[i];
+    }
+  }
+
+  std::vector<fs::path> kernels;
+  for(auto &&entry : fs::directory_iterator(options.kernels)) {
+    auto &path = entry.path();
+    if (path.extension() == ".lisa" && path.stem().string().find(options.filter) != std::string::npos) {
+      kernels.push_back(path);
+    }
+  }
+  std::sort(kernels.begin(), kernels.end());
+
+  char dir_template[] = "/tmp/lisa-bench-XXXXXX";
+  if (!mkdtemp(dir_template)) {
+    fmt::print("error: cannot create a work directory\n");
+    return 1;
+  }
+  auto work = fs::path(dir_template);
+
+  fmt::print("{:<16} {:>12} {:>12} {:>8}\n", "kernel", "lisa (ms)", "C (ms)", "ratio");
+  bool failed = false;
+  for(auto &&kernel : kernels) {
+    auto name = kernel.stem().string();
+    auto twin = fs::path(kernel).replace_extension(".c");
+    auto report = [&](const string &msg) {
+      fmt::print("{:<16} error: {}\n", name, msg.view());
+      failed = true;
+    };
+    if (!fs::exists(twin)) {
+      report("no C version");
+      continue;
+    }
+
+    auto lisa_exe = work / (name + ".lisa.out");
+    auto c_exe = work / (name + ".c.out");
+    if (auto built = build_lisa(kernel, lisa_exe, options.opt_level); !built) {
+      report(built.error());
+      continue;
+    }
+    if (auto built = build_c(options.cc, twin, c_exe); !built) {
+      report(built.error());
+      continue;
+    }
+
+    auto lisa_time = measure(lisa_exe, options.runs);
+    auto c_time = measure(c_exe, options.runs);
+    if (!lisa_time || !c_time) {
+      report(!lisa_time ? lisa_time.error() : c_time.error());
+      continue;
+    }
+    if (lisa_time->status != c_time->status) {
+      report(ST::format("exits with {}, but the C version with {}", lisa_time->status, c_time->status));
+      continue;
+    }
+
+    auto ratio = lisa_time->best_ms / c_time->best_ms;
+    auto slow = ratio > options.threshold;
+    failed = failed || slow;
+    fmt::print("{:<16} {:>12.1f} {:>12.1f} {:>8.2f}{}\n",
+        name, lisa_time->best_ms, c_time->best_ms, ratio, slow ? "  REGRESSION" : "");
+  }
+
+  fs::remove_all(work);
+  if (failed) {
+    fmt::print("Some kernels failed or are more than {:.2f}x slower than C\n", options.threshold);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,40 @@
+#include <lisa/session.hpp>
+#include <lisa/file.hpp>
+#include <fmt/format.h>
+#include <string_theory/string>
+
+// Runs the i32 main of a sample in a lazy unit, which compiles each def on
+// its first call, and compares the result with the one expected:
+//
+//   lisa_lazy_sample ../generic.lisa 42
+//
+// The exit code is 0 when they are equal.
+
+auto main(int argc, const char* argv[]) -> int {
+  if (argc != 3) {
+    fmt::print("usage: {} FILE EXPECTED\n", argv[0]);
+    return 1;
+  }
+  auto code = lisa::read_file(argv[1]);
+  if (!code) {
+    fmt::print("error: {}\n", code.error().view());
+    return 1;
+  }
+
+  auto s = lisa::session();
+  auto unit = s.lazy(*code);
+  if (!unit) {
+    fmt::print("error: {}\n", unit.error().front().msg.view());
+    return 1;
+  }
+  auto main = (*unit)->function<int()>("main");
+  if (!main) {
+    fmt::print("error: {}\n", main.error().view());
+    return 1;
+  }
+
+  auto result = (*main)();
+  auto expected = ST::string(argv[2]).to_int();
+  fmt::print("{}: {}\n", argv[1], result);
+  return result == expected ? 0 : 1;
+}
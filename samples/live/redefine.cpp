@@ -0,0 +1,53 @@
+#include <lisa/session.hpp>
+#include <fmt/format.h>
+
+// Defines k and a caller of it in one live unit, then redefines k alone.
+// The caller was compiled once, yet sees every version of k. Then code that
+// redefines k and adds g fails to link, which must leave k and g as they
+// were, and g is defined for real. The exit code is 0 when all of it holds.
+
+auto main() -> int {
+  auto s = lisa::session();
+  auto unit = s.live(
+    "(def k () 10)\n"
+    "(def f (x'i32) (+ x (k)))");
+  if (!unit) {
+    fmt::print("error: {}\n", unit.error().front().msg.view());
+    return 1;
+  }
+  auto f = (*unit)->function<int(int)>("f");
+  if (!f) {
+    fmt::print("error: {}\n", f.error().view());
+    return 1;
+  }
+
+  auto before = (*f)(1);
+  if (auto defined = (*unit)->define("(def k () 20)"); !defined) {
+    fmt::print("error: {}\n", defined.error().front().msg.view());
+    return 1;
+  }
+  auto after = (*f)(1);
+  fmt::print("f 1 = {} with k = 10, then {} with k = 20\n", before, after);
+
+  auto broken = (*unit)->define(
+    "(extern lisamissingsymbol (x'i32) i32)\n"
+    "(def g (x'i32) (lisamissingsymbol x))\n"
+    "(def k () (g 30))");
+  if (broken) {
+    fmt::print("error: code that calls a missing symbol was linked\n");
+    return 1;
+  }
+  auto kept = (*f)(1);
+  auto hidden = !(*unit)->function<int(int)>("g");
+  fmt::print("f 1 = {} after the failed redefinition, g is {}\n", kept, hidden ? "unknown" : "known");
+
+  if (auto defined = (*unit)->define("(def g (x'i32) (* 2 x))"); !defined) {
+    fmt::print("error: {}\n", defined.error().front().msg.view());
+    return 1;
+  }
+  auto g = (*unit)->function<int(int)>("g");
+  auto doubled = g ? (*g)(4) : 0;
+  fmt::print("g 4 = {} once g is defined\n", doubled);
+
+  return before == 11 && after == 21 && kept == 21 && hidden && doubled == 8 ? 0 : 1;
+}
@@ -0,0 +1,16 @@
+/* Calls the defs of geometry.lisa through the header lisa writes for it:
+ *
+ *   lisa --emit=shared geometry.lisa
+ *   cc host.c -L. -lgeometry -Wl,-rpath,. -o host && ./host
+ *
+ * int, a C keyword, and ready? and ready!, which would both be ready_, are
+ * not exported. The exit code is 0 when every call gives the expected result.
+ */
+#include "geometry.h"
+
+int main(void) {
+  return sum_squares(3, 4) == 25
+    && inside_(0.5, 0.5, 1.0)
+    && !inside_(1.0, 1.0, 1.0)
+    && scale(1.5f, 4) == 6.0f ? 0 : 1;
+}
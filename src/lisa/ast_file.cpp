@@ -0,0 +1,539 @@
+#include <lisa/ast_file.hpp>
+#include <lisa/parser.hpp>
+#include <lisa/type_checker.hpp>
+#include <string_theory/format>
+#include <bit>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using ST::string;
+using ST::format;
+using tl::expected;
+using tl::make_unexpected;
+using std::uint32_t;
+using std::uint64_t;
+using std::vector;
+template<class T>
+using uniq = std::unique_ptr<T>;
+
+namespace lisa {
+namespace {
+constexpr char ast_magic[4] = {'L', 'A', 'S', 'T'};
+
+auto align(uint64_t offset) -> uint64_t {
+  return (offset + 7) & ~uint64_t(7);
+}
+
+// FNV-1a.
+auto hash(const string &s) -> uint64_t {
+  uint64_t h = 0xcbf29ce484222325;
+  for(std::size_t i = 0; i < s.size(); ++i) {
+    h = (h ^ static_cast<unsigned char>(s.c_str()[i])) * 0x100000001b3;
+  }
+  return h;
+}
+
+template<class T>
+auto nodes_of(const vector<uniq<T>> &v) -> vector<const node *> {
+  vector<const node *> result;
+  for(auto &&n: v) {
+    result.push_back(n.get());
+  }
+  return result;
+}
+
+auto append(vector<const node *> &to, const vector<const node *> &from) -> void {
+  to.insert(to.end(), from.cbegin(), from.cend());
+}
+}
+
+auto str_of(ast_kind kind) -> string {
+  switch(kind) {
+    case ast_kind::id: return "id";
+    case ast_kind::boolc: return "boolc";
+    case ast_kind::inum: return "inum";
+    case ast_kind::fnum: return "fnum";
+    case ast_kind::strc: return "strc";
+    case ast_kind::typed: return "typed";
+    case ast_kind::def: return "def";
+    case ast_kind::generic: return "generic";
+    case ast_kind::fn_call: return "fn_call";
+    case ast_kind::lambda: return "lambda";
+    case ast_kind::defstruct: return "defstruct";
+    case ast_kind::extern_: return "extern";
+    case ast_kind::par_reduce: return "par_reduce";
+    case ast_kind::let: return "let";
+    case ast_kind::set: return "set";
+    case ast_kind::while_: return "while";
+    case ast_kind::dotimes: return "dotimes";
+    case ast_kind::progn: return "progn";
+    default: return "unknown";
+  }
+}
+
+auto ast_writer::text(const string &s) -> uint32_t {
+  auto [it, added] = this->interned.try_emplace(std::string(s.c_str(), s.size()), this->strings.size());
+  if (added) {
+    this->strings.push_back(it->first);
+  }
+  return it->second;
+}
+
+auto id::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::id;
+  w.record.text = w.text(this->name);
+  w.record.flags = this->is_op ? ast_op : 0;
+}
+
+auto boolc::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::boolc;
+  w.record.value = this->value;
+}
+
+auto inum::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::inum;
+  w.record.value = this->number;
+  w.record.text = w.text(this->suffix);
+}
+
+auto fnum::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::fnum;
+  w.record.value = std::bit_cast<uint64_t>(this->number);
+  w.record.text = w.text(this->suffix);
+}
+
+auto strc::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::strc;
+  w.record.text = w.text(this->value);
+}
+
+// fn_name, type_params..., args..., body...
+auto def::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::def;
+  w.record.flags = (this->memo ? ast_memo : 0)
+    | (this->fast_math ? ast_fast_math : 0)
+    | (this->fp_contract ? ast_fp_contract : 0);
+  w.record.groups[0] = this->type_params.size();
+  w.record.groups[1] = this->args.size();
+  w.parts = {this->fn_name.get()};
+  append(w.parts, nodes_of(this->type_params));
+  append(w.parts, nodes_of(this->args));
+  append(w.parts, nodes_of(this->body));
+}
+
+// pattern, instances...
+auto generic::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::generic;
+  w.parts = {this->pattern.get()};
+  append(w.parts, nodes_of(this->instances));
+}
+
+// fn_name, args...
+auto fn_call::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::fn_call;
+  w.parts = {this->fn_name.get()};
+  append(w.parts, nodes_of(this->args));
+}
+
+// args..., body...
+auto lambda::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::lambda;
+  w.record.groups[0] = this->args.size();
+  w.parts = nodes_of(this->args);
+  append(w.parts, nodes_of(this->body));
+}
+
+// struct_name, fields...
+auto defstruct::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::defstruct;
+  w.parts = {this->struct_name.get()};
+  append(w.parts, nodes_of(this->fields));
+}
+
+// fn_name, ret_name if there is one, args...
+auto extern_::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::extern_;
+  w.parts = {this->fn_name.get()};
+  if (this->ret_name) {
+    w.record.flags = ast_has_ret;
+    w.parts.push_back(this->ret_name.get());
+  }
+  append(w.parts, nodes_of(this->args));
+}
+
+auto par_reduce::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::par_reduce;
+  w.parts = nodes_of(this->args);
+}
+
+// var_name, body...
+auto let::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::let;
+  w.parts = {this->var_name.get()};
+  append(w.parts, nodes_of(this->body));
+}
+
+// var_name, value...
+auto set::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::set;
+  w.parts = {this->var_name.get()};
+  append(w.parts, nodes_of(this->value));
+}
+
+auto while_::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::while_;
+  w.parts = nodes_of(this->body);
+}
+
+// var_name, body...
+auto dotimes::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::dotimes;
+  w.parts = {this->var_name.get()};
+  append(w.parts, nodes_of(this->body));
+}
+
+auto progn::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::progn;
+  w.parts = nodes_of(this->children);
+}
+
+// Every node gets its index when its parent is stored, so it is stored
+// after its parent, from an explicit stack.
+auto write_ast(const node &root, const string &source) -> expected<std::string, string> {
+  ast_writer w;
+  vector<ast_record> records(1);
+  vector<uint32_t> parts;
+  vector<std::pair<const node *, uint32_t>> stack{{&root, 0}};
+
+  while(!stack.empty()) {
+    auto [n, index] = stack.back();
+    stack.pop_back();
+    w.record = {};
+    w.record.text = no_string;
+    w.parts.clear();
+    n->store(w);
+    w.record.pos = n->pos;
+    w.record.type = n->ty ? w.text(n->ty->name) : no_string;
+    w.record.first = parts.size();
+    w.record.count = w.parts.size();
+    for(auto* p: w.parts) {
+      if (!p) {
+        return make_unexpected(string("The tree is incomplete"));
+      }
+      parts.push_back(records.size());
+      stack.push_back({p, static_cast<uint32_t>(records.size())});
+      records.emplace_back();
+    }
+    records[index] = w.record;
+  }
+  if (records.size() >= no_string || parts.size() >= no_string || w.strings.size() >= no_string) {
+    return make_unexpected(string("The tree is too large"));
+  }
+
+  vector<ast_string> strings;
+  uint64_t chars = 0;
+  for(auto &&s: w.strings) {
+    if (chars + s.size() >= no_string) {
+      return make_unexpected(string("The tree is too large"));
+    }
+    strings.push_back({static_cast<uint32_t>(chars), static_cast<uint32_t>(s.size())});
+    chars += s.size();
+  }
+
+  ast_header h{};
+  std::memcpy(h.magic, ast_magic, sizeof(ast_magic));
+  h.version = ast_version;
+  h.source_hash = hash(source);
+  h.node_count = records.size();
+  h.part_count = parts.size();
+  h.string_count = strings.size();
+  h.nodes = align(sizeof(ast_header));
+  h.parts = align(h.nodes + records.size() * sizeof(ast_record));
+  h.strings = align(h.parts + parts.size() * sizeof(uint32_t));
+  h.chars = align(h.strings + strings.size() * sizeof(ast_string));
+  h.size = h.chars + chars;
+
+  std::string result(h.size, '\0');
+  std::memcpy(result.data(), &h, sizeof(h));
+  std::memcpy(result.data() + h.nodes, records.data(), records.size() * sizeof(ast_record));
+  std::memcpy(result.data() + h.parts, parts.data(), parts.size() * sizeof(uint32_t));
+  std::memcpy(result.data() + h.strings, strings.data(), strings.size() * sizeof(ast_string));
+  auto* out = result.data() + h.chars;
+  for(auto &&s: w.strings) {
+    std::memcpy(out, s.data(), s.size());
+    out += s.size();
+  }
+  return result;
+}
+
+// Everything a reader indexes is checked once here, so that the accessors
+// need no checks and a damaged file cannot make them read out of bounds.
+auto ast_view::open(std::string_view bytes) -> expected<ast_view, string> {
+  auto fail = [](const char* msg) { return make_unexpected(string(msg)); };
+  if (reinterpret_cast<std::uintptr_t>(bytes.data()) % alignof(ast_record) != 0) {
+    return fail("The AST file is not aligned to 8 bytes");
+  }
+  if (bytes.size() < sizeof(ast_header)) {
+    return fail("The AST file is truncated");
+  }
+  auto &h = *reinterpret_cast<const ast_header *>(bytes.data());
+  if (std::memcmp(h.magic, ast_magic, sizeof(ast_magic)) != 0) {
+    return fail("This is not an AST file");
+  }
+  if (h.version != ast_version) {
+    return make_unexpected(format("The AST file has version {}, not {}", h.version, ast_version));
+  }
+  auto within = [&](uint64_t offset, uint64_t count, uint64_t size) {
+    return offset % 8 == 0 && offset <= h.size && count <= (h.size - offset) / size;
+  };
+  if (h.size != bytes.size() || h.node_count == 0
+      || !within(h.nodes, h.node_count, sizeof(ast_record))
+      || !within(h.parts, h.part_count, sizeof(uint32_t))
+      || !within(h.strings, h.string_count, sizeof(ast_string))
+      || !within(h.chars, 0, 1)) {
+    return fail("The AST file is truncated");
+  }
+
+  ast_view view;
+  view.data = bytes.data();
+  for(uint32_t i = 0; i < h.string_count; ++i) {
+    auto &s = reinterpret_cast<const ast_string *>(view.data + h.strings)[i];
+    if (uint64_t(s.offset) + s.size > h.size - h.chars) {
+      return fail("The AST file has a string out of bounds");
+    }
+  }
+  for(uint32_t i = 0; i < h.node_count; ++i) {
+    auto &r = view.record(i);
+    if (r.kind > ast_kind::progn
+        || (r.text != no_string && r.text >= h.string_count)
+        || (r.type != no_string && r.type >= h.string_count)
+        || uint64_t(r.first) + r.count > h.part_count
+        || uint64_t(r.groups[0]) + r.groups[1] > r.count) {
+      return make_unexpected(format("The AST file has a damaged node {}", i));
+    }
+    for(auto p: view.parts(i)) {
+      if (p <= i || p >= h.node_count) {
+        return make_unexpected(format("The AST file has a damaged node {}", i));
+      }
+    }
+  }
+  return view;
+}
+
+auto ast_view::header() const -> const ast_header& {
+  return *reinterpret_cast<const ast_header *>(this->data);
+}
+
+auto ast_view::size() const -> uint32_t {
+  return this->header().node_count;
+}
+
+auto ast_view::record(uint32_t i) const -> const ast_record& {
+  return reinterpret_cast<const ast_record *>(this->data + this->header().nodes)[i];
+}
+
+auto ast_view::parts(uint32_t i) const -> std::span<const uint32_t> {
+  auto &r = this->record(i);
+  return {reinterpret_cast<const uint32_t *>(this->data + this->header().parts) + r.first, r.count};
+}
+
+auto ast_view::text(uint32_t i) const -> std::string_view {
+  if (i == no_string) {
+    return {};
+  }
+  auto &s = reinterpret_cast<const ast_string *>(this->data + this->header().strings)[i];
+  return {this->data + this->header().chars + s.offset, s.size};
+}
+
+auto ast_view::matches(const string &source) const -> bool {
+  return this->header().source_hash == hash(source);
+}
+
+namespace {
+// Builds a node from its record and its parts, which have the kinds its
+// store hook gives them; null if they do not.
+struct loader {
+  const ast_view &view;
+  const ast_record &r;
+  vector<uniq<node>> parts;
+  std::size_t next = 0;
+  bool ok = true;
+
+  auto text() const -> string {
+    auto s = this->view.text(this->r.text);
+    return string(s.data(), s.size());
+  }
+
+  template<class T>
+  auto take() -> uniq<T> {
+    if (this->next >= this->parts.size()) {
+      this->ok = false;
+      return nullptr;
+    }
+    auto &p = this->parts[this->next++];
+    auto* t = dynamic_cast<T *>(p.get());
+    if (!t) {
+      this->ok = false;
+      return nullptr;
+    }
+    p.release();
+    return uniq<T>(t);
+  }
+
+  template<class T>
+  auto take(std::size_t count) -> vector<uniq<T>> {
+    vector<uniq<T>> result;
+    for(std::size_t i = 0; i < count; ++i) {
+      result.push_back(this->take<T>());
+    }
+    return result;
+  }
+
+  auto rest() -> vector<uniq<node>> {
+    return this->take<node>(this->parts.size() - this->next);
+  }
+
+  auto is_id(std::size_t i) const -> bool {
+    return dynamic_cast<const id *>(this->parts[i].get());
+  }
+
+  // Whether the record has as many parts as its kind needs. The parser
+  // leaves some of these counts to the checker, but a tree with one wrong
+  // fails to check anyway, so it is parsed again from the source instead.
+  auto counts_fit() const -> bool {
+    auto n = static_cast<std::uint64_t>(this->parts.size());
+    auto* g = this->r.groups;
+    switch(this->r.kind) {
+    case ast_kind::id:
+    case ast_kind::boolc:
+    case ast_kind::inum:
+    case ast_kind::fnum:
+    case ast_kind::strc:
+      return n == 0;
+    case ast_kind::typed:
+      return n == 2;
+    case ast_kind::def:
+      return 1 + std::uint64_t{g[0]} + g[1] <= n;
+    case ast_kind::lambda:
+      return g[0] <= n;
+    case ast_kind::generic:
+    case ast_kind::fn_call:
+    case ast_kind::defstruct:
+    case ast_kind::while_:
+      return n >= 1;
+    case ast_kind::extern_:
+      return n >= (this->r.flags & ast_has_ret ? 2 : 1);
+    case ast_kind::par_reduce:
+      return n == 5 && this->is_id(2) && this->is_id(4);
+    case ast_kind::let:
+    case ast_kind::dotimes:
+      return n >= 2;
+    case ast_kind::set:
+      return n == 2;
+    case ast_kind::progn:
+      return true;
+    }
+    return false;
+  }
+
+  auto load() -> uniq<node> {
+    if (!this->counts_fit()) {
+      return nullptr;
+    }
+    auto pos = static_cast<std::size_t>(this->r.pos);
+    auto* g = this->r.groups;
+    switch(this->r.kind) {
+    case ast_kind::id:
+      return std::make_unique<id>(pos, this->text(), this->r.flags & ast_op);
+    case ast_kind::boolc:
+      return std::make_unique<boolc>(pos, this->r.value != 0);
+    case ast_kind::inum:
+      return std::make_unique<inum>(pos, this->r.value, this->text());
+    case ast_kind::fnum:
+      return std::make_unique<fnum>(pos, std::bit_cast<double>(this->r.value), this->text());
+    case ast_kind::strc:
+      return std::make_unique<strc>(pos, this->text());
+    case ast_kind::typed: {
+      auto ty_name = this->take<id>();
+      return std::make_unique<typed<id>>(pos, std::move(ty_name), this->take<id>());
+    }
+    case ast_kind::def: {
+      auto fn_name = this->take<id>();
+      auto type_params = this->take<id>(g[0]);
+      auto args = this->take<typed<id>>(g[1]);
+      auto d = std::make_unique<def>(pos, std::move(fn_name), std::move(args), this->rest(), this->r.flags & ast_memo);
+      d->type_params = std::move(type_params);
+      d->fast_math = this->r.flags & ast_fast_math;
+      d->fp_contract = this->r.flags & ast_fp_contract;
+      return d;
+    }
+    case ast_kind::generic: {
+      auto result = std::make_unique<generic>(pos, this->take<def>());
+      result->instances = this->rest();
+      return result;
+    }
+    case ast_kind::fn_call: {
+      auto fn_name = this->take<id>();
+      return std::make_unique<fn_call>(pos, std::move(fn_name), this->rest());
+    }
+    case ast_kind::lambda: {
+      auto args = this->take<typed<id>>(g[0]);
+      return std::make_unique<lambda>(pos, std::move(args), this->rest());
+    }
+    case ast_kind::defstruct: {
+      auto name = this->take<id>();
+      return std::make_unique<defstruct>(pos, std::move(name), this->take<typed<id>>(this->parts.size() - this->next));
+    }
+    case ast_kind::extern_: {
+      auto fn_name = this->take<id>();
+      auto ret_name = this->r.flags & ast_has_ret ? this->take<id>() : nullptr;
+      auto args = this->take<typed<id>>(this->parts.size() - this->next);
+      return std::make_unique<extern_>(pos, std::move(fn_name), std::move(args), std::move(ret_name));
+    }
+    case ast_kind::par_reduce:
+      return std::make_unique<par_reduce>(pos, this->rest());
+    case ast_kind::let: {
+      auto var_name = this->take<id>();
+      return std::make_unique<let>(pos, std::move(var_name), this->rest());
+    }
+    case ast_kind::set: {
+      auto var_name = this->take<id>();
+      return std::make_unique<set>(pos, std::move(var_name), this->rest());
+    }
+    case ast_kind::while_:
+      return std::make_unique<while_>(pos, this->rest());
+    case ast_kind::dotimes: {
+      auto var_name = this->take<id>();
+      return std::make_unique<dotimes>(pos, std::move(var_name), this->rest());
+    }
+    case ast_kind::progn:
+      return std::make_unique<progn>(pos, this->rest());
+    }
+    return nullptr;
+  }
+};
+}
+
+// Parts have larger indices than their nodes, so the nodes are built from
+// the last to the first and each finds its parts already built.
+auto read_ast(const ast_view &view) -> expected<uniq<node>, string> {
+  vector<uniq<node>> built(view.size());
+  for(auto i = view.size(); i-- > 0;) {
+    auto l = loader{view, view.record(i), {}};
+    for(auto p: view.parts(i)) {
+      if (!built[p]) {
+        return make_unexpected(format("Node {} is a part of more than one node", p));
+      }
+      l.parts.push_back(std::move(built[p]));
+    }
+    auto n = l.load();
+    if (!n || !l.ok) {
+      return make_unexpected(format("Node {} has the wrong number or kinds of parts", i));
+    }
+    built[i] = std::move(n);
+  }
+  return std::move(built[0]);
+}
+}
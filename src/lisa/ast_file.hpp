@@ -0,0 +1,121 @@
+#ifndef LISA_AST_FILE
+#define LISA_AST_FILE
+#include <string_theory/string>
+#include <tl/expected.hpp>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace lisa {
+struct node;
+
+// The binary form of a tree, which can be mapped from a file and read in
+// place. It starts with an ast_header and holds, each at an offset aligned
+// to 8 bytes, an array of fixed-size records, one per node, the parts of
+// each node as indices of records, and the strings of the tree. A node is
+// stored before its parts, so every part has a larger index than its node,
+// and the root is record 0. Numbers are in the byte order of the writer;
+// a file of the other order fails the version check.
+//
+// The records keep positions and, for a checked tree, the name of the type
+// of every node, but not what else the checker adds. Reading the file back
+// gives the tree without types: a tree written right after parsing can be
+// checked and compiled as if it had been parsed again.
+inline constexpr std::uint32_t ast_version = 1;
+
+enum class ast_kind : std::uint8_t {
+  id, boolc, inum, fnum, strc, typed, def, generic, fn_call, lambda,
+  defstruct, extern_, par_reduce, let, set, while_, dotimes, progn
+};
+
+auto str_of(ast_kind) -> ST::string;
+
+struct ast_header {
+  char magic[4];
+  std::uint32_t version;
+  // A hash of the source the tree was parsed from, to tell whether it
+  // changed.
+  std::uint64_t source_hash;
+  std::uint32_t node_count;
+  std::uint32_t part_count;
+  std::uint32_t string_count;
+  std::uint32_t reserved;
+  std::uint64_t nodes;
+  std::uint64_t parts;
+  std::uint64_t strings;
+  std::uint64_t chars;
+  std::uint64_t size;
+};
+
+inline constexpr std::uint32_t no_string = 0xffffffff;
+
+// The parts of a node are `count` indices from `first` on. Nodes with more
+// than one list of parts, such as a def, give the sizes of all but the last
+// in `groups`. What `text`, `value` and `flags` hold depends on the kind.
+struct ast_record {
+  std::uint64_t pos;
+  std::uint64_t value;
+  std::uint32_t text;
+  std::uint32_t type;
+  std::uint32_t first;
+  std::uint32_t count;
+  std::uint32_t groups[2];
+  ast_kind kind;
+  std::uint8_t flags;
+  std::uint8_t reserved[6];
+};
+
+struct ast_string {
+  std::uint32_t offset;
+  std::uint32_t size;
+};
+
+// Flags of the records.
+inline constexpr std::uint8_t ast_op = 1;
+inline constexpr std::uint8_t ast_memo = 1;
+inline constexpr std::uint8_t ast_fast_math = 2;
+inline constexpr std::uint8_t ast_fp_contract = 4;
+inline constexpr std::uint8_t ast_has_ret = 1;
+
+// What node::store fills in for one node: its record, but for the indices,
+// and its parts in order.
+struct ast_writer {
+  ast_record record;
+  std::vector<const node *> parts;
+
+  // The index of a string, which is stored once however often it occurs.
+  auto text(const ST::string &) -> std::uint32_t;
+
+  std::vector<std::string> strings;
+  std::unordered_map<std::string, std::uint32_t> interned;
+};
+
+auto write_ast(const node &, const ST::string &source) -> tl::expected<std::string, ST::string>;
+
+// A checked view of the bytes of a file written by write_ast. It does not
+// copy them, so they must outlive it and be aligned to 8 bytes, as mapped
+// files are.
+struct ast_view {
+  static auto open(std::string_view) -> tl::expected<ast_view, ST::string>;
+
+  auto header() const -> const ast_header&;
+  auto size() const -> std::uint32_t;
+  auto record(std::uint32_t) const -> const ast_record&;
+  auto parts(std::uint32_t) const -> std::span<const std::uint32_t>;
+  auto text(std::uint32_t) const -> std::string_view;
+  // Whether the tree was parsed from `source`.
+  auto matches(const ST::string &source) const -> bool;
+
+private:
+  const char* data = nullptr;
+};
+
+auto read_ast(const ast_view &) -> tl::expected<std::unique_ptr<node>, ST::string>;
+}
+
+#endif
@@ -1,14 +1,23 @@
 #include <lisa/type_checker.hpp>
 #include <lisa/primitive.hpp>
 #include <lisa/compiler.hpp>
+#include <lisa/escape.hpp>
 #include <lisa/parser.hpp>
+#include <string_theory/format>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/Type.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/APInt.h>
+#include <llvm/Support/ErrorHandling.h>
 #include <algorithm>
 #include <iterator>
 
@@ -17,8 +26,16 @@ using lisa::compiler;
 using llvm::FunctionType;
 using llvm::ConstantInt;
 using llvm::BasicBlock;
+using llvm::AllocaInst;
+using llvm::IRBuilder;
 using llvm::ConstantFP;
 using llvm::Function;
+using llvm::GlobalValue;
+using llvm::GlobalVariable;
+using llvm::ConstantPointerNull;
+using llvm::Constant;
+using llvm::StructType;
+using llvm::FastMathFlags;
 using llvm::APFloat;
 using llvm::APInt;
 using llvm::Value;
@@ -29,16 +46,50 @@ using std::transform;
 using std::vector;
 using std::size_t;
 using ST::string;
+using ST::format;
 
 namespace lisa {
+auto region_type(llvm::LLVMContext &c) -> StructType* {
+  if (auto* r = StructType::getTypeByName(c, "lisa.region"); r) {
+    return r;
+  }
+  auto* i8p = Type::getInt8PtrTy(c);
+  return StructType::create(c, {i8p, i8p, i8p}, "lisa.region");
+}
+
+// The attributes type_checker::infer_attributes proved for a function.
+auto add_attributes(Function* fn, const fn_type& type) -> void {
+  if (type.readnone) {
+    fn->setDoesNotAccessMemory();
+  }
+  if (type.nounwind) {
+    fn->setDoesNotThrow();
+  }
+  if (type.willreturn) {
+    fn->addFnAttr(llvm::Attribute::WillReturn);
+  }
+  if (type.norecurse) {
+    fn->addFnAttr(llvm::Attribute::NoRecurse);
+  }
+}
+
+// A def that returns a list or a string takes the region to allocate it in
+// as a hidden first argument.
 auto gen_fn_decl(compiler& c, const string& name, const fn_type& type) {
   if (auto p = prim_fn::find(name); p) {
     return;
   }
+  if (auto i = intrinsic_fn::find(name, type); i && type.external && type.pure) {
+    c.intrinsics[name] = llvm::Intrinsic::getDeclaration(&c.module, i->id, {type.ret->to_llvm(c.context)});
+    return;
+  }
   vector<Type *> args_t;
+  if (is_heap(type.ret)) {
+    args_t.push_back(region_type(c.context)->getPointerTo());
+  }
   transform(type.args.cbegin(), type.args.cend(), back_inserter(args_t),
-      [&](auto &&t) { return t->raw(c.context); });
-  auto* ret_t = type.ret->raw(c.context);
+      [&](auto &&t) { return t->to_llvm(c.context); });
+  auto* ret_t = type.ret->to_llvm(c.context);
   auto* fn_t = FunctionType::get(ret_t, args_t, false);
   auto* fn = Function::Create(
     fn_t,
@@ -46,32 +97,328 @@ auto gen_fn_decl(compiler& c, const string& name, const fn_type& type) {
     name.c_str(),
     c.module
   );
+  add_attributes(fn, type);
+  // Results narrower than an int are extended as C callers expect; see
+  // c_header.
+  if (!type.external && type.ret == &bool_) {
+    fn->addRetAttr(llvm::Attribute::ZExt);
+  }
+  else if (!type.external && (type.ret == &i8 || type.ret == &i16)) {
+    fn->addRetAttr(llvm::Attribute::SExt);
+  }
 }
 
 auto compiler::compile(const unordered_map<string, fn_type> &fn_table) -> void {
+  auto &o = this->options;
+  if (this->src && (o.remarks_passed || o.remarks_missed || o.remarks_analysis)) {
+    this->debug_info = std::make_unique<llvm::DIBuilder>(this->module);
+    this->debug_file = this->debug_info->createFile(this->module.getModuleIdentifier(), ".");
+    this->debug_info->createCompileUnit(
+        llvm::dwarf::DW_LANG_C, this->debug_file, "lisa", o.opt_level > 0, "", 0, "",
+        llvm::DICompileUnit::LineTablesOnly);
+    this->module.addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+  }
   for(auto&& [name, type]: fn_table) {
     gen_fn_decl(*this, name, type);
   }
 }
 
 auto compiler::compile(const node &ast) -> void {
-  ast.gen(*this);
+  struct frame {
+    const node* target;
+    vector<node *> subnodes;
+    vector<Value *> values;
+  };
+  vector<frame> stack;
+  this->locate(ast.pos);
+  ast.enter(*this);
+  stack.push_back({&ast, ast.subnodes(), {}});
+
+  while(true) {
+    auto &top = stack.back();
+    if (top.values.size() < top.subnodes.size()) {
+      auto* next = top.subnodes[top.values.size()];
+      this->locate(next->pos);
+      next->enter(*this);
+      stack.push_back({next, next->subnodes(), {}});
+      continue;
+    }
+    this->locate(top.target->pos);
+    auto* result = top.target->gen(*this, top.values);
+    stack.pop_back();
+    if (stack.empty()) {
+      return;
+    }
+    auto &parent = stack.back();
+    parent.values.push_back(result);
+    parent.target->step(*this, parent.values);
+  }
+}
+
+namespace {
+// Collects the requested kinds of remarks, from the optimization pipeline
+// as well as from code generation.
+struct remark_collector : llvm::DiagnosticHandler {
+  compiler &c;
+
+  explicit remark_collector(compiler &c) : c(c) {}
+
+  auto isPassedOptRemarkEnabled(llvm::StringRef) const -> bool override {
+    return this->c.options.remarks_passed;
+  }
+
+  auto isMissedOptRemarkEnabled(llvm::StringRef) const -> bool override {
+    return this->c.options.remarks_missed;
+  }
+
+  auto isAnalysisRemarkEnabled(llvm::StringRef) const -> bool override {
+    return this->c.options.remarks_analysis;
+  }
+
+  auto isAnyRemarkEnabled() const -> bool override {
+    auto &o = this->c.options;
+    return o.remarks_passed || o.remarks_missed || o.remarks_analysis;
+  }
+
+  auto handleDiagnostics(const llvm::DiagnosticInfo &di) -> bool override {
+    auto* r = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&di);
+    if (!r) {
+      return false;
+    }
+
+    remark_kind kind;
+    switch(r->getKind()) {
+    case llvm::DK_OptimizationRemark:
+    case llvm::DK_MachineOptimizationRemark:
+      kind = remark_kind::passed;
+      break;
+    case llvm::DK_OptimizationRemarkMissed:
+    case llvm::DK_MachineOptimizationRemarkMissed:
+      kind = remark_kind::missed;
+      break;
+    case llvm::DK_OptimizationRemarkAnalysis:
+    case llvm::DK_OptimizationRemarkAnalysisFPCommute:
+    case llvm::DK_OptimizationRemarkAnalysisAliasing:
+    case llvm::DK_MachineOptimizationRemarkAnalysis:
+      kind = remark_kind::analysis;
+      break;
+    default:
+      return false;
+    }
+
+    // Code without a line location, such as a def-memo wrapper, is
+    // reported at its def.
+    auto fn = string(r->getFunction().getName().str().c_str());
+    std::size_t pos = 0;
+    if (r->isLocationAvailable()) {
+      auto loc = r->getLocation();
+      pos = this->c.offset_of(loc.getLine(), loc.getColumn());
+    }
+    else if (auto it = this->c.fn_pos.find(fn); it != this->c.fn_pos.end()) {
+      pos = it->second;
+    }
+
+    this->c.remarks.push_back({
+      kind, pos, string(r->getPassName()), string(r->getRemarkName().str().c_str()), fn, string(r->getMsg().c_str())
+    });
+    return true;
+  }
+};
+}
+
+auto compiler::optimize() -> void {
+  if (this->debug_info) {
+    this->debug_info->finalize();
+  }
+  auto &o = this->options;
+  if (o.remarks_passed || o.remarks_missed || o.remarks_analysis) {
+    this->context.setDiagnosticHandler(std::make_unique<remark_collector>(*this), true);
+  }
+
+  if (this->options.opt_level == 0) {
+    return;
+  }
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cgam;
+  llvm::ModuleAnalysisManager mam;
+  llvm::PassBuilder pb;
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+  auto level = this->options.opt_level == 1 ? llvm::OptimizationLevel::O1
+    : this->options.opt_level == 2 ? llvm::OptimizationLevel::O2
+    : llvm::OptimizationLevel::O3;
+  pb.buildPerModuleDefaultPipeline(level).run(this->module, mam);
+}
+
+// Attaches the position to the code generated from now on, if it is in a
+// def that has a subprogram.
+auto compiler::locate(size_t pos) -> void {
+  if (!this->debug_scope) {
+    this->builder.SetCurrentDebugLocation(llvm::DebugLoc());
+    return;
+  }
+  auto p = this->src->pos_of(pos);
+  this->builder.SetCurrentDebugLocation(
+      llvm::DILocation::get(this->context, p.line, p.character, this->debug_scope));
+}
+
+auto compiler::offset_of(size_t line, size_t column) const -> size_t {
+  if (!this->src || line == 0 || line > this->src->line_starts.size()) {
+    return 0;
+  }
+  return this->src->line_starts[line - 1] + (column > 0 ? column - 1 : 0);
+}
+
+// Allocas go to the top of the entry block, where mem2reg can promote them.
+auto entry_alloca(compiler &c, Type* t, const string &name) -> AllocaInst* {
+  auto &entry = c.builder.GetInsertBlock()->getParent()->getEntryBlock();
+  IRBuilder<> b(&entry, entry.begin());
+  return b.CreateAlloca(t, nullptr, name.c_str());
+}
+
+// The fast path only moves `cur`; lisa_region_grow starts a new chunk,
+// which is also how an empty region, whose `cur` and `end` are null, gets
+// its first one. Sizes are rounded up to 8 bytes to keep cells aligned.
+auto compiler::allocate(Value* size) -> Value* {
+  auto* region_t = region_type(this->context);
+  auto* i8p = this->builder.getInt8PtrTy();
+  auto* i64 = this->builder.getInt64Ty();
+  auto* f = this->builder.GetInsertBlock()->getParent();
+  auto* bump = BasicBlock::Create(this->context, "alloc.bump", f);
+  auto* grow = BasicBlock::Create(this->context, "alloc.grow", f);
+  auto* done = BasicBlock::Create(this->context, "alloc.done", f);
+
+  size = this->builder.CreateAnd(this->builder.CreateAdd(size, this->builder.getInt64(7)), this->builder.getInt64(~7ull));
+  auto* cur_slot = this->builder.CreateStructGEP(region_t, this->alloc_region, 1);
+  auto* end_slot = this->builder.CreateStructGEP(region_t, this->alloc_region, 2);
+  auto* cur = this->builder.CreateLoad(i8p, cur_slot, "cur");
+  auto* end = this->builder.CreateLoad(i8p, end_slot, "end");
+  auto* next = this->builder.CreateGEP(this->builder.getInt8Ty(), cur, size, "next");
+  auto* fits = this->builder.CreateICmpULE(
+      this->builder.CreatePtrToInt(next, i64), this->builder.CreatePtrToInt(end, i64));
+  this->builder.CreateCondBr(fits, bump, grow);
+
+  this->builder.SetInsertPoint(bump);
+  this->builder.CreateStore(next, cur_slot);
+  this->builder.CreateBr(done);
+
+  this->builder.SetInsertPoint(grow);
+  auto grow_fn = this->module.getOrInsertFunction("lisa_region_grow", i8p, region_t->getPointerTo(), i64);
+  auto* fresh = this->builder.CreateCall(grow_fn, {this->alloc_region, size}, "fresh");
+  this->builder.CreateBr(done);
+
+  this->builder.SetInsertPoint(done);
+  auto* result = this->builder.CreatePHI(i8p, 2, "block");
+  result->addIncoming(cur, bump);
+  result->addIncoming(fresh, grow);
+  return result;
 }
 
-auto id::gen(compiler &c) const -> Value* {
-  return c.var_table[this->name].value;
+auto compiler::leave() -> void {
+  if (!this->region) {
+    return;
+  }
+  auto release = this->module.getOrInsertFunction("lisa_region_release",
+      this->builder.getVoidTy(), region_type(this->context)->getPointerTo());
+  this->builder.CreateCall(release, {this->region});
 }
 
-auto boolc::gen(compiler &c) const -> Value* {
+auto compiler::suspend() -> void {
+  this->suspended.push_back({
+    this->builder.saveIP(),
+    std::move(this->var_table),
+    std::move(this->scopes),
+    std::move(this->loops),
+    this->region,
+    this->ret_region,
+    std::move(this->escaping),
+    this->debug_scope
+  });
+  this->var_table.clear();
+  this->scopes.clear();
+  this->loops.clear();
+  this->escaping.clear();
+  this->region = nullptr;
+  this->ret_region = nullptr;
+  this->debug_scope = nullptr;
+}
+
+auto compiler::resume() -> void {
+  auto &s = this->suspended.back();
+  this->builder.restoreIP(s.point);
+  this->var_table = std::move(s.var_table);
+  this->scopes = std::move(s.scopes);
+  this->loops = std::move(s.loops);
+  this->region = s.region;
+  this->ret_region = s.ret_region;
+  this->escaping = std::move(s.escaping);
+  this->debug_scope = s.debug_scope;
+  this->suspended.pop_back();
+}
+
+auto compiler::bind(const string &name, Value* init) -> void {
+  auto* slot = entry_alloca(*this, init->getType(), name);
+  this->builder.CreateStore(init, slot);
+
+  auto it = this->var_table.find(name);
+  this->scopes.push_back({name, it != this->var_table.end() ? std::optional(it->second) : std::nullopt});
+  this->var_table[name] = variable{slot};
+}
+
+auto compiler::unbind() -> void {
+  auto [name, shadowed] = std::move(this->scopes.back());
+  this->scopes.pop_back();
+  if (shadowed) {
+    this->var_table[name] = *shadowed;
+  }
+  else {
+    this->var_table.erase(name);
+  }
+}
+
+// Whether the current block already ends, e.g. with a `return`.
+auto terminated(compiler &c) -> bool {
+  return c.builder.GetInsertBlock()->getTerminator() != nullptr;
+}
+
+auto node::enter(compiler &) const -> void {}
+
+auto node::step(compiler &, const vector<Value *> &) const -> void {}
+
+auto id::gen(compiler &c, const vector<Value *> &) const -> Value* {
+  auto* slot = c.var_table[this->name].slot;
+  return c.builder.CreateLoad(slot->getAllocatedType(), slot, this->name.c_str());
+}
+
+auto boolc::gen(compiler &c, const vector<Value *> &) const -> Value* {
   return c.builder.getInt1(this->value);
 }
 
-auto inum::gen(compiler &c) const -> Value* {
-  return ConstantInt::get(c.context, APInt(32, this->number));
+auto inum::gen(compiler &c, const vector<Value *> &) const -> Value* {
+  auto* t = this->ty->to_llvm(c.context);
+  if (t->isFloatingPointTy()) {
+    return ConstantFP::get(t, static_cast<double>(this->number));
+  }
+  return ConstantInt::get(t, this->number);
 }
 
-auto fnum::gen(compiler &c) const -> Value* {
-  return ConstantFP::get(c.context, APFloat(this->number));
+auto fnum::gen(compiler &c, const vector<Value *> &) const -> Value* {
+  return ConstantFP::get(this->ty->to_llvm(c.context), this->number);
+}
+
+// Laid out like a lisa_str, including the terminating zero.
+auto strc::gen(compiler &c, const vector<Value *> &) const -> Value* {
+  auto* data = llvm::ConstantDataArray::getString(c.context, this->value.c_str(), true);
+  auto* init = llvm::ConstantStruct::getAnon({c.builder.getInt64(this->value.size()), data});
+  auto* global = new GlobalVariable(c.module, init->getType(), true, GlobalValue::PrivateLinkage, init, "str");
+  global->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  global->setAlignment(llvm::Align(8));
+  return c.builder.CreateBitCast(global, str_.to_llvm(c.context));
 }
 
 auto get_fn(compiler &c, const def & fn_def) -> Function* {
@@ -83,50 +430,477 @@ auto get_fn(compiler &c, const def & fn_def) -> Function* {
   }
 }
 
-auto def::gen(compiler &c) const -> Value* {
+auto widen(compiler &c, Value* v) -> Value* {
+  auto* t = v->getType();
+  if (t->isFloatingPointTy()) {
+    v = c.builder.CreateBitCast(v, c.builder.getIntNTy(t->getPrimitiveSizeInBits()));
+  }
+  return c.builder.CreateZExt(v, c.builder.getInt64Ty());
+}
+
+auto narrow(compiler &c, Value* v, Type* t) -> Value* {
+  if (t->isFloatingPointTy()) {
+    return c.builder.CreateBitCast(c.builder.CreateTrunc(v, c.builder.getIntNTy(t->getPrimitiveSizeInBits())), t);
+  }
+  return c.builder.CreateTrunc(v, t);
+}
+
+// Fills `f` with a lookup in its memo table and returns the function that
+// must receive the original body; `f` only calls it on a miss. The table
+// serves calls from other defs: a def's name is only known once its body
+// is typed, so no def calls itself.
+auto gen_memo_wrapper(compiler &c, Function* f) -> Function* {
+  auto* impl = Function::Create(
+    f->getFunctionType(),
+    Function::InternalLinkage,
+    f->getName() + ".body",
+    c.module
+  );
+
+  auto* i8p = c.builder.getInt8PtrTy();
+  auto* i32 = c.builder.getInt32Ty();
+  auto* i64 = c.builder.getInt64Ty();
+  auto* i64p = i64->getPointerTo();
+  auto memo_new = c.module.getOrInsertFunction("lisa_memo_new", i8p, i32, i32, i32);
+  auto memo_lookup = c.module.getOrInsertFunction("lisa_memo_lookup", i32, i8p, i64p, i64p);
+  auto memo_store = c.module.getOrInsertFunction("lisa_memo_store", c.builder.getVoidTy(), i8p, i64p, i64);
+  auto* slot = new GlobalVariable(c.module, i8p, false, GlobalValue::InternalLinkage,
+      ConstantPointerNull::get(i8p), f->getName() + ".memo");
+
+  auto* entry = BasicBlock::Create(c.context, "entry", f);
+  auto* init = BasicBlock::Create(c.context, "init", f);
+  auto* probe = BasicBlock::Create(c.context, "probe", f);
+  auto* hit = BasicBlock::Create(c.context, "hit", f);
+  auto* miss = BasicBlock::Create(c.context, "miss", f);
+  auto arity = static_cast<std::uint32_t>(f->arg_size());
+
+  c.builder.SetInsertPoint(entry);
+  auto* key = c.builder.CreateAlloca(i64, c.builder.getInt32(arity ? arity : 1), "key");
+  auto* cached = c.builder.CreateAlloca(i64, nullptr, "cached");
+  // par-reduce may call the wrapper from several threads at once; a lost
+  // race only leaks one table.
+  auto* table = c.builder.CreateLoad(i8p, slot, "table");
+  table->setAlignment(llvm::Align(8));
+  table->setAtomic(llvm::AtomicOrdering::Acquire);
+  c.builder.CreateCondBr(c.builder.CreateIsNull(table), init, probe);
+
+  c.builder.SetInsertPoint(init);
+  auto* fresh = c.builder.CreateCall(memo_new, {
+      c.builder.getInt32(arity),
+      c.builder.getInt32(c.options.memo_capacity),
+      c.builder.getInt32(c.options.memo_policy)}, "fresh");
+  auto* publish = c.builder.CreateStore(fresh, slot);
+  publish->setAlignment(llvm::Align(8));
+  publish->setAtomic(llvm::AtomicOrdering::Release);
+  c.builder.CreateBr(probe);
+
+  c.builder.SetInsertPoint(probe);
+  auto* memo = c.builder.CreatePHI(i8p, 2, "memo");
+  memo->addIncoming(table, entry);
+  memo->addIncoming(fresh, init);
+  vector<Value *> args;
+  for(auto &&a : f->args()) {
+    c.builder.CreateStore(widen(c, &a), c.builder.CreateConstGEP1_32(i64, key, a.getArgNo()));
+    args.push_back(&a);
+  }
+  auto* found = c.builder.CreateCall(memo_lookup, {memo, key, cached}, "found");
+  c.builder.CreateCondBr(c.builder.CreateICmpNE(found, c.builder.getInt32(0)), hit, miss);
+
+  c.builder.SetInsertPoint(hit);
+  c.builder.CreateRet(narrow(c, c.builder.CreateLoad(i64, cached), f->getReturnType()));
+
+  c.builder.SetInsertPoint(miss);
+  auto* result = c.builder.CreateCall(impl, args, "result");
+  c.builder.CreateCall(memo_store, {memo, key, widen(c, result)});
+  c.builder.CreateRet(result);
+
+  return impl;
+}
+
+auto open_subprogram(compiler &c, Function* f, size_t pos) -> void {
+  auto line = c.src->pos_of(pos).line;
+  auto flags = llvm::DISubprogram::SPFlagDefinition;
+  if (c.options.opt_level > 0) {
+    flags |= llvm::DISubprogram::SPFlagOptimized;
+  }
+  c.debug_scope = c.debug_info->createFunction(
+      c.debug_file, f->getName(), f->getName(), c.debug_file, line,
+      c.debug_info->createSubroutineType(c.debug_info->getOrCreateTypeArray({})),
+      line, llvm::DINode::FlagZero, flags);
+  f->setSubprogram(c.debug_scope);
+  c.locate(pos);
+}
+
+// A region for what the function allocates and does not return, emptied
+// by compiler::leave.
+auto local_region(compiler &c) -> Value* {
+  auto* region_t = region_type(c.context);
+  auto* region = entry_alloca(c, region_t, "region");
+  c.builder.CreateStore(Constant::getNullValue(region_t), region);
+  return region;
+}
+
+auto def::enter(compiler &c) const -> void {
+  c.debug_scope = nullptr;
+  c.locate(this->pos);
+
   Function* f = get_fn(c, *this);
+  c.fn_pos[this->fn_name->name] = this->pos;
+  if (this->memo) {
+    f = gen_memo_wrapper(c, f);
+    c.fn_pos[f->getName().str().c_str()] = this->pos;
+  }
   BasicBlock* block = BasicBlock::Create(c.context, "entry", f);
   c.builder.SetInsertPoint(block);
 
+  if (c.debug_info) {
+    open_subprogram(c, f, this->pos);
+  }
+
+  FastMathFlags fmf;
+  if (c.options.fast_math || this->fast_math) {
+    fmf.setFast();
+  }
+  else if (c.options.fp_contract || this->fp_contract) {
+    fmf.setAllowContract();
+  }
+  c.builder.setFastMathFlags(fmf);
+
   c.var_table.clear();
-  size_t i = 0;
+  c.scopes.clear();
+  c.loops.clear();
+
+  auto escapes = analyze_escapes(*this);
+  c.escaping = std::move(escapes.escaping);
+  c.region = escapes.local ? local_region(c) : nullptr;
+  c.ret_region = nullptr;
+  auto hidden = f->arg_size() - this->args.size();
+  if (hidden) {
+    c.ret_region = f->getArg(0);
+  }
   for(auto && a : f->args()) {
-    c.var_table[this->args[i]->raw->name] = variable{&a};
-    ++i;
+    if (a.getArgNo() >= hidden) {
+      c.bind(this->args[a.getArgNo() - hidden]->raw->name, &a);
+    }
   }
+  c.scopes.clear();
+}
+
+auto def::gen(compiler &c, const vector<Value *> &body) const -> Value* {
+  Function* f = get_fn(c, *this);
 
-  if (body.empty()) {
+  if (terminated(c)) {}
+  else if (body.empty() || f->getReturnType()->isVoidTy()) {
+    c.leave();
     c.builder.CreateRetVoid();
   }
   else {
-    for(size_t i = 0; i < this->body.size() - 1; ++i) {
-      this->body[i]->gen(c);
-    }
-    auto* ret = this->body.back()->gen(c);
-    c.builder.CreateRet(ret);
+    c.leave();
+    c.builder.CreateRet(body.back());
   }
 
+  c.debug_scope = nullptr;
+  c.locate(this->pos);
   return f;
 }
 
-auto fn_call::gen(compiler &c) const -> Value* {
+// Only the instances, which are its subnodes, have code.
+auto generic::gen(compiler &, const vector<Value *> &) const -> Value* {
+  return nullptr;
+}
+
+// A call repeats the attributes proved for its callee.
+const llvm::Attribute::AttrKind call_attributes[] = {
+  llvm::Attribute::ReadNone,
+  llvm::Attribute::NoUnwind,
+  llvm::Attribute::WillReturn,
+  llvm::Attribute::NoRecurse
+};
+
+// A lambda is an internal function that takes a pointer to its closure,
+// from which it loads its captures, ahead of its arguments. A function of
+// an erased type has the same signature.
+auto lambda_signature(compiler &c, const type_t &fn_t) -> FunctionType* {
+  vector<Type *> args_t{c.builder.getInt8PtrTy()};
+  transform(fn_t.params.cbegin(), fn_t.params.cend(), back_inserter(args_t),
+      [&](auto &&t) { return t->to_llvm(c.context); });
+  return FunctionType::get(fn_t.result->to_llvm(c.context), args_t, false);
+}
+
+auto lambda_fn(compiler &c, const type_t &closure_t) -> Function* {
+  if (auto* f = c.module.getFunction(closure_t.lambda_fn.c_str()); f) {
+    return f;
+  }
+  return Function::Create(lambda_signature(c, closure_t), Function::InternalLinkage,
+      closure_t.lambda_fn.c_str(), c.module);
+}
+
+// A closure passed where any function of its signature is expected is
+// erased to its lambda and a copy of its captures on the stack of the
+// caller, which outlives the call since functions cannot be returned.
+auto erase(compiler &c, Value* closure, const type_t &closure_t) -> Value* {
+  auto* i8p = c.builder.getInt8PtrTy();
+  auto* env = entry_alloca(c, closure->getType(), "env");
+  c.builder.CreateStore(closure, env);
+  Value* erased = llvm::UndefValue::get(erased_fn_type(c.context));
+  erased = c.builder.CreateInsertValue(erased, c.builder.CreateBitCast(lambda_fn(c, closure_t), i8p), 0);
+  return c.builder.CreateInsertValue(erased, c.builder.CreateBitCast(env, i8p), 1, "erased");
+}
+
+auto convert_args(compiler &c, const fn_call &call, vector<Value *> args, FunctionType* fn_t) -> vector<Value *> {
+  auto hidden = fn_t->getNumParams() - args.size();
+  for(size_t i = 0; i < args.size(); ++i) {
+    auto* arg_t = call.args[i]->ty;
+    if (!arg_t->lambda_fn.empty() && args[i]->getType() != fn_t->getParamType(i + hidden)) {
+      args[i] = erase(c, args[i], *arg_t);
+    }
+  }
+  return args;
+}
+
+// A closure variable is called directly, with a pointer to the closure
+// in its slot; any other function variable indirectly.
+auto call_variable(compiler &c, const fn_call &call, const vector<Value *> &args) -> Value* {
+  auto &fn_t = *call.fn_name->ty;
+  auto* slot = c.var_table[call.fn_name->name].slot;
+  auto* i8p = c.builder.getInt8PtrTy();
+  auto* signature = lambda_signature(c, fn_t);
+  Value* callee;
+  Value* env;
+  if (!fn_t.lambda_fn.empty()) {
+    callee = lambda_fn(c, fn_t);
+    env = c.builder.CreateBitCast(slot, i8p, "env");
+  }
+  else {
+    auto* erased = c.builder.CreateLoad(slot->getAllocatedType(), slot, call.fn_name->name.c_str());
+    callee = c.builder.CreateBitCast(c.builder.CreateExtractValue(erased, 0), signature->getPointerTo(), "fn");
+    env = c.builder.CreateExtractValue(erased, 1, "env");
+  }
+
+  vector<Value *> with_env{env};
+  auto converted = convert_args(c, call, args, signature);
+  with_env.insert(with_env.end(), converted.begin(), converted.end());
+  if (signature->getReturnType()->isVoidTy()) {
+    c.builder.CreateCall(signature, callee, with_env);
+    return nullptr;
+  }
+  return c.builder.CreateCall(signature, callee, with_env, "fncall");
+}
+
+auto fn_call::gen(compiler &c, const vector<Value *> &args) const -> Value* {
+  c.alloc_region = c.escaping.count(this) ? c.ret_region : c.region;
+  if (this->via_variable) {
+    return call_variable(c, *this, args);
+  }
   if (auto prim = prim_fn::find(this->fn_name->name); prim) {
-    return (*prim)(c, this->ref_args());
+    return (*prim)(c, args);
+  }
+
+  if (auto it = c.intrinsics.find(this->fn_name->name); it != c.intrinsics.end()) {
+    return c.builder.CreateCall(it->second, args, "intrinsic");
   }
 
   Function* f = c.module.getFunction(this->fn_name->name.c_str());
+  if (!f) {
+    // The checker resolved the call, so its def must have been declared.
+    llvm::report_fatal_error(llvm::Twine("No function is declared for the call of ") + this->fn_name->name.c_str());
+  }
+  auto converted = convert_args(c, *this, args, f->getFunctionType());
+  if (is_heap(this->ty)) {
+    converted.insert(converted.begin(), c.alloc_region);
+  }
 
-  vector<Value *> args;
-  transform(this->args.begin(), this->args.end(), back_inserter(args),
-      [&](auto &&a) { return a->gen(c); });
+  auto* call = c.builder.CreateCall(f, converted);
+  for(auto kind : call_attributes) {
+    if (f->hasFnAttribute(kind)) {
+      call->addFnAttr(kind);
+    }
+  }
+  if (f->getReturnType()->isVoidTy()) {
+    return nullptr;
+  }
+  call->setName("fncall");
+  return call;
+}
 
-  return c.builder.CreateCall(f, args, "fncall");
+// The lambda is generated as a function of its own, in the middle of the
+// one it appears in, which its value, the closure, is then built in.
+auto lambda::enter(compiler &c) const -> void {
+  auto* closure_t = this->ty->to_llvm(c.context);
+  c.suspend();
+  auto* f = lambda_fn(c, *this->ty);
+  c.fn_pos[this->fn_label] = this->pos;
+  c.builder.SetInsertPoint(BasicBlock::Create(c.context, "entry", f));
+  if (c.debug_info) {
+    open_subprogram(c, f, this->pos);
+  }
+
+  auto* env = c.builder.CreateBitCast(f->getArg(0), closure_t->getPointerTo(), "env");
+  for(size_t i = 0; i < this->captures.size(); ++i) {
+    auto &name = this->captures[i];
+    auto* field = c.builder.CreateStructGEP(closure_t, env, i);
+    c.bind(name, c.builder.CreateLoad(this->ty->fields[i]->to_llvm(c.context), field, name.c_str()));
+  }
+  for(size_t i = 0; i < this->args.size(); ++i) {
+    c.bind(this->args[i]->raw->name, f->getArg(i + 1));
+  }
+  c.scopes.clear();
+
+  auto escapes = analyze_escapes(*this);
+  c.escaping = std::move(escapes.escaping);
+  c.region = escapes.local ? local_region(c) : nullptr;
+}
+
+auto lambda::gen(compiler &c, const vector<Value *> &body) const -> Value* {
+  auto* f = c.builder.GetInsertBlock()->getParent();
+  if (terminated(c)) {}
+  else if (body.empty() || f->getReturnType()->isVoidTy()) {
+    c.leave();
+    c.builder.CreateRetVoid();
+  }
+  else {
+    c.leave();
+    c.builder.CreateRet(body.back());
+  }
+  c.resume();
+  c.locate(this->pos);
+
+  Value* closure = llvm::UndefValue::get(this->ty->to_llvm(c.context));
+  for(size_t i = 0; i < this->captures.size(); ++i) {
+    auto &name = this->captures[i];
+    auto* slot = c.var_table[name].slot;
+    auto* value = c.builder.CreateLoad(slot->getAllocatedType(), slot, name.c_str());
+    closure = c.builder.CreateInsertValue(closure, value, i);
+  }
+  return closure;
+}
+
+auto let::step(compiler &c, const vector<Value *> &body) const -> void {
+  if (body.size() == 1) {
+    c.bind(this->var_name->name, body.front());
+  }
+}
+
+auto let::gen(compiler &c, const vector<Value *> &body) const -> Value* {
+  c.unbind();
+  return body.size() > 1 ? body.back() : nullptr;
+}
+
+auto set::gen(compiler &c, const vector<Value *> &value) const -> Value* {
+  c.builder.CreateStore(value.front(), c.var_table[this->var_name->name].slot);
+  return value.front();
+}
+
+// The condition gets a block of its own, so that the body can branch back
+// to it.
+auto while_::enter(compiler &c) const -> void {
+  auto* f = c.builder.GetInsertBlock()->getParent();
+  auto* cond = BasicBlock::Create(c.context, "while.cond", f);
+  auto* exit = BasicBlock::Create(c.context, "while.end");
+  c.builder.CreateBr(cond);
+  c.builder.SetInsertPoint(cond);
+  c.loops.push_back({cond, exit});
+}
+
+auto while_::step(compiler &c, const vector<Value *> &body) const -> void {
+  if (body.size() != 1) {
+    return;
+  }
+  auto* f = c.builder.GetInsertBlock()->getParent();
+  auto* loop = BasicBlock::Create(c.context, "while.body", f);
+  c.builder.CreateCondBr(body.front(), loop, c.loops.back().second);
+  c.builder.SetInsertPoint(loop);
 }
 
-auto progn::gen(compiler &c) const -> Value* {
-  for(auto && ch : this->children) {
-    ch->gen(c);
+auto while_::gen(compiler &c, const vector<Value *> &) const -> Value* {
+  auto [cond, exit] = c.loops.back();
+  c.loops.pop_back();
+  if (!terminated(c)) {
+    c.builder.CreateBr(cond);
   }
+  exit->insertInto(c.builder.GetInsertBlock()->getParent());
+  c.builder.SetInsertPoint(exit);
+  return nullptr;
+}
+
+// Lowered like `for (i = 0; i < count; ++i)` in C, so that the loop passes
+// see a canonical counted loop.
+auto dotimes::step(compiler &c, const vector<Value *> &body) const -> void {
+  if (body.size() != 1) {
+    return;
+  }
+  auto* f = c.builder.GetInsertBlock()->getParent();
+  auto* cond = BasicBlock::Create(c.context, "dotimes.cond", f);
+  auto* loop = BasicBlock::Create(c.context, "dotimes.body", f);
+  auto* exit = BasicBlock::Create(c.context, "dotimes.end");
+  auto* i32 = c.builder.getInt32Ty();
+
+  c.bind(this->var_name->name, c.builder.getInt32(0));
+  auto* slot = c.var_table[this->var_name->name].slot;
+  c.builder.CreateBr(cond);
+
+  c.builder.SetInsertPoint(cond);
+  auto* i = c.builder.CreateLoad(i32, slot, this->var_name->name.c_str());
+  c.builder.CreateCondBr(c.builder.CreateICmpSLT(i, body.front()), loop, exit);
+
+  c.builder.SetInsertPoint(loop);
+  c.loops.push_back({cond, exit});
+}
+
+auto dotimes::gen(compiler &c, const vector<Value *> &) const -> Value* {
+  auto [cond, exit] = c.loops.back();
+  c.loops.pop_back();
+  if (!terminated(c)) {
+    auto* slot = c.var_table[this->var_name->name].slot;
+    auto* i = c.builder.CreateLoad(c.builder.getInt32Ty(), slot, this->var_name->name.c_str());
+    c.builder.CreateStore(c.builder.CreateNSWAdd(i, c.builder.getInt32(1)), slot);
+    c.builder.CreateBr(cond);
+  }
+  c.unbind();
+  exit->insertInto(c.builder.GetInsertBlock()->getParent());
+  c.builder.SetInsertPoint(exit);
+  return nullptr;
+}
+
+// Fills in the constructor and accessors; they are always inlined, so SROA
+// keeps the fields in registers.
+auto defstruct::gen(compiler &c, const vector<Value *> &) const -> Value* {
+  auto &name = this->struct_name->name;
+  auto* ctor = c.module.getFunction(name.c_str());
+  ctor->addFnAttr(llvm::Attribute::AlwaysInline);
+  c.builder.SetInsertPoint(BasicBlock::Create(c.context, "entry", ctor));
+  Value* result = llvm::PoisonValue::get(ctor->getReturnType());
+  for(auto &&a : ctor->args()) {
+    result = c.builder.CreateInsertValue(result, &a, a.getArgNo());
+  }
+  c.builder.CreateRet(result);
+
+  for(unsigned i = 0; i < this->fields.size(); ++i) {
+    auto* get = c.module.getFunction(format("{}-{}", name, this->fields[i]->raw->name).c_str());
+    get->addFnAttr(llvm::Attribute::AlwaysInline);
+    c.builder.SetInsertPoint(BasicBlock::Create(c.context, "entry", get));
+    c.builder.CreateRet(c.builder.CreateExtractValue(get->getArg(0), i));
+  }
+  return nullptr;
+}
+
+auto extern_::gen(compiler &, const vector<Value *> &) const -> Value* {
+  return nullptr;
+}
+
+auto par_reduce::gen(compiler &c, const vector<Value *> &args) const -> Value* {
+  auto* fn = c.module.getFunction(this->fn_name(2)->name.c_str());
+  auto* combine = c.module.getFunction(this->fn_name(4)->name.c_str());
+  auto* elem = args[2]->getType();
+  auto* i32 = c.builder.getInt32Ty();
+  auto runtime = c.module.getOrInsertFunction(
+      elem->isDoubleTy() ? "lisa_par_reduce_f64" : "lisa_par_reduce_i32",
+      elem, i32, i32, fn->getType(), elem, combine->getType());
+
+  return c.builder.CreateCall(runtime, {args[0], args[1], fn, args[2], combine}, "parreduce");
+}
+
+auto progn::gen(compiler &, const vector<Value *> &) const -> Value* {
   return nullptr;
 }
 }
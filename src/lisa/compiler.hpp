@@ -2,32 +2,139 @@
 #define LISA_COMPILER
 
 #include <lisa/parser.hpp>
+#include <runtime/lisa_rt.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Value.h>
 #include <string_theory/string>
 #include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <optional>
+#include <utility>
 #include <vector>
+#include <cstdint>
 #include <cstdlib>
 
 namespace lisa {
 struct fn_type;
 
+// Every variable lives in an entry-block alloca, so `set!` can assign it;
+// mem2reg turns them back into SSA values.
 struct variable {
-  llvm::Value* value;
+  llvm::AllocaInst* slot;
+};
+
+// The state of a function whose code generation is suspended while a
+// lambda inside it is generated.
+struct suspended_fn {
+  llvm::IRBuilderBase::InsertPoint point;
+  std::unordered_map<ST::string, variable> var_table;
+  std::vector<std::pair<ST::string, std::optional<variable>>> scopes;
+  std::vector<std::pair<llvm::BasicBlock *, llvm::BasicBlock *>> loops;
+  llvm::Value* region;
+  llvm::Value* ret_region;
+  std::unordered_set<const node *> escaping;
+  llvm::DISubprogram* debug_scope;
+};
+
+struct compile_options {
+  std::uint32_t memo_capacity = 4096;
+  std::uint32_t memo_policy = LISA_MEMO_LRU;
+  bool fast_math = false;
+  bool fp_contract = false;
+  std::uint32_t opt_level = 2;
+  // The kinds of optimization remarks collected into compiler::remarks.
+  bool remarks_passed = false;
+  bool remarks_missed = false;
+  bool remarks_analysis = false;
+  // Extra driver arguments, such as -l and -L, for make_executable.
+  std::vector<ST::string> link_args;
+};
+
+enum class remark_kind {
+  passed, missed, analysis
+};
+
+// An optimization remark of an LLVM pass, located at the def or call it
+// is about.
+struct remark {
+  remark_kind kind;
+  std::size_t pos;
+  ST::string pass;
+  ST::string name;
+  ST::string function;
+  ST::string msg;
 };
 
 struct compiler {
-  llvm::LLVMContext context;
+  // Owned through pointers so that a finished module can be handed over,
+  // e.g. to a JIT, together with its context.
+  std::unique_ptr<llvm::LLVMContext> owned_context;
+  std::unique_ptr<llvm::Module> owned_module;
+  llvm::LLVMContext &context;
   llvm::IRBuilder<> builder;
-  llvm::Module module;
+  llvm::Module &module;
   std::unordered_map<ST::string, variable> var_table;
+  // Extern functions that are lowered to LLVM intrinsics.
+  std::unordered_map<ST::string, llvm::Function *> intrinsics;
+  compile_options options;
+
+  // Bindings shadowed by the innermost `let`s and `dotimes`es, and the
+  // condition and exit blocks of the enclosing loops.
+  std::vector<std::pair<ST::string, std::optional<variable>>> scopes;
+  std::vector<std::pair<llvm::BasicBlock *, llvm::BasicBlock *>> loops;
+
+  // The lisa_region of the current call, if it allocates anything that
+  // does not escape, and the region of the caller that escaping values go
+  // to, if it returns a list or a string. `alloc_region` is the one the
+  // call being generated allocates in.
+  llvm::Value* region = nullptr;
+  llvm::Value* ret_region = nullptr;
+  llvm::Value* alloc_region = nullptr;
+  std::unordered_set<const node *> escaping;
+  std::vector<suspended_fn> suspended;
+
+  // When remarks are requested for a known source, the generated code
+  // carries line tables, with a subprogram for every def, so that remarks
+  // can be traced back to Lisa code.
+  const source* src = nullptr;
+  std::unique_ptr<llvm::DIBuilder> debug_info;
+  llvm::DIFile* debug_file = nullptr;
+  llvm::DISubprogram* debug_scope = nullptr;
+  std::unordered_map<ST::string, std::size_t> fn_pos;
+  std::vector<remark> remarks;
 
-  compiler() : context(), builder(context), module("mod", context), var_table() {}
+  compiler() :
+    owned_context(std::make_unique<llvm::LLVMContext>()),
+    owned_module(std::make_unique<llvm::Module>("mod", *owned_context)),
+    context(*owned_context),
+    builder(context),
+    module(*owned_module),
+    var_table(),
+    options() {}
 
   auto compile(const std::unordered_map<ST::string, fn_type>&) -> void;
   auto compile(const node &) -> void;
+  auto optimize() -> void;
+
+  auto locate(std::size_t pos) -> void;
+  auto offset_of(std::size_t line, std::size_t column) const -> std::size_t;
+
+  // Bump-allocates `size` bytes in `alloc_region`, and releases `region`
+  // before a return.
+  auto allocate(llvm::Value* size) -> llvm::Value*;
+  auto leave() -> void;
+
+  // Switches to a new function, and back to the one it interrupted.
+  auto suspend() -> void;
+  auto resume() -> void;
+
+  auto bind(const ST::string &, llvm::Value*) -> void;
+  auto unbind() -> void;
 };
 }
 
@@ -1,25 +1,315 @@
 #include <lisa/driver_interface.hpp>
+#include <lisa/type_checker.hpp>
+#include <llvm/IR/GlobalAlias.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_ostream.h>
-#include <cppfs/FileHandle.h>
-#include <cppfs/fs.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#ifdef LISA_HAS_LLD
+#include <lld/Common/Driver.h>
+#endif
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
 #include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_set>
+#include <vector>
 #include <fmt/format.h>
 
 using ST::string;
-using llvm::raw_string_ostream;
-namespace fs { using namespace cppfs::fs; }
+using tl::expected;
+using tl::make_unexpected;
+
+extern char** environ;
 
 namespace lisa {
-auto make_executable(const string &out, const compiler &c) -> void {
-  std::string ir;
-  raw_string_ostream ss(ir);
-  ss << c.module;
-  ss.flush();
-
-  fs::open("tmp.ll").writeFile(ir);
-  std::system("llc --filetype obj tmp.ll");
-  auto driver_cmd = fmt::format("gcc -o {} tmp.o", out.view());
-  std::system(driver_cmd.c_str());
+namespace {
+std::once_flag native_target_ready;
+
+// An anonymous in-memory file. The linker reads it through /proc, so builds
+// leave nothing behind on disk and never collide with each other.
+struct memory_file {
+  int fd = -1;
+
+  memory_file() : fd(memfd_create("lisa-object", 0)) {}
+  memory_file(const memory_file &) = delete;
+  ~memory_file() {
+    if (this->fd >= 0) {
+      close(this->fd);
+    }
+  }
+
+  auto write(const std::string &data) -> bool {
+    for(std::size_t done = 0; done < data.size();) {
+      auto n = ::write(this->fd, data.data() + done, data.size() - done);
+      if (n < 0) {
+        return false;
+      }
+      done += n;
+    }
+    return true;
+  }
+
+  auto path() const -> std::string {
+    return fmt::format("/proc/self/fd/{}", this->fd);
+  }
+};
+
+#ifdef LISA_HAS_LLD
+// LLD keeps its state in globals, so one link runs at a time. Emitting the
+// object, which is most of the work, still runs in parallel.
+std::mutex lld_lock;
+
+auto link(const string &out, const std::string &object, const compiler &c, bool shared) -> expected<void, string> {
+  std::vector<std::string> args = {"ld.lld", "--eh-frame-hdr", "--hash-style=gnu", "-o", out.c_str()};
+  if (shared) {
+    for(auto arg: { "-shared", "--exclude-libs=ALL", LISA_CRTI, LISA_CRTBEGIN }) {
+      args.push_back(arg);
+    }
+  }
+  else {
+    for(auto arg: { "-pie", "-dynamic-linker", LISA_DYNAMIC_LINKER, LISA_CRT1, LISA_CRTI, LISA_CRTBEGIN }) {
+      args.push_back(arg);
+    }
+  }
+  for(auto arg: { "-L" LISA_GCC_LIB_DIR, "-L" LISA_LIBC_DIR }) {
+    args.push_back(arg);
+  }
+  args.push_back(object);
+  args.push_back(LISA_RUNTIME_LIB);
+  for(auto &&arg: c.options.link_args) {
+    args.push_back(arg.c_str());
+  }
+  // libgcc_s, the unwinder of libstdc++, is only kept when something uses
+  // it. LLD resolves archives in any order, so libgcc and libc, which refer
+  // to each other, are listed once rather than twice as gcc's driver does.
+  for(auto lib: { "-lstdc++", "-lpthread", "-lm", "--as-needed", "-lgcc_s", "--no-as-needed", "-lgcc", "-lc" }) {
+    args.push_back(lib);
+  }
+  args.push_back(LISA_CRTEND);
+  args.push_back(LISA_CRTN);
+
+  std::vector<const char *> argv;
+  for(auto &&arg: args) {
+    argv.push_back(arg.c_str());
+  }
+
+  std::string diagnostics;
+  llvm::raw_string_ostream os(diagnostics);
+  std::lock_guard lock(lld_lock);
+  if (!lld::elf::link(argv, os, os, false, false)) {
+    os.flush();
+    return make_unexpected(string(diagnostics.c_str()));
+  }
+  return {};
+}
+#else
+// gcc runs without a shell, so paths and arguments reach it as they are.
+auto link(const string &out, const std::string &object, const compiler &c, bool shared) -> expected<void, string> {
+  std::vector<std::string> args = {"gcc"};
+  if (shared) {
+    args.push_back("-shared");
+    args.push_back("-Wl,--exclude-libs,ALL");
+  }
+  for(auto arg: { "-o", out.c_str(), "-x", "none", object.c_str(), LISA_RUNTIME_LIB, "-lstdc++", "-lpthread", "-lm" }) {
+    args.push_back(arg);
+  }
+  for(auto &&arg : c.options.link_args) {
+    args.push_back(arg.c_str());
+  }
+
+  std::vector<char *> argv;
+  for(auto &&arg: args) {
+    argv.push_back(arg.data());
+  }
+  argv.push_back(nullptr);
+
+  pid_t pid;
+  if (posix_spawnp(&pid, "gcc", nullptr, nullptr, argv.data(), environ) != 0) {
+    return make_unexpected(string("Cannot run the linker"));
+  }
+  int status;
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return make_unexpected(string("The linker failed"));
+  }
+  return {};
+}
+#endif
+
+// The module is compiled for the host, so it takes on the host's target
+// triple and data layout.
+auto build(const string &out, compiler &c, bool shared) -> expected<void, string> {
+  init_native_target();
+  auto triple = llvm::sys::getDefaultTargetTriple();
+  std::string msg;
+  auto target = llvm::TargetRegistry::lookupTarget(triple, msg);
+  if (!target) {
+    return make_unexpected(string(msg.c_str()));
+  }
+  auto tm = std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+      triple, "generic", "", llvm::TargetOptions(), llvm::Reloc::PIC_));
+
+  c.module.setTargetTriple(triple);
+  c.module.setDataLayout(tm->createDataLayout());
+  auto object = emit_object(*tm, c.module);
+  if (!object) {
+    return make_unexpected(object.error());
+  }
+
+  memory_file file;
+  if (file.fd < 0 || !file.write(*object)) {
+    return make_unexpected(string("Cannot hold the object file in memory"));
+  }
+  return link(out, file.path(), c, shared);
+}
+
+auto c_type(const type &t) -> const char* {
+  return &t == &i8 ? "int8_t"
+    : &t == &i16 ? "int16_t"
+    : &t == &i32 ? "int32_t"
+    : &t == &i64 ? "int64_t"
+    : &t == &u32 ? "uint32_t"
+    : &t == &f32 ? "float"
+    : &t == &f64 ? "double"
+    : &t == &bool_ ? "bool"
+    : &t == &statement ? "void"
+    : nullptr;
+}
+
+auto c_identifier(const string &name) -> std::string {
+  std::string id(name.c_str());
+  std::replace_if(id.begin(), id.end(), [](unsigned char ch) {
+    return !std::isalnum(ch) && ch != '_';
+  }, '_');
+  return id;
+}
+
+// The keywords of C and C++, which the header is read as, and the macros
+// of stdbool.h.
+const std::unordered_set<std::string> c_keywords = {
+  "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor",
+  "bool", "break", "case", "catch", "char", "char8_t", "char16_t", "char32_t",
+  "class", "compl", "concept", "const", "const_cast", "consteval",
+  "constexpr", "constinit", "continue", "co_await", "co_return", "co_yield",
+  "decltype", "default", "delete", "do", "double", "dynamic_cast", "else",
+  "enum", "explicit", "export", "extern", "false", "float", "for", "friend",
+  "goto", "if", "inline", "int", "long", "mutable", "namespace", "new",
+  "noexcept", "not", "not_eq", "nullptr", "operator", "or", "or_eq",
+  "private", "protected", "public", "register", "reinterpret_cast",
+  "requires", "restrict", "return", "short", "signed", "sizeof", "static",
+  "static_assert", "static_cast", "struct", "switch", "template", "this",
+  "thread_local", "throw", "true", "try", "typedef", "typeid", "typename",
+  "union", "unsigned", "using", "virtual", "void", "volatile", "wchar_t",
+  "while", "xor", "xor_eq", "_Alignas", "_Alignof", "_Atomic", "_Bool",
+  "_Complex", "_Generic", "_Imaginary", "_Noreturn", "_Static_assert",
+  "_Thread_local", "__bool_true_false_are_defined"
+};
+
+auto declarable(const std::string &id) -> bool {
+  return !id.empty() && !std::isdigit(static_cast<unsigned char>(id[0])) && !c_keywords.count(id);
+}
+}
+
+auto init_native_target() -> void {
+  std::call_once(native_target_ready, [] {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+  });
+}
+
+auto emit_object(llvm::TargetMachine &tm, llvm::Module &m) -> expected<std::string, string> {
+  llvm::SmallVector<char, 0> buffer;
+  llvm::raw_svector_ostream os(buffer);
+  llvm::legacy::PassManager pm;
+  if (tm.addPassesToEmitFile(pm, os, nullptr, llvm::CGFT_ObjectFile)) {
+    return make_unexpected(string("The target cannot emit object files"));
+  }
+  pm.run(m);
+  return std::string(buffer.begin(), buffer.end());
+}
+
+auto make_executable(const string &out, compiler &c) -> expected<void, string> {
+  return build(out, c, false);
+}
+
+auto exported_fns(const compiler &c, const std::unordered_map<string, fn_type> &fn_table) -> std::vector<string> {
+  std::vector<string> candidates;
+  std::unordered_map<std::string, std::size_t> claims;
+  for(auto &&[name, type]: fn_table) {
+    auto* fn = c.module.getFunction(name.c_str());
+    if (!fn || name == "main" || name.find('<') >= 0 || fn->isDeclaration() || fn->hasLocalLinkage() || !type.ret || !c_type(*type.ret)) {
+      continue;
+    }
+    auto id = c_identifier(name);
+    if (!declarable(id)) {
+      continue;
+    }
+    if (auto* other = c.module.getNamedValue(id); other && other != fn) {
+      continue;
+    }
+    if (std::all_of(type.args.cbegin(), type.args.cend(), [](auto* t) { return t && t != &statement && c_type(*t); })) {
+      candidates.push_back(name);
+      ++claims[id];
+    }
+  }
+
+  // Defs such as a-b and a?b would both be declared as a_b, so neither is.
+  std::vector<string> result;
+  std::copy_if(candidates.begin(), candidates.end(), std::back_inserter(result), [&](auto &&name) {
+    return claims[c_identifier(name)] == 1;
+  });
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+// Everything but the exported defs is hidden, so that the library's
+// symbols are its interface and calls between its defs stay direct. A def
+// whose name is not a C identifier is exported through an alias.
+auto make_shared_library(const string &out, compiler &c, const std::vector<string> &exported) -> expected<void, string> {
+  for(auto &&g: c.module.global_values()) {
+    if (!g.isDeclaration() && !g.hasLocalLinkage()) {
+      g.setVisibility(llvm::GlobalValue::HiddenVisibility);
+    }
+  }
+  for(auto &&name: exported) {
+    auto* fn = c.module.getFunction(name.c_str());
+    if (auto id = c_identifier(name); id != name.c_str()) {
+      llvm::GlobalAlias::create(id, fn);
+    }
+    else {
+      fn->setVisibility(llvm::GlobalValue::DefaultVisibility);
+    }
+  }
+  return build(out, c, true);
+}
+
+auto c_header(const std::unordered_map<string, fn_type> &fn_table, const std::vector<string> &exported, const string &name) -> std::string {
+  auto guard = "LISA_" + c_identifier(name) + "_H";
+  std::transform(guard.begin(), guard.end(), guard.begin(), [](unsigned char ch) { return std::toupper(ch); });
+  auto header = fmt::format(
+      "#ifndef {0}\n#define {0}\n"
+      "#include <stdbool.h>\n#include <stdint.h>\n\n"
+      "#ifdef __cplusplus\nextern \"C\" {{\n#endif\n\n", guard);
+  for(auto &&fn: exported) {
+    auto &type = fn_table.at(fn);
+    std::string params;
+    for(auto* t: type.args) {
+      params += params.empty() ? c_type(*t) : fmt::format(", {}", c_type(*t));
+    }
+    header += fmt::format("{} {}({});\n", c_type(*type.ret), c_identifier(fn), params.empty() ? "void" : params);
+  }
+  header += "\n#ifdef __cplusplus\n}\n#endif\n\n#endif\n";
+  return header;
 }
 }
@@ -2,10 +2,45 @@
 #define LISA_DRIVER_INTERFACE
 #include <lisa/compiler.hpp>
 #include <string_theory/string>
+#include <tl/expected.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace llvm {
+class TargetMachine;
+}
 
 namespace lisa {
-auto make_executable(const ST::string&, const compiler &) -> void;
+// Registers the native target with LLVM. Only the first call does any work.
+auto init_native_target() -> void;
+auto emit_object(llvm::TargetMachine &, llvm::Module &) -> tl::expected<std::string, ST::string>;
+
+// Compiles the module of the compiler for the host and links it with the
+// runtime into the executable `out`. Everything happens in process when
+// lisa is built with LLD; otherwise the system compiler driver links. The
+// module is given the host's target triple and data layout. Executables
+// linked with LLD name LISA_DYNAMIC_LINKER as their program interpreter,
+// which the build takes from the C++ compiler lisa is built with.
+auto make_executable(const ST::string &out, compiler &) -> tl::expected<void, ST::string>;
+
+// The defs of the module that C code can call: those whose arguments and
+// result are numbers or bools. `main`, which would clash with the host's,
+// generic instances and defs that take or return lists, strings, structs or
+// functions stay internal, as do defs whose C name (see c_header) is a C or
+// C++ keyword or is shared with another def or symbol.
+auto exported_fns(const compiler &, const std::unordered_map<ST::string, fn_type> &) -> std::vector<ST::string>;
+
+// Like make_executable, but links the shared library `out`, which exports
+// only `exported` and keeps the runtime to itself. Every other symbol of the
+// module is hidden.
+auto make_shared_library(const ST::string &out, compiler &, const std::vector<ST::string> &exported) -> tl::expected<void, ST::string>;
+
+// A C header that declares `exported`, for the library `name`. A def whose
+// name is not a C identifier, such as sum-squares, is declared as the name
+// with every other character replaced by '_', sum_squares, which the
+// library exports as an alias.
+auto c_header(const std::unordered_map<ST::string, fn_type> &, const std::vector<ST::string> &exported, const ST::string &name) -> std::string;
 }
 
 #endif
-
@@ -0,0 +1,120 @@
+#include <lisa/escape.hpp>
+#include <lisa/type_checker.hpp>
+#include <lisa/primitive.hpp>
+#include <string_theory/string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using std::unordered_map;
+using std::unordered_set;
+using std::vector;
+using std::size_t;
+using ST::string;
+
+namespace lisa {
+namespace {
+// The arguments whose list a primitive's result may share, and the
+// primitives that allocate.
+const unordered_map<string, vector<size_t>> prim_aliases = {
+  {"cons", {1}},
+  {"tail", {0}}
+};
+const unordered_set<string> prim_allocates = {"cons", "str-cat"};
+
+auto allocates(const fn_call &call) -> bool {
+  if (!is_heap(call.ty)) {
+    return false;
+  }
+  return !prim_fn::find(call.fn_name->name) || prim_allocates.count(call.fn_name->name);
+}
+
+auto analyze(const vector<std::unique_ptr<node>> &body, bool returns_heap) -> escape_info {
+  unordered_map<const node *, vector<const node *>> sources;
+  unordered_map<string, vector<const node *>> assigned;
+  vector<const fn_call *> sites;
+  vector<const node *> work;
+  if (returns_heap) {
+    work.push_back(body.back().get());
+  }
+
+  vector<const node *> stack;
+  for(auto &&b : body) {
+    stack.push_back(b.get());
+  }
+  while(!stack.empty()) {
+    auto* n = stack.back();
+    stack.pop_back();
+    // A lambda allocates in a region of its own.
+    if (dynamic_cast<const lambda *>(n)) {
+      continue;
+    }
+    for(auto* s : n->subnodes()) {
+      stack.push_back(s);
+    }
+
+    if (auto* l = dynamic_cast<const let *>(n); l && !l->body.empty()) {
+      assigned[l->var_name->name].push_back(l->body.front().get());
+      if (l->body.size() > 1) {
+        sources[n].push_back(l->body.back().get());
+      }
+    }
+    else if (auto* s = dynamic_cast<const set *>(n); s && s->value.size() == 1) {
+      assigned[s->var_name->name].push_back(s->value.front().get());
+      sources[n].push_back(s->value.front().get());
+    }
+    else if (auto* call = dynamic_cast<const fn_call *>(n); call) {
+      auto &name = call->fn_name->name;
+      if (name == "return" && returns_heap && !call->args.empty()) {
+        work.push_back(call->args.front().get());
+      }
+      else if (auto it = prim_aliases.find(name); it != prim_aliases.end()) {
+        for(auto i : it->second) {
+          sources[n].push_back(call->args[i].get());
+        }
+      }
+      else if (!prim_fn::find(name) && is_heap(call->ty)) {
+        for(auto &&a : call->args) {
+          if (is_heap(a->ty)) {
+            sources[n].push_back(a.get());
+          }
+        }
+      }
+      if (allocates(*call)) {
+        sites.push_back(call);
+      }
+    }
+  }
+
+  // Everything that flows into an escaping node escapes too.
+  escape_info result;
+  unordered_set<string> escaping_vars;
+  while(!work.empty()) {
+    auto* n = work.back();
+    work.pop_back();
+    if (!result.escaping.insert(n).second) {
+      continue;
+    }
+    if (auto* i = dynamic_cast<const id *>(n); i && escaping_vars.insert(i->name).second) {
+      auto &values = assigned[i->name];
+      work.insert(work.end(), values.begin(), values.end());
+    }
+    auto &from = sources[n];
+    work.insert(work.end(), from.begin(), from.end());
+  }
+
+  for(auto* site : sites) {
+    result.local = result.local || !result.escaping.count(site);
+  }
+  return result;
+}
+}
+
+auto analyze_escapes(const def &d) -> escape_info {
+  return analyze(d.body, !d.body.empty() && is_heap(d.body.back()->ty));
+}
+
+auto analyze_escapes(const lambda &l) -> escape_info {
+  return analyze(l.body, false);
+}
+}
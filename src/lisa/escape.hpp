@@ -0,0 +1,30 @@
+#ifndef LISA_ESCAPE
+#define LISA_ESCAPE
+
+#include <lisa/parser.hpp>
+#include <unordered_set>
+
+namespace lisa {
+struct escape_info {
+  // The nodes whose list or string may be part of the result of the def:
+  // what they allocate must outlive the call, so it goes to the region of
+  // the caller.
+  std::unordered_set<const node *> escaping;
+  // Whether something is allocated that does not escape, in which case the
+  // def needs a region of its own.
+  bool local = false;
+};
+
+// A flow-insensitive analysis of a type checked def, which skips the bodies
+// of its lambdas. Lists and strings reach the result through the last form
+// of the body and `return`, and flow through variables, `let`, `set!`, the
+// tail of `cons`, `tail`, and calls of user functions, which may return any
+// of their arguments. Variables are tracked by name, so a shadowed name is
+// conservatively treated as one variable.
+auto analyze_escapes(const def &) -> escape_info;
+// A lambda returns neither lists nor strings, so nothing it allocates
+// escapes it.
+auto analyze_escapes(const lambda &) -> escape_info;
+}
+
+#endif
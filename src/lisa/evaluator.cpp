@@ -0,0 +1,223 @@
+#include <lisa/evaluator.hpp>
+#include <lisa/type_checker.hpp>
+#include <lisa/primitive.hpp>
+#include <lisa/parser.hpp>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using std::unordered_map;
+using std::optional;
+using std::nullopt;
+using std::vector;
+using std::pair;
+using std::size_t;
+using std::uint32_t;
+using std::int32_t;
+using ST::string;
+template<class T>
+using uniq = std::unique_ptr<T>;
+
+namespace lisa {
+evaluator::evaluator(const unordered_map<string, fn_type> &fns) :
+  fn_table(fns), defs(), frames(), steps(0) {}
+
+auto literal_of(size_t pos, const constant &value) -> uniq<node> {
+  uniq<node> result;
+  if (auto* i = std::get_if<int32_t>(&value); i) {
+    result = std::make_unique<inum>(pos, static_cast<uint32_t>(*i));
+    result->ty = &i32;
+  }
+  else if (auto* f = std::get_if<double>(&value); f) {
+    result = std::make_unique<fnum>(pos, *f);
+    result->ty = &f64;
+  }
+  else {
+    result = std::make_unique<boolc>(pos, std::get<bool>(value));
+    result->ty = &bool_;
+  }
+  return result;
+}
+
+auto evaluator::fold(node &ast) -> void {
+  auto add_def = [&](const node* n) {
+    if (auto* d = dynamic_cast<const def *>(n); d) {
+      this->defs[d->fn_name->name] = d;
+    }
+  };
+  for(auto* n : ast.subnodes()) {
+    add_def(n);
+    if (auto* g = dynamic_cast<const generic *>(n); g) {
+      for(auto* i : g->subnodes()) {
+        add_def(i);
+      }
+    }
+  }
+
+  // Post-order over the slots of the tree, so that arguments are folded
+  // before the calls that use them.
+  vector<pair<uniq<node> *, bool>> stack;
+  for(auto* s : ast.slots()) {
+    stack.push_back({s, false});
+  }
+
+  while(!stack.empty()) {
+    auto [slot, entered] = stack.back();
+    if (!*slot) {
+      stack.pop_back();
+      continue;
+    }
+    if (!entered) {
+      stack.back().second = true;
+      for(auto* s : (*slot)->slots()) {
+        stack.push_back({s, false});
+      }
+      continue;
+    }
+    stack.pop_back();
+
+    auto* call = dynamic_cast<fn_call *>(slot->get());
+    if (!call) {
+      continue;
+    }
+    vector<constant> args;
+    for(auto* a : call->subnodes()) {
+      auto c = a && a->subnodes().empty() && !dynamic_cast<fn_call *>(a)
+        ? a->eval(*this, {}) : nullopt;
+      if (!c) {
+        break;
+      }
+      args.push_back(*c);
+    }
+    if (args.size() != call->args.size()) {
+      continue;
+    }
+
+    // The call itself is the first node of its budget, as it is in run.
+    this->steps = 1;
+    if (this->steps > this->max_steps) {
+      continue;
+    }
+    if (auto result = call->eval(*this, args); result) {
+      *slot = literal_of(call->pos, *result);
+    }
+  }
+}
+
+// Evaluates one expression in the innermost frame without recursing on the
+// C++ stack; only calls of user functions nest, through `call`.
+auto evaluator::run(const node &n) -> optional<constant> {
+  struct frame {
+    const node* target;
+    vector<node *> subnodes;
+    vector<constant> values;
+  };
+  vector<frame> stack;
+  stack.push_back({&n, n.subnodes(), {}});
+
+  while(true) {
+    auto &top = stack.back();
+    if (top.values.size() < top.subnodes.size()) {
+      auto* next = top.subnodes[top.values.size()];
+      stack.push_back({next, next->subnodes(), {}});
+      continue;
+    }
+    if (++this->steps > this->max_steps) {
+      return nullopt;
+    }
+    auto result = top.target->eval(*this, top.values);
+    if (!result) {
+      return nullopt;
+    }
+    stack.pop_back();
+    if (stack.empty()) {
+      return result;
+    }
+    stack.back().values.push_back(*result);
+  }
+}
+
+auto evaluator::call(const string &name, const vector<constant> &args) -> optional<constant> {
+  auto fn = this->fn_table.find(name);
+  auto d = this->defs.find(name);
+  if (fn == this->fn_table.end() || !fn->second.pure || d == this->defs.end()
+      || d->second->body.empty() || this->frames.size() >= this->max_calls) {
+    return nullopt;
+  }
+
+  unordered_map<string, constant> frame;
+  for(size_t i = 0; i < args.size(); ++i) {
+    frame[d->second->args[i]->raw->name] = args[i];
+  }
+  this->frames.push_back(std::move(frame));
+
+  optional<constant> result;
+  for(auto &&b : d->second->body) {
+    if (result = this->run(*b); !result) {
+      break;
+    }
+  }
+
+  this->frames.pop_back();
+  return result;
+}
+
+auto evaluator::lookup(const string &name) const -> optional<constant> {
+  if (this->frames.empty()) {
+    return nullopt;
+  }
+  if (auto it = this->frames.back().find(name); it != this->frames.back().end()) {
+    return it->second;
+  }
+  return nullopt;
+}
+
+auto node::eval(evaluator &, const vector<constant> &) const -> optional<constant> {
+  return nullopt;
+}
+
+auto id::eval(evaluator &e, const vector<constant> &) const -> optional<constant> {
+  return e.lookup(this->name);
+}
+
+auto boolc::eval(evaluator &, const vector<constant> &) const -> optional<constant> {
+  return this->value;
+}
+
+// Only i32, f64 and bool are constants, so code that uses the other widths
+// is left as it is.
+auto inum::eval(evaluator &, const vector<constant> &) const -> optional<constant> {
+  if (this->ty != &i32) {
+    return nullopt;
+  }
+  return static_cast<int32_t>(static_cast<uint32_t>(this->number));
+}
+
+auto fnum::eval(evaluator &, const vector<constant> &) const -> optional<constant> {
+  if (this->ty != &f64) {
+    return nullopt;
+  }
+  return this->number;
+}
+
+auto fn_call::eval(evaluator &e, const vector<constant> &args) const -> optional<constant> {
+  if (auto prim = prim_fn::find(this->fn_name->name); prim) {
+    return prim->folder ? prim->folder(args) : nullopt;
+  }
+  if (this->via_variable) {
+    return nullopt;
+  }
+  return e.call(this->fn_name->name, args);
+}
+
+auto par_reduce::eval(evaluator &e, const vector<constant> &args) const -> optional<constant> {
+  auto from = std::get<int32_t>(args[0]);
+  auto to = std::get<int32_t>(args[1]);
+  optional<constant> acc = args[2];
+  for(auto i = from; acc && i < to; ++i) {
+    auto value = e.call(this->fn_name(2)->name, {i});
+    acc = value ? e.call(this->fn_name(4)->name, {*acc, *value}) : nullopt;
+  }
+  return acc;
+}
+}
@@ -0,0 +1,41 @@
+#ifndef LISA_EVALUATOR
+#define LISA_EVALUATOR
+
+#include <lisa/type_checker.hpp>
+#include <string_theory/string>
+#include <unordered_map>
+#include <optional>
+#include <variant>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace lisa {
+struct node;
+struct def;
+
+// The value of a constant i32, f64 or bool expression.
+using constant = std::variant<std::int32_t, double, bool>;
+
+// Interprets calls to pure functions whose arguments are all literals and
+// replaces them with their result. Runs between type_checker and compiler;
+// a call that does not finish within `max_steps` nodes (or nests deeper
+// than `max_calls` calls) is left for run time.
+struct evaluator {
+  const std::unordered_map<ST::string, fn_type> &fn_table;
+  std::unordered_map<ST::string, const def *> defs;
+  std::vector<std::unordered_map<ST::string, constant>> frames;
+  std::size_t max_steps = 100000;
+  std::size_t max_calls = 256;
+  std::size_t steps = 0;
+
+  evaluator(const std::unordered_map<ST::string, fn_type> &);
+
+  auto fold(node &) -> void;
+  auto run(const node &) -> std::optional<constant>;
+  auto call(const ST::string &, const std::vector<constant> &) -> std::optional<constant>;
+  auto lookup(const ST::string &) const -> std::optional<constant>;
+};
+}
+
+#endif
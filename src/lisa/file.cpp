@@ -1,6 +1,13 @@
 #include <lisa/file.hpp>
 #include <cppfs/fs.h>
 #include <cppfs/FileHandle.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
 
 using ST::string;
 using cppfs::FileHandle;
@@ -18,4 +25,68 @@ namespace lisa {
       return make_unexpected("File does not exists");
     }
   }
+
+  mapped_file::mapped_file(mapped_file &&other) : data(other.data), size(other.size) {
+    other.data = nullptr;
+    other.size = 0;
+  }
+
+  mapped_file::~mapped_file() {
+    if (this->data) {
+      munmap(const_cast<char *>(this->data), this->size);
+    }
+  }
+
+  auto mapped_file::bytes() const -> std::string_view {
+    return {this->data, this->size};
+  }
+
+  // An empty file is not mapped, since mmap refuses a length of 0.
+  auto map_file(const string &path) -> expected<mapped_file, string> {
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return make_unexpected("File does not exists");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return make_unexpected("Cannot read the file");
+    }
+    mapped_file file;
+    if (st.st_size > 0) {
+      auto* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        close(fd);
+        return make_unexpected("Cannot map the file");
+      }
+      file.data = static_cast<const char *>(p);
+      file.size = st.st_size;
+    }
+    close(fd);
+    return file;
+  }
+
+  auto replace_file(const string &path, std::string_view data) -> expected<void, string> {
+    auto temp = std::string(path.c_str()) + ".XXXXXX";
+    auto fd = mkstemp(temp.data());
+    if (fd < 0) {
+      return make_unexpected("Cannot create a file next to the file");
+    }
+    // mkstemp makes the file private to its owner; give it the usual mode.
+    auto mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+
+    bool written = true;
+    for(std::size_t done = 0; written && done < data.size();) {
+      auto n = write(fd, data.data() + done, data.size() - done);
+      written = n >= 0;
+      done += written ? n : 0;
+    }
+    if (close(fd) != 0 || !written || std::rename(temp.c_str(), path.c_str()) != 0) {
+      unlink(temp.c_str());
+      return make_unexpected("Cannot write the file");
+    }
+    return {};
+  }
 }
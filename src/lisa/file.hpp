@@ -2,9 +2,32 @@
 #define LISA_FILE
 #include <string_theory/string>
 #include <tl/expected.hpp>
+#include <string_view>
+#include <cstddef>
 
 namespace lisa {
   auto read_file(const ST::string &) -> tl::expected<ST::string, ST::string>;
+
+  // A file mapped read-only into memory for as long as it lives, such as
+  // an AST file to read in place (see ast_view).
+  struct mapped_file {
+    const char* data = nullptr;
+    std::size_t size = 0;
+
+    mapped_file() = default;
+    mapped_file(mapped_file &&);
+    mapped_file(const mapped_file &) = delete;
+    ~mapped_file();
+
+    auto bytes() const -> std::string_view;
+  };
+
+  auto map_file(const ST::string &) -> tl::expected<mapped_file, ST::string>;
+
+  // Writes a file next to the one at the path and renames it over it, so
+  // that whoever maps or reads the file sees either all of the old one or
+  // all of the new one.
+  auto replace_file(const ST::string &, std::string_view) -> tl::expected<void, ST::string>;
 }
 
 #endif
@@ -1,9 +1,13 @@
 #include <lisa/lexer.hpp>
 #include <string_theory/format>
+#include <algorithm>
 #include <cstdlib>
 #include <cctype>
+#include <cstdint>
 
 using std::vector;
+using std::string_view;
+using std::uint32_t;
 using ST::string;
 using ST::format;
 using lisa::token;
@@ -40,157 +44,134 @@ auto str_of(token_kind kind) -> string {
   }
 }
 
-auto str_of_char(char ch) {
-  string result;
-  return result += ch;
+source::source(const string &c) : code(c), line_starts{0} {
+  auto text = this->code.view();
+  for(size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == '\n') {
+      this->line_starts.push_back(i + 1);
+    }
+  }
+}
+
+auto source::pos_of(size_t offset) const -> token_pos {
+  auto it = std::upper_bound(this->line_starts.cbegin(), this->line_starts.cend(), offset);
+  auto line_n = static_cast<size_t>(it - this->line_starts.cbegin());
+  return token_pos {line_n, offset - this->line_starts[line_n - 1] + 1};
+}
+
+auto source::line(size_t line_n) const -> string_view {
+  auto text = this->code.view();
+  size_t begin = this->line_starts[line_n - 1];
+  size_t end = line_n < this->line_starts.size() ? this->line_starts[line_n] - 1 : text.size();
+  return text.substr(begin, end - begin);
+}
+
+auto source::text(const token &t) const -> string_view {
+  return this->code.view().substr(t.offset, t.length);
+}
+
+auto source::raw(const token &t) const -> string {
+  return string(this->text(t));
+}
+
+auto make_token(size_t begin, size_t end, token_kind kind) {
+  return token {static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin), kind};
 }
 
-auto make_pos(size_t l, size_t c) {
-  return token_pos {l, c + 1};
+auto lexer::tokenize(const source &src) -> vector<token> {
+  vector<token> result{};
+  this->offset = 0;
+  this->last_end = 0;
+  this->next_batch(src, result, SIZE_MAX);
+  return result;
 }
 
-auto read_tokens_(vector<token> &result, const string& s, size_t line_n) {
-  for(size_t i = 0; i < s.size(); ++i) {
+// Appends at most `max` tokens, continuing where the previous batch
+// stopped. Returns false once the eof token has been appended.
+auto lexer::next_batch(const source &src, vector<token> &result, size_t max) -> bool {
+  auto s = src.code.view();
+  size_t first = result.size();
+
+  for(auto &i = this->offset; i < s.size(); ++i) {
+    if (result.size() - first >= max) {
+      this->last_end = result.back().offset + result.back().length;
+      return true;
+    }
     // consume whitespaces
-    while(isspace(s[i])) {
+    while(i < s.size() && isspace(s[i])) {
       ++i;
     }
-    //empty line
+    size_t begin = i;
+    // end of input
     if (i >= s.size()) {}
     // left paren
     else if (s[i] == '(') {
-      result.push_back(token{
-          make_pos(line_n, i),
-          token_kind::lpar,
-          str_of_char(s[i])
-      });
+      result.push_back(make_token(begin, i + 1, token_kind::lpar));
     }
     // right paren
     else if (s[i] == ')') {
-      result.push_back(token{
-          make_pos(line_n, i),
-          token_kind::rpar,
-          str_of_char(s[i])
-      });
+      result.push_back(make_token(begin, i + 1, token_kind::rpar));
     }
     // identifier
     else if (isalpha(s[i])) {
-      string read = str_of_char(s[i]);
-      
-      while(i + 1  < s.size() && (isalnum(s[i + 1]) || s[i + 1] == '-')) {
+      while(i + 1 < s.size() && (isalnum(s[i + 1]) || s[i + 1] == '-')) {
         ++i;
-        read += s[i];
       }
-
-      result.push_back(token{
-          make_pos(line_n, i),
-          token_kind::word,
-          read
-      });
+      // predicates and mutators, as in `set!`
+      if (i + 1 < s.size() && (s[i + 1] == '!' || s[i + 1] == '?')) {
+        ++i;
+      }
+      result.push_back(make_token(begin, i + 1, token_kind::word));
     }
     // string
     else if (s[i] == '"') {
-      string read;
-
-      while(i + 1 < s.size() && s[i + 1] != '"') {
+      while(i + 1 < s.size() && s[i + 1] != '"' && s[i + 1] != '\n') {
         ++i;
-        read += s[i];
       }
+      result.push_back(make_token(begin + 1, i + 1, token_kind::str));
       ++i;
-
-      result.push_back(token{
-          make_pos(line_n, i),
-          token_kind::str,
-          read
-      });
     }
-    // number
+    // number, with an optional type suffix as in `7i64` or `0.5f32`
     else if (isalnum(s[i])) {
-      string read = str_of_char(s[i]);
-
       while(i + 1 < s.size() && isdigit(s[i + 1])) {
         ++i;
-        read += s[i];
       }
 
-      // integer
-      if (i + 1 >= s.size() || s[i + 1] != '.') {
-        result.push_back(token{
-            make_pos(line_n, i),
-            token_kind::inum,
-            read
-        });
-      }
-      // floating point
-      else {
+      auto kind = token_kind::inum;
+      if (i + 1 < s.size() && s[i + 1] == '.') {
+        kind = token_kind::fnum;
         ++i;
-        read += s[i];
         while(i + 1 < s.size() && isdigit(s[i + 1])) {
           ++i;
-          read += s[i];
         }
-
-        result.push_back(token{
-            make_pos(line_n, i),
-            token_kind::fnum,
-            read
-        });
       }
+      while(i + 1 < s.size() && isalnum(s[i + 1])) {
+        ++i;
+      }
+      result.push_back(make_token(begin, i + 1, kind));
     }
     else if(s[i] == '\'') {
-      result.push_back(token{
-          make_pos(line_n, i),
-          token_kind::tysep,
-          str_of_char(s[i])
-      });
+      result.push_back(make_token(begin, i + 1, token_kind::tysep));
     }
     // operator
     else if(ispunct(s[i])) {
-      string read = str_of_char(s[i]);
-
       while(i + 1 < s.size() && ispunct(s[i + 1])) {
         ++i;
-        read += s[i];
       }
-
-      result.push_back(token{
-          make_pos(line_n, i),
-          token_kind::op,
-          read
-      });
+      result.push_back(make_token(begin, i + 1, token_kind::op));
     }
     // unknown
     else {
-      result.push_back(token{
-          make_pos(line_n, i),
-          token_kind::invalid,
-          str_of_char(s[i])
-      });
+      result.push_back(make_token(begin, i + 1, token_kind::invalid));
     }
   }
-}
-
-auto lexer::tokenize(const string &code) -> vector<token> {
-  vector<token> result{};
-
-  size_t line_n = 1;
-  for(auto &&s: code.split('\n')) {
-    read_tokens_(result, s, line_n);
-    ++line_n;
-  }
 
-  token_pos eof_pos = {0, 0};
-  if (!result.empty()) {
-    eof_pos = result.back().pos;
-    ++eof_pos.character;
+  size_t eof_pos = this->last_end;
+  if (result.size() > first) {
+    eof_pos = result.back().offset + result.back().length;
   }
+  result.push_back(make_token(eof_pos, eof_pos, token_kind::eof));
 
-  result.push_back(token{
-      eof_pos,
-      token_kind::eof,
-      "EOF"
-  });
-
-  return result;
+  return false;
 }
 }
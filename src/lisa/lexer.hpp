@@ -2,11 +2,13 @@
 #define LISA_LEXER
 
 #include <string_theory/string>
+#include <string_view>
+#include <cstdint>
 #include <cstdlib>
 #include <vector>
 
 namespace lisa {
-enum class token_kind {
+enum class token_kind : std::uint8_t {
   lpar, rpar, word, str, inum, fnum, op, tysep, eof, invalid
 };
 
@@ -19,14 +21,33 @@ struct token_pos {
   auto to_str() const -> ST::string;
 };
 
+// A token only records where its text lies in the source; line/column
+// positions are resolved through `source` when something needs them.
 struct token {
-  token_pos pos;
+  std::uint32_t offset;
+  std::uint32_t length;
   token_kind kind;
-  ST::string raw;
+};
+
+struct source {
+  ST::string code;
+  std::vector<std::uint32_t> line_starts;
+
+  source(const ST::string &);
+
+  auto pos_of(std::size_t offset) const -> token_pos;
+  auto line(std::size_t line_n) const -> std::string_view;
+  auto text(const token &) const -> std::string_view;
+  auto raw(const token &) const -> ST::string;
 };
 
 struct lexer {
-  auto tokenize(const ST::string &code) -> std::vector<token>;
+  // Where the next batch starts, and the end of the last token so far.
+  std::size_t offset = 0;
+  std::size_t last_end = 0;
+
+  auto tokenize(const source &) -> std::vector<token>;
+  auto next_batch(const source &, std::vector<token> &, std::size_t max) -> bool;
 };
 }
 
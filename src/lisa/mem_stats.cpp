@@ -0,0 +1,175 @@
+#include <lisa/mem_stats.hpp>
+#include <lisa/parser.hpp>
+#include <fmt/format.h>
+#include <atomic>
+#include <malloc.h>
+#include <sys/resource.h>
+
+using ST::string;
+using std::int64_t;
+using std::uint64_t;
+using std::vector;
+
+namespace lisa {
+namespace {
+struct counter {
+  std::atomic<uint64_t> allocs = 0;
+  std::atomic<uint64_t> frees = 0;
+  std::atomic<uint64_t> bytes = 0;
+  std::atomic<int64_t> live = 0;
+  std::atomic<int64_t> peak = 0;
+
+  auto alloc(void* p) -> void {
+    auto size = static_cast<int64_t>(malloc_usable_size(p));
+    this->allocs.fetch_add(1, std::memory_order_relaxed);
+    this->bytes.fetch_add(size, std::memory_order_relaxed);
+    auto now = this->live.fetch_add(size, std::memory_order_relaxed) + size;
+    auto peak = this->peak.load(std::memory_order_relaxed);
+    while(now > peak && !this->peak.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+  }
+
+  auto free(void* p) -> void {
+    auto size = static_cast<int64_t>(malloc_usable_size(p));
+    this->frees.fetch_add(1, std::memory_order_relaxed);
+    this->live.fetch_sub(size, std::memory_order_relaxed);
+  }
+
+  // Restarts the peak from what is live now.
+  auto read(bool restart) -> mem_counts {
+    mem_counts c;
+    c.allocs = this->allocs.load(std::memory_order_relaxed);
+    c.frees = this->frees.load(std::memory_order_relaxed);
+    c.bytes = this->bytes.load(std::memory_order_relaxed);
+    c.live = this->live.load(std::memory_order_relaxed);
+    c.peak = restart ? c.live : this->peak.load(std::memory_order_relaxed);
+    if (restart) {
+      this->peak.store(c.live, std::memory_order_relaxed);
+    }
+    return c;
+  }
+};
+
+std::atomic<bool> counting = false;
+counter heap_counter;
+counter node_counter;
+
+auto since(const mem_counts &start, const mem_counts &now) -> mem_counts {
+  return {
+    now.allocs - start.allocs,
+    now.frees - start.frees,
+    now.bytes - start.bytes,
+    now.live - start.live,
+    now.peak - start.live
+  };
+}
+
+auto max_rss() -> std::size_t {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+}
+}
+
+auto start_counting() -> void {
+  counting.store(true, std::memory_order_relaxed);
+}
+
+auto count_alloc(void* p) -> void {
+  if (p && counting.load(std::memory_order_relaxed)) {
+    heap_counter.alloc(p);
+  }
+}
+
+auto count_free(void* p) -> void {
+  if (p && counting.load(std::memory_order_relaxed)) {
+    heap_counter.free(p);
+  }
+}
+
+auto node::operator new(std::size_t size) -> void* {
+  auto* p = ::operator new(size);
+  if (counting.load(std::memory_order_relaxed)) {
+    node_counter.alloc(p);
+  }
+  return p;
+}
+
+auto node::operator delete(void* p, std::size_t) -> void {
+  if (p && counting.load(std::memory_order_relaxed)) {
+    node_counter.free(p);
+  }
+  ::operator delete(p);
+}
+
+auto mem_stats::start(const string &name) -> void {
+  if (!counting.load(std::memory_order_relaxed)) {
+    return;
+  }
+  this->stop();
+  this->phases.push_back({name});
+  this->heap_at_start = heap_counter.read(true);
+  this->nodes_at_start = node_counter.read(true);
+  this->running = true;
+}
+
+auto mem_stats::stop() -> void {
+  if (!this->running) {
+    return;
+  }
+  auto &phase = this->phases.back();
+  phase.heap = since(this->heap_at_start, heap_counter.read(false));
+  phase.nodes = since(this->nodes_at_start, node_counter.read(false));
+  phase.max_rss = max_rss();
+  this->running = false;
+}
+
+// Walks the tree as write_ast does, through the parts each node stores.
+auto mem_stats::census(const node &root) -> void {
+  this->nodes.clear();
+  for(int kind = 0; kind <= static_cast<int>(ast_kind::progn); ++kind) {
+    this->nodes.push_back({static_cast<ast_kind>(kind)});
+  }
+  ast_writer w;
+  vector<const node *> stack{&root};
+
+  while(!stack.empty()) {
+    auto* n = stack.back();
+    stack.pop_back();
+    w.parts.clear();
+    n->store(w);
+    auto &c = this->nodes[static_cast<std::size_t>(w.record.kind)];
+    ++c.count;
+    c.bytes += malloc_usable_size(const_cast<node *>(n));
+    for(auto* p: w.parts) {
+      if (p) {
+        stack.push_back(p);
+      }
+    }
+  }
+}
+
+auto mem_stats::report() const -> std::string {
+  auto out = fmt::format("{:<28} {:>10} {:>10} {:>12} {:>12} {:>12} {:>8} {:>12} {:>12}\n",
+      "phase", "allocs", "frees", "bytes", "live", "peak", "nodes", "node bytes", "max rss");
+  for(auto &&p: this->phases) {
+    out += fmt::format("{:<28} {:>10} {:>10} {:>12} {:>12} {:>12} {:>8} {:>12} {:>12}\n",
+        p.name.c_str(), p.heap.allocs, p.heap.frees, p.heap.bytes, p.heap.live, p.heap.peak,
+        p.nodes.allocs, p.nodes.bytes, p.max_rss);
+  }
+
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+  out += fmt::format("\n{:<28} {:>10} {:>12} {:>8}\n", "node", "count", "bytes", "each");
+  for(auto &&c: this->nodes) {
+    if (c.count == 0) {
+      continue;
+    }
+    out += fmt::format("{:<28} {:>10} {:>12} {:>8}\n",
+        str_of(c.kind).c_str(), c.count, c.bytes, c.bytes / c.count);
+    count += c.count;
+    bytes += c.bytes;
+  }
+  out += fmt::format("{:<28} {:>10} {:>12}\n", "total", count, bytes);
+  return out;
+}
+}
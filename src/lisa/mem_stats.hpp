@@ -0,0 +1,64 @@
+#ifndef LISA_MEM_STATS
+#define LISA_MEM_STATS
+#include <lisa/ast_file.hpp>
+#include <string_theory/string>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lisa {
+struct node;
+
+// Allocations are counted while counting is on, by the operator new of the
+// driver (see main.cpp) and by node::operator new for the tree alone. Sizes
+// are the usable sizes of the blocks, rounding included, so they add up to
+// what the heap really holds.
+auto start_counting() -> void;
+auto count_alloc(void *) -> void;
+auto count_free(void *) -> void;
+
+struct mem_counts {
+  std::uint64_t allocs = 0;
+  std::uint64_t frees = 0;
+  std::uint64_t bytes = 0;
+  // Bytes allocated less bytes freed, and the most that were live at once.
+  std::int64_t live = 0;
+  std::int64_t peak = 0;
+};
+
+struct mem_phase {
+  ST::string name;
+  mem_counts heap;
+  mem_counts nodes;
+  // The peak resident set size of the process when the phase ended.
+  std::size_t max_rss = 0;
+};
+
+struct node_census {
+  ast_kind kind;
+  std::uint64_t count = 0;
+  std::uint64_t bytes = 0;
+};
+
+// The memory used by each phase of a run. The live and peak counts of a
+// phase are relative to what was live when it started. Phases do not nest;
+// start ends the phase before it.
+struct mem_stats {
+  std::vector<mem_phase> phases;
+  std::vector<node_census> nodes;
+
+  auto start(const ST::string &) -> void;
+  auto stop() -> void;
+  // Counts the nodes of a tree by kind.
+  auto census(const node &) -> void;
+  auto report() const -> std::string;
+
+private:
+  bool running = false;
+  mem_counts heap_at_start;
+  mem_counts nodes_at_start;
+};
+}
+
+#endif
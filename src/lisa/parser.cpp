@@ -1,8 +1,11 @@
 #include <lisa/parser.hpp>
 #include <lisa/lexer.hpp>
 #include <string_theory/format>
+#include <string_theory/stringstream>
 #include <algorithm>
 #include <iterator>
+#include <utility>
+#include <cctype>
 
 using std::transform;
 using std::back_inserter;
@@ -17,17 +20,21 @@ using lisa::token;
 using lisa::token_kind;
 
 namespace lisa {
-auto parser::report(const token_pos &pos, const string &msg) {
+auto parser::raw(const token &t) const -> string {
+  return t.kind == token_kind::eof ? string("EOF") : this->src->raw(t);
+}
+
+auto parser::report(size_t pos, const string &msg) {
   this->errors.emplace_back(pos, msg);
 }
 
 auto parser::expect(const string &word, const token &t) -> bool {
-  if (word == t.raw) {
+  if (word.view() == this->src->text(t)) {
     return false;
   }
   else {
-    this->report(t.pos, format("Expected \"{}\", but found \"{}\"",
-          word, t.raw));
+    this->report(t.offset, format("Expected \"{}\", but found \"{}\"",
+          word, this->raw(t)));
     return true;
   }
 }
@@ -37,8 +44,8 @@ auto parser::expect(token_kind kind, const token &t) -> bool {
     return false;
   }
   else {
-    this->report(t.pos, format("Expected {}, but found \"{}\"",
-          str_of(kind), t.raw));
+    this->report(t.offset, format("Expected {}, but found \"{}\"",
+          str_of(kind), this->raw(t)));
     return true;
   }
 }
@@ -49,72 +56,553 @@ auto forward(size_t &i, const vector<token> &t) {
   }
 }
 
-auto parser::parse(const vector<token> &t) -> uniq<node> {
+auto parser::parse(const source &s, const vector<token> &t) -> uniq<node> {
+  this->src = &s;
   vector<uniq<node>> result;
   size_t i = 0;
   while(t[i].kind != token_kind::eof) {
     result.push_back(this->parse(t, i));
     forward(i, t);
   }
-  return make_unique<progn>(token_pos{1, 1}, std::move(result));
+  return make_unique<progn>(0, std::move(result));
+}
+
+auto parse_atom(parser& p, const vector<token> &t, size_t &i) -> uniq<node> {
+  if (t[i].kind == token_kind::word && (p.src->text(t[i]) == "true" || p.src->text(t[i]) == "false")) {
+    return boolc::parse(p, t, i);
+  }
+  else if (t[i].kind == token_kind::word || t[i].kind == token_kind::op) {
+    return id::parse(p, t, i);
+  }
+  else if (t[i].kind == token_kind::inum) {
+    return inum::parse(p, t, i);
+  }
+  else if (t[i].kind == token_kind::fnum) {
+    return fnum::parse(p, t, i);
+  }
+  else if (t[i].kind == token_kind::str) {
+    return strc::parse(p, t, i);
+  }
+  else {
+    p.report(t[i].offset, format("Unexpected token \"{}\"", p.raw(t[i])));
+    return nullptr;
+  }
+}
+
+// A form whose header has been read and whose body is still being filled;
+// `body` is null for forms that take no subexpressions.
+struct parse_frame {
+  uniq<node> target;
+  vector<uniq<node>>* body;
+};
+
+auto open_form(parser& p, const vector<token> &t, size_t &i) -> parse_frame {
+  if (i + 1 >= t.size()) {
+    return {nullptr, nullptr};
+  }
+  else if (t[i + 1].kind == token_kind::word &&
+      (p.src->text(t[i + 1]) == "def" || p.src->text(t[i + 1]) == "def-memo")) {
+    auto d = def::parse(p, t, i);
+    auto* body = &d->body;
+    // A def that takes functions is specialized like a generic.
+    auto higher_order = std::any_of(d->args.begin(), d->args.end(),
+        [](auto &&a) { return a && a->ty_name->name.starts_with("("); });
+    if (!d->type_params.empty() || higher_order) {
+      auto pos = d->pos;
+      return {make_unique<generic>(pos, std::move(d)), body};
+    }
+    return {std::move(d), body};
+  }
+  else if (t[i + 1].kind == token_kind::word && p.src->text(t[i + 1]) == "lambda") {
+    auto l = lambda::parse(p, t, i);
+    auto* body = &l->body;
+    return {std::move(l), body};
+  }
+  else if (t[i + 1].kind == token_kind::word && p.src->text(t[i + 1]) == "defstruct") {
+    return {defstruct::parse(p, t, i), nullptr};
+  }
+  else if (t[i + 1].kind == token_kind::word && p.src->text(t[i + 1]) == "extern") {
+    return {extern_::parse(p, t, i), nullptr};
+  }
+  else if (t[i + 1].kind == token_kind::word && p.src->text(t[i + 1]) == "let") {
+    auto l = let::parse(p, t, i);
+    auto* body = l ? &l->body : nullptr;
+    return {std::move(l), body};
+  }
+  else if (t[i + 1].kind == token_kind::word && p.src->text(t[i + 1]) == "set!") {
+    auto s = set::parse(p, t, i);
+    auto* body = s ? &s->value : nullptr;
+    return {std::move(s), body};
+  }
+  else if (t[i + 1].kind == token_kind::word && p.src->text(t[i + 1]) == "while") {
+    auto w = while_::parse(p, t, i);
+    auto* body = &w->body;
+    return {std::move(w), body};
+  }
+  else if (t[i + 1].kind == token_kind::word && p.src->text(t[i + 1]) == "dotimes") {
+    auto d = dotimes::parse(p, t, i);
+    auto* body = d ? &d->body : nullptr;
+    return {std::move(d), body};
+  }
+  else if (t[i + 1].kind == token_kind::word && p.src->text(t[i + 1]) == "par-reduce") {
+    auto r = par_reduce::parse(p, t, i);
+    auto* body = &r->args;
+    return {std::move(r), body};
+  }
+  else if (t[i + 1].kind == token_kind::word || t[i + 1].kind == token_kind::op) {
+    auto f = fn_call::parse(p, t, i);
+    auto* body = &f->args;
+    return {std::move(f), body};
+  }
+  else {
+    p.report(t[i].offset, format("Unexpected token \"{}\"", p.raw(t[i])));
+    return {nullptr, nullptr};
+  }
+}
+
+auto skip_form(const vector<token> &t, size_t &i) {
+  size_t depth = 0;
+  for(; t[i].kind != token_kind::eof; ++i) {
+    if (t[i].kind == token_kind::lpar) {
+      ++depth;
+    }
+    else if (t[i].kind == token_kind::rpar && --depth == 0) {
+      return;
+    }
+  }
 }
 
 auto parser::parse(const vector<token> &t, std::size_t &i) -> uniq<node> {
-  if (t[i].kind == token_kind::lpar) {
-    if (i + 1 >= t.size()) {
+  vector<parse_frame> stack;
+
+  while(true) {
+    uniq<node> done;
+
+    if (!stack.empty() && t[i].kind == token_kind::rpar) {
+      done = std::move(stack.back().target);
+      stack.pop_back();
+    }
+    else if (!stack.empty() && t[i].kind == token_kind::eof) {
+      this->expect(token_kind::rpar, t[i]);
       return nullptr;
     }
-    else if (t[i + 1].kind == token_kind::word && t[i + 1].raw == "def") {
-      return def::parse(*this, t, i);
+    else if (t[i].kind == token_kind::lpar && stack.size() >= this->max_depth) {
+      this->report(t[i].offset, format("Nesting exceeds the depth limit of {}", this->max_depth));
+      skip_form(t, i);
     }
-    else if (t[i + 1].kind == token_kind::word || t[i + 1].kind == token_kind::op) {
-      return fn_call::parse(*this, t, i);
+    else if (t[i].kind == token_kind::lpar) {
+      if (auto frame = open_form(*this, t, i); frame.target) {
+        stack.push_back(std::move(frame));
+        continue;
+      }
     }
     else {
-      this->report(t[i].pos, format("Unexpected token \"{}\"", t[i].raw));
-      return nullptr;
+      done = parse_atom(*this, t, i);
+    }
+
+    if (stack.empty()) {
+      return done;
+    }
+    if (stack.back().body) {
+      stack.back().body->push_back(std::move(done));
+    }
+    else if (done) {
+      this->report(done->pos, "Unexpected form");
     }
+    forward(i, t);
   }
-  else if (t[i].kind == token_kind::word && (t[i].raw == "true" || t[i].raw == "false")) {
-    return boolc::parse(*this, t, i);
+}
+
+node::~node() {}
+
+auto drop_nodes(vector<uniq<node>> &nodes) -> void {
+  auto pending = std::move(nodes);
+  while(!pending.empty()) {
+    auto n = std::move(pending.back());
+    pending.pop_back();
+    if (n) {
+      n->release(pending);
+    }
   }
-  else if (t[i].kind == token_kind::word || t[i].kind == token_kind::op) {
-    return id::parse(*this, t, i);
+}
+
+def::~def() { drop_nodes(this->body); }
+generic::~generic() { drop_nodes(this->instances); }
+fn_call::~fn_call() { drop_nodes(this->args); }
+par_reduce::~par_reduce() { drop_nodes(this->args); }
+let::~let() { drop_nodes(this->body); }
+set::~set() { drop_nodes(this->value); }
+while_::~while_() { drop_nodes(this->body); }
+dotimes::~dotimes() { drop_nodes(this->body); }
+lambda::~lambda() { drop_nodes(this->body); }
+progn::~progn() { drop_nodes(this->children); }
+
+auto node::subnodes() const -> vector<node *> {
+  return {};
+}
+
+auto node::slots() -> vector<uniq<node> *> {
+  return {};
+}
+
+auto node::release(vector<uniq<node>> &) -> void {}
+
+template <class T>
+auto ref_body(const vector<uniq<T>> &body) -> vector<node *> {
+  vector<node *> result;
+  transform(body.cbegin(), body.cend(), back_inserter(result),
+      [](auto &&p) { return p.get(); });
+  return result;
+}
+
+template <class T>
+auto release_body(vector<uniq<T>> &body, vector<uniq<node>> &to) {
+  std::move(body.begin(), body.end(), back_inserter(to));
+  body.clear();
+}
+
+auto def::subnodes() const -> vector<node *> {
+  return ref_body(this->body);
+}
+
+auto generic::subnodes() const -> vector<node *> {
+  return ref_body(this->instances);
+}
+
+auto fn_call::subnodes() const -> vector<node *> {
+  return ref_body(this->args);
+}
+
+auto lambda::subnodes() const -> vector<node *> {
+  return ref_body(this->body);
+}
+
+auto let::subnodes() const -> vector<node *> {
+  return ref_body(this->body);
+}
+
+auto set::subnodes() const -> vector<node *> {
+  return ref_body(this->value);
+}
+
+auto while_::subnodes() const -> vector<node *> {
+  return ref_body(this->body);
+}
+
+auto dotimes::subnodes() const -> vector<node *> {
+  return ref_body(this->body);
+}
+
+// The name at `i` when that argument is a plain name, otherwise null.
+auto par_reduce::fn_name(size_t i) const -> const id* {
+  return i < this->args.size() ? dynamic_cast<const id *>(this->args[i].get()) : nullptr;
+}
+
+auto par_reduce::subnodes() const -> vector<node *> {
+  vector<node *> result;
+  for(size_t i : {0, 1, 3}) {
+    if (i < this->args.size()) {
+      result.push_back(this->args[i].get());
+    }
   }
-  else if (t[i].kind == token_kind::inum) {
-    return inum::parse(*this, t, i);
+  return result;
+}
+
+auto progn::subnodes() const -> vector<node *> {
+  return ref_body(this->children);
+}
+
+template <class T>
+auto slots_of(vector<uniq<T>> &body) -> vector<uniq<node> *> {
+  vector<uniq<node> *> result;
+  for(auto &&p : body) {
+    result.push_back(&p);
   }
-  else if (t[i].kind == token_kind::fnum) {
-    return fnum::parse(*this, t, i);
+  return result;
+}
+
+auto def::slots() -> vector<uniq<node> *> {
+  return slots_of(this->body);
+}
+
+auto generic::slots() -> vector<uniq<node> *> {
+  return slots_of(this->instances);
+}
+
+auto fn_call::slots() -> vector<uniq<node> *> {
+  return slots_of(this->args);
+}
+
+auto lambda::slots() -> vector<uniq<node> *> {
+  return slots_of(this->body);
+}
+
+auto let::slots() -> vector<uniq<node> *> {
+  return slots_of(this->body);
+}
+
+auto set::slots() -> vector<uniq<node> *> {
+  return slots_of(this->value);
+}
+
+auto while_::slots() -> vector<uniq<node> *> {
+  return slots_of(this->body);
+}
+
+auto dotimes::slots() -> vector<uniq<node> *> {
+  return slots_of(this->body);
+}
+
+auto par_reduce::slots() -> vector<uniq<node> *> {
+  vector<uniq<node> *> result;
+  for(size_t i : {0, 1, 3}) {
+    if (i < this->args.size()) {
+      result.push_back(&this->args[i]);
+    }
   }
-  else {
-    this->report(t[i].pos, format("Unexpected token \"{}\"", t[i].raw));
-    return nullptr;
+  return result;
+}
+
+auto progn::slots() -> vector<uniq<node> *> {
+  return slots_of(this->children);
+}
+
+auto def::release(vector<uniq<node>> &to) -> void {
+  release_body(this->body, to);
+}
+
+auto generic::release(vector<uniq<node>> &to) -> void {
+  release_body(this->instances, to);
+  to.push_back(std::move(this->pattern));
+}
+
+auto fn_call::release(vector<uniq<node>> &to) -> void {
+  release_body(this->args, to);
+}
+
+auto lambda::release(vector<uniq<node>> &to) -> void {
+  release_body(this->body, to);
+}
+
+auto let::release(vector<uniq<node>> &to) -> void {
+  release_body(this->body, to);
+}
+
+auto set::release(vector<uniq<node>> &to) -> void {
+  release_body(this->value, to);
+}
+
+auto while_::release(vector<uniq<node>> &to) -> void {
+  release_body(this->body, to);
+}
+
+auto dotimes::release(vector<uniq<node>> &to) -> void {
+  release_body(this->body, to);
+}
+
+auto par_reduce::release(vector<uniq<node>> &to) -> void {
+  release_body(this->args, to);
+}
+
+auto progn::release(vector<uniq<node>> &to) -> void {
+  release_body(this->children, to);
+}
+
+auto copy_node(const node &root) -> uniq<node> {
+  struct frame {
+    const node* target;
+    vector<node *> subnodes;
+    vector<uniq<node>> copies;
+  };
+  vector<frame> stack;
+  bool complete = true;
+  stack.push_back({&root, root.subnodes(), {}});
+
+  while(true) {
+    auto &top = stack.back();
+    if (top.copies.size() < top.subnodes.size()) {
+      auto* next = top.subnodes[top.copies.size()];
+      if (!next) {
+        complete = false;
+        top.copies.push_back(nullptr);
+        continue;
+      }
+      stack.push_back({next, next->subnodes(), {}});
+      continue;
+    }
+    auto result = top.target->copy(std::move(top.copies));
+    complete = complete && result;
+    stack.pop_back();
+    if (stack.empty()) {
+      return complete ? std::move(result) : nullptr;
+    }
+    stack.back().copies.push_back(std::move(result));
   }
 }
 
-node::~node() {}
+auto node::copy(vector<uniq<node>> &&) const -> uniq<node> {
+  return nullptr;
+}
+
+auto copy_id(const id &name) -> uniq<id> {
+  return make_unique<id>(name.pos, name.name, name.is_op);
+}
+
+auto id::copy(vector<uniq<node>> &&) const -> uniq<node> {
+  return copy_id(*this);
+}
+
+auto boolc::copy(vector<uniq<node>> &&) const -> uniq<node> {
+  return make_unique<boolc>(this->pos, this->value);
+}
+
+auto inum::copy(vector<uniq<node>> &&) const -> uniq<node> {
+  return make_unique<inum>(this->pos, this->number, this->suffix);
+}
+
+auto fnum::copy(vector<uniq<node>> &&) const -> uniq<node> {
+  return make_unique<fnum>(this->pos, this->number, this->suffix);
+}
+
+auto strc::copy(vector<uniq<node>> &&) const -> uniq<node> {
+  return make_unique<strc>(this->pos, this->value);
+}
+
+auto copy_args(const vector<uniq<typed<id>>> &args) -> vector<uniq<typed<id>>> {
+  vector<uniq<typed<id>>> result;
+  for(auto &&a : args) {
+    result.push_back(make_unique<typed<id>>(a->pos, copy_id(*a->ty_name), copy_id(*a->raw)));
+  }
+  return result;
+}
+
+// The copy of a generic's pattern is an ordinary def.
+auto def::copy(vector<uniq<node>> &&body) const -> uniq<node> {
+  auto d = make_unique<def>(this->pos, copy_id(*this->fn_name), copy_args(this->args), std::move(body), this->memo);
+  d->fast_math = this->fast_math;
+  d->fp_contract = this->fp_contract;
+  return d;
+}
+
+// Captures are found again when the copy is checked.
+auto lambda::copy(vector<uniq<node>> &&body) const -> uniq<node> {
+  return make_unique<lambda>(this->pos, copy_args(this->args), std::move(body));
+}
+
+auto fn_call::copy(vector<uniq<node>> &&args) const -> uniq<node> {
+  return make_unique<fn_call>(this->pos, copy_id(*this->fn_name), std::move(args));
+}
+
+auto par_reduce::copy(vector<uniq<node>> &&subnodes) const -> uniq<node> {
+  vector<uniq<node>> args(this->args.size());
+  size_t next = 0;
+  for(size_t i : {0, 1, 3}) {
+    if (i < args.size()) {
+      args[i] = std::move(subnodes[next++]);
+    }
+  }
+  for(size_t i : {2, 4}) {
+    if (auto* name = this->fn_name(i); name) {
+      args[i] = copy_id(*name);
+    }
+    else if (i < args.size()) {
+      return nullptr;
+    }
+  }
+  return make_unique<par_reduce>(this->pos, std::move(args));
+}
+
+auto let::copy(vector<uniq<node>> &&body) const -> uniq<node> {
+  return make_unique<let>(this->pos, copy_id(*this->var_name), std::move(body));
+}
+
+auto set::copy(vector<uniq<node>> &&value) const -> uniq<node> {
+  return make_unique<set>(this->pos, copy_id(*this->var_name), std::move(value));
+}
+
+auto while_::copy(vector<uniq<node>> &&body) const -> uniq<node> {
+  return make_unique<while_>(this->pos, std::move(body));
+}
+
+auto dotimes::copy(vector<uniq<node>> &&body) const -> uniq<node> {
+  return make_unique<dotimes>(this->pos, copy_id(*this->var_name), std::move(body));
+}
 
 auto node::repr() const -> string {
+  struct frame {
+    const node* target;
+    vector<node *> subnodes;
+    size_t next;
+  };
+  ST::string_stream ss;
+  vector<frame> stack;
+  ss << this->repr_open();
+  stack.push_back({this, this->subnodes(), 0});
+
+  while(!stack.empty()) {
+    auto &top = stack.back();
+    if (top.next < top.subnodes.size()) {
+      auto* next = top.subnodes[top.next];
+      if (top.next++ > 0) {
+        ss << ", ";
+      }
+      ss << next->repr_open();
+      stack.push_back({next, next->subnodes(), 0});
+      continue;
+    }
+    ss << top.target->repr_close();
+    stack.pop_back();
+  }
+  return ss.to_string();
+}
+
+auto node::repr_open() const -> string {
   return "<node>";
 }
 
-auto id::repr() const -> string {
+auto node::repr_close() const -> string {
+  return "";
+}
+
+auto id::repr_open() const -> string {
   return format("{{\"kind\":\"id\", \"name\":\"{}\", \"is_op\": {}}}",
       this->name,
       this->is_op);
 }
 
-auto boolc::repr() const -> string {
+auto boolc::repr_open() const -> string {
   return format("{{\"kind\":\"boolc\", \"value\":{}}}", this->value);
 }
 
-auto inum::repr() const -> string {
-  return format("{{\"kind\":\"inum\", \"number\":{}}}", this->number);
+auto repr_suffix(const string &suffix) -> string {
+  return suffix.empty() ? string() : format(", \"suffix\":\"{}\"", suffix);
+}
+
+auto inum::repr_open() const -> string {
+  return format("{{\"kind\":\"inum\", \"number\":{}{}}}", this->number, repr_suffix(this->suffix));
 }
 
-auto fnum::repr() const -> string {
-  return format("{{\"kind\":\"fnum\", \"number\":{}}}", this->number);
+auto fnum::repr_open() const -> string {
+  return format("{{\"kind\":\"fnum\", \"number\":{}{}}}", this->number, repr_suffix(this->suffix));
+}
+
+auto strc::repr_open() const -> string {
+  ST::string_stream escaped;
+  for(auto ch : this->value.view()) {
+    if (ch == '\\') {
+      escaped << "\\\\";
+    }
+    else if (ch == '\n') {
+      escaped << "\\n";
+    }
+    else if (ch == '\t') {
+      escaped << "\\t";
+    }
+    else {
+      escaped.append_char(ch);
+    }
+  }
+  return format("{{\"kind\":\"strc\", \"value\":\"{}\"}}", escaped.to_string());
 }
 
 template <class T>
@@ -132,74 +620,197 @@ auto repr_body(const vector<uniq<T>> &body) -> string {
   return result;
 }
 
-auto def::repr() const -> string {
-  return format("{{\"kind\":\"def\", \"fn_name\":{}, \"args\":{}, \"body\":{}}}",
+auto def::repr_open() const -> string {
+  return format("{{\"kind\":\"{}\", \"fn_name\":{}, \"args\":{}, \"fast_math\":{}, \"fp_contract\":{}, \"body\":[",
+      this->memo ? "def-memo" : "def",
       this->fn_name->repr(),
       repr_body(this->args),
-      repr_body(this->body));
+      this->fast_math,
+      this->fp_contract);
+}
+
+auto def::repr_close() const -> string {
+  return "]}";
+}
+
+auto generic::repr_open() const -> string {
+  return format("{{\"kind\":\"generic\", \"type_params\":{}, \"pattern\":{}, \"instances\":[",
+      repr_body(this->pattern->type_params),
+      this->pattern->repr());
+}
+
+auto generic::repr_close() const -> string {
+  return "]}";
+}
+
+auto fn_call::repr_open() const -> string {
+  return format("{{\"kind\":\"fn_call\", \"fn_name\":{}, \"args\":[",
+      this->fn_name->repr());
 }
 
-auto fn_call::repr() const -> string {
-  return format("{{\"kind\":\"fn_call\", \"fn_name\":{}, \"args\":{}}}",
+auto fn_call::repr_close() const -> string {
+  return "]}";
+}
+
+auto lambda::repr_open() const -> string {
+  return format("{{\"kind\":\"lambda\", \"args\":{}, \"body\":[", repr_body(this->args));
+}
+
+auto lambda::repr_close() const -> string {
+  return "]}";
+}
+
+auto defstruct::repr_open() const -> string {
+  return format("{{\"kind\":\"defstruct\", \"struct_name\":{}, \"fields\":{}}}",
+      this->struct_name->repr(),
+      repr_body(this->fields));
+}
+
+auto extern_::repr_open() const -> string {
+  return format("{{\"kind\":\"extern\", \"fn_name\":{}, \"args\":{}, \"ret\":{}}}",
       this->fn_name->repr(),
-      repr_body(this->args));
+      repr_body(this->args),
+      this->ret_name ? this->ret_name->repr() : "null");
 }
 
-auto progn::repr() const -> string {
-  return repr_body(this->children);
+auto let::repr_open() const -> string {
+  return format("{{\"kind\":\"let\", \"var_name\":{}, \"body\":[",
+      this->var_name->repr());
 }
 
-auto fn_call::ref_args() const -> vector<node *> {
-  vector<node *> result;
-  transform(this->args.cbegin(), this->args.cend(), back_inserter(result),
-      [](auto &&p) { return p.get(); });
-  return result;
+auto let::repr_close() const -> string {
+  return "]}";
 }
 
+auto set::repr_open() const -> string {
+  return format("{{\"kind\":\"set\", \"var_name\":{}, \"value\":[",
+      this->var_name->repr());
+}
 
-auto id::parse(parser&, const vector<token> &t, size_t &i) -> uniq<id> {
-  return make_unique<id>(t[i].pos, t[i].raw, t[i].kind == token_kind::op);
+auto set::repr_close() const -> string {
+  return "]}";
 }
 
-auto boolc::parse(parser &, const vector<token> &t, size_t &i) -> uniq<boolc> {
-  return make_unique<boolc>(t[i].pos, t[i].raw.to_bool());
+auto while_::repr_open() const -> string {
+  return "{\"kind\":\"while\", \"body\":[";
 }
 
-auto inum::parse(parser&, const vector<token> &t, size_t &i) -> uniq<inum> {
-  return make_unique<inum>(t[i].pos, t[i].raw.to_ulong_long());
+auto while_::repr_close() const -> string {
+  return "]}";
 }
 
-auto fnum::parse(parser&, const vector<token> &t, size_t &i) -> uniq<fnum> {
-  return make_unique<fnum>(t[i].pos, t[i].raw.to_double());
+auto dotimes::repr_open() const -> string {
+  return format("{{\"kind\":\"dotimes\", \"var_name\":{}, \"body\":[",
+      this->var_name->repr());
 }
 
-auto parse_body(parser& p, const vector<token> &t, size_t &i)  -> vector<uniq<node>> {
-  vector<uniq<node>> result;
+auto dotimes::repr_close() const -> string {
+  return "]}";
+}
+
+auto par_reduce::repr_open() const -> string {
+  return format("{{\"kind\":\"par_reduce\", \"fn\":{}, \"combine\":{}, \"args\":[",
+      this->fn_name(2) ? this->fn_name(2)->repr() : "null",
+      this->fn_name(4) ? this->fn_name(4)->repr() : "null");
+}
+
+auto par_reduce::repr_close() const -> string {
+  return "]}";
+}
+
+auto progn::repr_open() const -> string {
+  return "[";
+}
+
+auto progn::repr_close() const -> string {
+  return "]";
+}
 
-  while(t[i].kind != token_kind::eof && t[i].kind != token_kind::rpar) {
-    result.push_back(p.parse(t, i));
+auto id::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<id> {
+  return make_unique<id>(t[i].offset, p.raw(t[i]), t[i].kind == token_kind::op);
+}
+
+auto parse_type_name(parser& p, const vector<token> &t, size_t &i) -> uniq<id> {
+  if (t[i].kind != token_kind::lpar) {
+    return id::parse(p, t, i);
+  }
+  auto pos = t[i].offset;
+  forward(i, t);
+
+  string name = "(";
+  while(t[i].kind == token_kind::word) {
+    name += p.raw(t[i]) + " ";
     forward(i, t);
   }
+  if (p.expect("->", t[i])) {
+    return make_unique<id>(pos, name, false);
+  }
+  forward(i, t);
+  if (p.expect(token_kind::word, t[i])) {
+    return make_unique<id>(pos, name, false);
+  }
+  name += "-> " + p.raw(t[i]) + ")";
+  forward(i, t);
+  p.expect(token_kind::rpar, t[i]);
+  return make_unique<id>(pos, name, false);
+}
 
-  if (p.expect(token_kind::rpar, t[i])) {
-    return {};
+auto boolc::parse(parser &p, const vector<token> &t, size_t &i) -> uniq<boolc> {
+  return make_unique<boolc>(t[i].offset, p.raw(t[i]).to_bool());
+}
+
+// Splits a number into its digits and its type suffix.
+auto split_number(const string &raw) -> std::pair<string, string> {
+  size_t k = 0;
+  while(k < raw.size() && (isdigit(raw[k]) || raw[k] == '.')) {
+    ++k;
   }
+  return {raw.left(k), raw.substr(k)};
+}
 
-  return result;
+auto inum::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<inum> {
+  auto [digits, suffix] = split_number(p.raw(t[i]));
+  return make_unique<inum>(t[i].offset, digits.to_ulong_long(), suffix);
+}
+
+auto fnum::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<fnum> {
+  auto [digits, suffix] = split_number(p.raw(t[i]));
+  return make_unique<fnum>(t[i].offset, digits.to_double(), suffix);
+}
+
+// The lexer ends a string at the first quote, so only \\n, \\t and \\\\
+// are escapes.
+auto strc::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<strc> {
+  auto raw = p.src->text(t[i]);
+  ST::string_stream value;
+  for(size_t k = 0; k < raw.size(); ++k) {
+    if (raw[k] != '\\' || k + 1 == raw.size()) {
+      value.append_char(raw[k]);
+      continue;
+    }
+    switch(raw[++k]) {
+    case 'n': value.append_char('\n'); break;
+    case 't': value.append_char('\t'); break;
+    case '\\': value.append_char('\\'); break;
+    default:
+      p.report(t[i].offset + k - 1, format("Unknown escape \"\\{}\"", raw[k]));
+    }
+  }
+  return make_unique<strc>(t[i].offset, value.to_string());
 }
 
+// Reads "(name"; the arguments are filled in by parser::parse.
 auto fn_call::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<fn_call> {
   if (p.expect(token_kind::lpar, t[i])) {
     return nullptr;
   }
+  auto pos = t[i].offset;
   forward(i, t);
 
   auto fn_name = id::parse(p, t, i);
   forward(i, t);
 
-  auto args = parse_body(p, t, i);
-
-  return make_unique<fn_call>(t[i].pos, std::move(fn_name), std::move(args));
+  return make_unique<fn_call>(pos, std::move(fn_name), vector<uniq<node>>{});
 }
 
 auto parse_def_args(parser& p, const vector<token> &t, size_t &i) -> vector<uniq<typed<id>>> {
@@ -224,25 +835,194 @@ auto parse_def_args(parser& p, const vector<token> &t, size_t &i) -> vector<uniq
   return result;
 }
 
+// Reads an optional "(declare flags...)" right after the argument list.
+auto parse_declare(parser& p, def &d, const vector<token> &t, size_t &i) {
+  if (t[i].kind != token_kind::lpar || i + 1 >= t.size() || p.src->text(t[i + 1]) != "declare") {
+    return;
+  }
+  forward(i, t);
+  forward(i, t);
+
+  while(t[i].kind == token_kind::word) {
+    if (p.src->text(t[i]) == "fast-math") {
+      d.fast_math = true;
+    }
+    else if (p.src->text(t[i]) == "fp-contract") {
+      d.fp_contract = true;
+    }
+    else {
+      p.report(t[i].offset, format("Unknown declaration \"{}\"", p.raw(t[i])));
+    }
+    forward(i, t);
+  }
+
+  if (p.expect(token_kind::rpar, t[i])) {
+    return;
+  }
+  forward(i, t);
+}
+
+// Reads "(def name (args...)" or "(def-memo name (args...)" and its
+// declarations; the body is filled in by parser::parse.
 auto def::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<def> {
   if (p.expect(token_kind::lpar, t[i])) {
     return nullptr;
   }
+  auto pos = t[i].offset;
   forward(i, t);
 
-  if (p.expect("def", t[i])) {
+  bool memo = p.src->text(t[i]) == "def-memo";
+  if (!memo && p.expect("def", t[i])) {
     return nullptr;
   }
   forward(i, t);
 
+  // "(name T...)" names a generic and its type parameters
+  vector<uniq<id>> type_params;
+  bool generic = t[i].kind == token_kind::lpar;
+  if (generic) {
+    forward(i, t);
+  }
   auto fn_name = id::parse(p, t, i);
   forward(i, t);
+  if (generic) {
+    while(t[i].kind == token_kind::word) {
+      type_params.push_back(id::parse(p, t, i));
+      forward(i, t);
+    }
+    if (type_params.empty()) {
+      p.report(t[i].offset, format("Expected a type parameter, but found \"{}\"", p.raw(t[i])));
+    }
+    if (p.expect(token_kind::rpar, t[i])) {
+      type_params.clear();
+    }
+    forward(i, t);
+  }
 
   auto args = parse_def_args(p, t, i);
   forward(i, t);
 
-  auto body = parse_body(p, t, i);
+  auto d = make_unique<def>(pos, std::move(fn_name), std::move(args), vector<uniq<node>>{}, memo);
+  d->type_params = std::move(type_params);
+  parse_declare(p, *d, t, i);
+  return d;
+}
+
+// Reads "(lambda (args...)"; the body is filled in by parser::parse.
+auto lambda::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<lambda> {
+  auto pos = t[i].offset;
+  forward(i, t);
+  forward(i, t);
+
+  auto args = parse_def_args(p, t, i);
+  forward(i, t);
+
+  return make_unique<lambda>(pos, std::move(args), vector<uniq<node>>{});
+}
+
+// Reads "(par-reduce"; the arguments are filled in by parser::parse.
+auto par_reduce::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<par_reduce> {
+  if (p.expect(token_kind::lpar, t[i])) {
+    return nullptr;
+  }
+  auto pos = t[i].offset;
+  forward(i, t);
+  forward(i, t);
+
+  return make_unique<par_reduce>(pos, vector<uniq<node>>{});
+}
+
+// Reads "(let name", "(set! name" or "(dotimes name"; the rest of the form
+// is filled in by parser::parse.
+template<class T>
+auto parse_binding(parser& p, const vector<token> &t, size_t &i) -> uniq<T> {
+  if (p.expect(token_kind::lpar, t[i])) {
+    return nullptr;
+  }
+  auto pos = t[i].offset;
+  forward(i, t);
+  forward(i, t);
+
+  if (p.expect(token_kind::word, t[i])) {
+    return nullptr;
+  }
+  auto var_name = id::parse(p, t, i);
+  forward(i, t);
+
+  return make_unique<T>(pos, std::move(var_name), vector<uniq<node>>{});
+}
+
+auto let::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<let> {
+  return parse_binding<let>(p, t, i);
+}
+
+auto set::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<set> {
+  return parse_binding<set>(p, t, i);
+}
+
+auto dotimes::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<dotimes> {
+  return parse_binding<dotimes>(p, t, i);
+}
+
+// Reads "(while"; the condition and body are filled in by parser::parse.
+auto while_::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<while_> {
+  if (p.expect(token_kind::lpar, t[i])) {
+    return nullptr;
+  }
+  auto pos = t[i].offset;
+  forward(i, t);
+  forward(i, t);
+
+  return make_unique<while_>(pos, vector<uniq<node>>{});
+}
+
+// Reads the whole "(defstruct name (fields...)" header; only the closing
+// paren is left to parser::parse.
+auto defstruct::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<defstruct> {
+  if (p.expect(token_kind::lpar, t[i])) {
+    return nullptr;
+  }
+  auto pos = t[i].offset;
+  forward(i, t);
+  forward(i, t);
+
+  if (p.expect(token_kind::word, t[i])) {
+    return nullptr;
+  }
+  auto struct_name = id::parse(p, t, i);
+  forward(i, t);
+
+  auto fields = parse_def_args(p, t, i);
+  forward(i, t);
+
+  return make_unique<defstruct>(pos, std::move(struct_name), std::move(fields));
+}
+
+// Reads the whole "(extern name (args...) ret" header; only the closing
+// paren is left to parser::parse.
+auto extern_::parse(parser& p, const vector<token> &t, size_t &i) -> uniq<extern_> {
+  if (p.expect(token_kind::lpar, t[i])) {
+    return nullptr;
+  }
+  auto pos = t[i].offset;
+  forward(i, t);
+  forward(i, t);
+
+  if (p.expect(token_kind::word, t[i])) {
+    return nullptr;
+  }
+  auto fn_name = id::parse(p, t, i);
+  forward(i, t);
+
+  auto args = parse_def_args(p, t, i);
+  forward(i, t);
+
+  uniq<id> ret_name;
+  if (t[i].kind == token_kind::word) {
+    ret_name = id::parse(p, t, i);
+    forward(i, t);
+  }
 
-  return make_unique<def>(t[i].pos, std::move(fn_name), std::move(args), std::move(body));
+  return make_unique<extern_>(pos, std::move(fn_name), std::move(args), std::move(ret_name));
 }
 }
@@ -2,15 +2,21 @@
 #define LISA_PARSER
 #include <lisa/lexer.hpp>
 #include <lisa/util.hpp>
+#include <lisa/evaluator.hpp>
 #include <llvm/IR/Value.h>
 #include <string_theory/string>
 #include <memory>
+#include <optional>
 #include <vector>
+#include <cstdint>
 #include <cstddef>
 
 namespace lisa {
 struct compiler;
 struct type_checker;
+struct evaluator;
+struct vm_assembler;
+struct ast_writer;
 struct type;
 using type_t = type;
 
@@ -18,58 +24,110 @@ struct node;
 
 struct parser {
   std::vector<error> errors;
+  std::size_t max_depth = 65536;
+  const source* src = nullptr;
 
-  auto parse(const std::vector<token> &) -> std::unique_ptr<node>;
+  auto parse(const source &, const std::vector<token> &) -> std::unique_ptr<node>;
   auto parse(const std::vector<token> &, std::size_t &i) -> std::unique_ptr<node>;
 
-  auto report(const token_pos&, const ST::string &);
+  auto raw(const token &) const -> ST::string;
+  auto report(std::size_t, const ST::string &);
   auto expect(const ST::string &, const token &) -> bool;
   auto expect(token_kind, const token &) -> bool;
 };
 
+// Every walk over the tree (repr, type, gen) is driven by an explicit stack,
+// so nodes only describe one level: `subnodes` lists the subexpressions in
+// evaluation order, the `repr_open`/`enter` hooks run before them, `step`
+// after each of them and the `repr_close`/`type`/`gen`/`eval`/`lower`/`copy`
+// hooks after all of them. `store` describes the node for write_ast.
 struct node {
-  token_pos pos;
+  std::size_t pos;
+  type_t* ty = nullptr;
 
-  node(const token_pos &p) : pos(p) {}
+  node(std::size_t p) : pos(p) {}
   virtual ~node();
-  virtual auto repr() const -> ST::string;
-  virtual auto gen(compiler &) const -> llvm::Value* = 0;
+  // Count the nodes apart from other allocations; see mem_stats.
+  static auto operator new(std::size_t) -> void*;
+  static auto operator delete(void *, std::size_t) -> void;
+  auto repr() const -> ST::string;
+
+  virtual auto subnodes() const -> std::vector<node *>;
+  virtual auto slots() -> std::vector<std::unique_ptr<node> *>;
+  virtual auto release(std::vector<std::unique_ptr<node>> &) -> void;
+  virtual auto repr_open() const -> ST::string;
+  virtual auto repr_close() const -> ST::string;
+  virtual auto enter(type_checker &) -> void;
+  virtual auto step(type_checker &, std::size_t) -> void;
   virtual auto type(type_checker &) -> type_t* = 0;
+  virtual auto enter(compiler &) const -> void;
+  virtual auto step(compiler &, const std::vector<llvm::Value *> &) const -> void;
+  virtual auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value* = 0;
+  virtual auto eval(evaluator &, const std::vector<constant> &) const -> std::optional<constant>;
+  virtual auto enter(vm_assembler &) const -> void;
+  virtual auto lower(vm_assembler &, const std::vector<std::uint16_t> &, std::uint16_t) const -> std::uint16_t;
+  virtual auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  virtual auto store(ast_writer &) const -> void = 0;
 };
 
+auto drop_nodes(std::vector<std::unique_ptr<node>> &) -> void;
+// An untyped copy of the tree, or null if it has a node that cannot be
+// copied.
+auto copy_node(const node &) -> std::unique_ptr<node>;
+
 struct id : node {
   ST::string name;
   bool is_op;
   
-  id(const token_pos &p, const ST::string &n, bool i) : node(p), name(n), is_op(i) {}
+  id(std::size_t p, const ST::string &n, bool i) : node(p), name(n), is_op(i) {}
   
-  auto repr() const -> ST::string;
-  auto gen(compiler &) const -> llvm::Value*;
+  auto repr_open() const -> ST::string;
   auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto eval(evaluator &, const std::vector<constant> &) const -> std::optional<constant>;
+  auto lower(vm_assembler &, const std::vector<std::uint16_t> &, std::uint16_t) const -> std::uint16_t;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
 
   static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<id>;
 };
 
+// Reads the type after a "'": a type name, or a function type such as
+// "(i32 f64 -> bool)", which is named by its canonical spelling.
+auto parse_type_name(parser &, const std::vector<token> &, std::size_t &) -> std::unique_ptr<id>;
+
 struct boolc : node {
   bool value;
 
-  boolc(const token_pos &p, bool v) : node(p), value(v) {}
+  boolc(std::size_t p, bool v) : node(p), value(v) {}
 
-  auto repr() const -> ST::string;
-  auto gen(compiler &) const -> llvm::Value*;
+  auto repr_open() const -> ST::string;
   auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto eval(evaluator &, const std::vector<constant> &) const -> std::optional<constant>;
+  auto lower(vm_assembler &, const std::vector<std::uint16_t> &, std::uint16_t) const -> std::uint16_t;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
 
   static auto parse(parser &, const std::vector<token> &, std::size_t &) -> std::unique_ptr<boolc>;
 };
 
+// A number literal without a type suffix is an i32 or f64, but it takes
+// the type of the other operands or of the parameter it is passed for if
+// its value fits (see fn_call::type).
 struct inum : node {
   unsigned long long number;
+  ST::string suffix;
   
-  inum(const token_pos &p, unsigned long long n) : node(p), number(n) {}
+  inum(std::size_t p, unsigned long long n, const ST::string &s = {}) : node(p), number(n), suffix(s) {}
 
-  auto repr() const -> ST::string;
-  auto gen(compiler &) const -> llvm::Value*;
+  auto repr_open() const -> ST::string;
   auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto eval(evaluator &, const std::vector<constant> &) const -> std::optional<constant>;
+  auto lower(vm_assembler &, const std::vector<std::uint16_t> &, std::uint16_t) const -> std::uint16_t;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
 
   static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<inum>;
 };
@@ -77,85 +135,372 @@ struct inum : node {
 struct fnum : node {
   double number;
   
-  fnum(const token_pos &p, double n) : node(p), number(n) {}
+  ST::string suffix;
 
-  auto repr() const -> ST::string;
-  auto gen(compiler &) const -> llvm::Value*;
+  fnum(std::size_t p, double n, const ST::string &s = {}) : node(p), number(n), suffix(s) {}
+
+  auto repr_open() const -> ST::string;
   auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto eval(evaluator &, const std::vector<constant> &) const -> std::optional<constant>;
+  auto lower(vm_assembler &, const std::vector<std::uint16_t> &, std::uint16_t) const -> std::uint16_t;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
 
   static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<fnum>;
 };
 
+// A string literal. It is a constant of the executable, so it never lives
+// in a region.
+struct strc : node {
+  ST::string value;
+
+  strc(std::size_t p, const ST::string &v) : node(p), value(v) {}
+
+  auto repr_open() const -> ST::string;
+  auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
+
+  static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<strc>;
+};
+
 template<class T>
 struct typed : node {
   std::unique_ptr<id> ty_name;
   std::unique_ptr<T> raw;
 
   typed(
-      const token_pos &p,
+      std::size_t p,
       std::unique_ptr<id> &&t,
       std::unique_ptr<T> &&r
   ) : node(p), ty_name(std::move(t)), raw(std::move(r)) {}
 
-  auto repr() const -> ST::string;
-  auto gen(compiler &) const -> llvm::Value*;
+  auto repr_open() const -> ST::string;
   auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto store(ast_writer &) const -> void;
 
   static auto parse(parser&, std::unique_ptr<T>&&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<typed<T>>;
 };
 
 struct def : node {
   std::unique_ptr<id> fn_name;
+  // Set for the pattern of a generic, which reads "(def (name T...)".
+  std::vector<std::unique_ptr<id>> type_params;
   std::vector<std::unique_ptr<typed<id>>> args;
   std::vector<std::unique_ptr<node>> body;
+  bool memo;
+  bool fast_math = false;
+  bool fp_contract = false;
 
   def(
-      const token_pos &p,
+      std::size_t p,
       std::unique_ptr<id> &&f,
       std::vector<std::unique_ptr<typed<id>>> &&a,
-      std::vector<std::unique_ptr<node>> &&b
-  ) : node(p), fn_name(std::move(f)), args(std::move(a)), body(std::move(b)) {}
-
-  auto repr() const -> ST::string;
-  auto gen(compiler &) const -> llvm::Value*;
+      std::vector<std::unique_ptr<node>> &&b,
+      bool m = false
+  ) : node(p), fn_name(std::move(f)), args(std::move(a)), body(std::move(b)), memo(m) {}
+  ~def();
+
+  auto subnodes() const -> std::vector<node *>;
+  auto slots() -> std::vector<std::unique_ptr<node> *>;
+  auto release(std::vector<std::unique_ptr<node>> &) -> void;
+  auto repr_open() const -> ST::string;
+  auto repr_close() const -> ST::string;
+  auto enter(type_checker &) -> void;
   auto type(type_checker &) -> type_t*;
+  auto enter(compiler &) const -> void;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto enter(vm_assembler &) const -> void;
+  auto lower(vm_assembler &, const std::vector<std::uint16_t> &, std::uint16_t) const -> std::uint16_t;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
 
   static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<def>;
 };
 
+// A def with type parameters. It is not compiled itself: the type checker
+// copies it for every list of argument types it is called with, so the
+// instances, which are ordinary defs, are its subnodes.
+struct generic : node {
+  std::unique_ptr<def> pattern;
+  std::vector<std::unique_ptr<node>> instances;
+
+  generic(
+      std::size_t p,
+      std::unique_ptr<def> &&d
+  ) : node(p), pattern(std::move(d)) {}
+  ~generic();
+
+  auto subnodes() const -> std::vector<node *>;
+  auto slots() -> std::vector<std::unique_ptr<node> *>;
+  auto release(std::vector<std::unique_ptr<node>> &) -> void;
+  auto repr_open() const -> ST::string;
+  auto repr_close() const -> ST::string;
+  auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto lower(vm_assembler &, const std::vector<std::uint16_t> &, std::uint16_t) const -> std::uint16_t;
+  auto store(ast_writer &) const -> void;
+};
+
 struct fn_call : node {
   std::unique_ptr<id> fn_name;
   std::vector<std::unique_ptr<node>> args;
+  // Set by the type checker when `fn_name` is a variable holding a
+  // function; `fn_name->ty` is then its type.
+  bool via_variable = false;
 
   fn_call(
-      const token_pos &p,
+      std::size_t p,
       std::unique_ptr<id> &&f,
       std::vector<std::unique_ptr<node>> &&a
   ) : node(p), fn_name(std::move(f)), args(std::move(a)) {}
-  
-  auto repr() const -> ST::string;
-  auto gen(compiler &) const -> llvm::Value*;
-  auto type(type_checker &) -> type_t*;
+  ~fn_call();
 
-  auto ref_args() const -> std::vector<node *>;
+  auto subnodes() const -> std::vector<node *>;
+  auto slots() -> std::vector<std::unique_ptr<node> *>;
+  auto release(std::vector<std::unique_ptr<node>> &) -> void;
+  auto repr_open() const -> ST::string;
+  auto repr_close() const -> ST::string;
+  auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto eval(evaluator &, const std::vector<constant> &) const -> std::optional<constant>;
+  auto lower(vm_assembler &, const std::vector<std::uint16_t> &, std::uint16_t) const -> std::uint16_t;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
 
   static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<fn_call>;
 };
 
+// (lambda (arg'type...) body...): a function value. The type checker finds
+// the variables it captures and gives it a type of its own, whose values
+// are the captured values; the compiler turns the body into a function
+// named `fn_label` that takes them through an environment pointer.
+struct lambda : node {
+  std::vector<std::unique_ptr<typed<id>>> args;
+  std::vector<std::unique_ptr<node>> body;
+  std::vector<ST::string> captures;
+  ST::string fn_label;
+
+  lambda(
+      std::size_t p,
+      std::vector<std::unique_ptr<typed<id>>> &&a,
+      std::vector<std::unique_ptr<node>> &&b
+  ) : node(p), args(std::move(a)), body(std::move(b)) {}
+  ~lambda();
+
+  auto subnodes() const -> std::vector<node *>;
+  auto slots() -> std::vector<std::unique_ptr<node> *>;
+  auto release(std::vector<std::unique_ptr<node>> &) -> void;
+  auto repr_open() const -> ST::string;
+  auto repr_close() const -> ST::string;
+  auto enter(type_checker &) -> void;
+  auto type(type_checker &) -> type_t*;
+  auto enter(compiler &) const -> void;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
+
+  static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<lambda>;
+};
+
+// (defstruct name (field'type...)): a struct type passed by value.
+struct defstruct : node {
+  std::unique_ptr<id> struct_name;
+  std::vector<std::unique_ptr<typed<id>>> fields;
+
+  defstruct(
+      std::size_t p,
+      std::unique_ptr<id> &&n,
+      std::vector<std::unique_ptr<typed<id>>> &&f
+  ) : node(p), struct_name(std::move(n)), fields(std::move(f)) {}
+
+  auto repr_open() const -> ST::string;
+  auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto store(ast_writer &) const -> void;
+
+  static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<defstruct>;
+};
+
+// (extern name (arg'type...) ret): a function defined outside Lisa, called
+// with the C calling convention. Without `ret` it returns nothing.
+struct extern_ : node {
+  std::unique_ptr<id> fn_name;
+  std::vector<std::unique_ptr<typed<id>>> args;
+  std::unique_ptr<id> ret_name;
+
+  extern_(
+      std::size_t p,
+      std::unique_ptr<id> &&f,
+      std::vector<std::unique_ptr<typed<id>>> &&a,
+      std::unique_ptr<id> &&r
+  ) : node(p), fn_name(std::move(f)), args(std::move(a)), ret_name(std::move(r)) {}
+
+  auto repr_open() const -> ST::string;
+  auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto store(ast_writer &) const -> void;
+
+  static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<extern_>;
+};
+
+// (par-reduce from to fn init combine): `fn` and `combine` name functions,
+// so only `from`, `to` and `init` are subexpressions.
+struct par_reduce : node {
+  std::vector<std::unique_ptr<node>> args;
+
+  par_reduce(
+      std::size_t p,
+      std::vector<std::unique_ptr<node>> &&a
+  ) : node(p), args(std::move(a)) {}
+  ~par_reduce();
+
+  auto fn_name(std::size_t) const -> const id*;
+  auto subnodes() const -> std::vector<node *>;
+  auto slots() -> std::vector<std::unique_ptr<node> *>;
+  auto release(std::vector<std::unique_ptr<node>> &) -> void;
+  auto repr_open() const -> ST::string;
+  auto repr_close() const -> ST::string;
+  auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto eval(evaluator &, const std::vector<constant> &) const -> std::optional<constant>;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
+
+  static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<par_reduce>;
+};
+
+// (let name init body...): `name` is a mutable local bound to `init` in
+// `body`. The value is that of the last form of `body`.
+struct let : node {
+  std::unique_ptr<id> var_name;
+  std::vector<std::unique_ptr<node>> body;
+
+  let(
+      std::size_t p,
+      std::unique_ptr<id> &&v,
+      std::vector<std::unique_ptr<node>> &&b
+  ) : node(p), var_name(std::move(v)), body(std::move(b)) {}
+  ~let();
+
+  auto subnodes() const -> std::vector<node *>;
+  auto slots() -> std::vector<std::unique_ptr<node> *>;
+  auto release(std::vector<std::unique_ptr<node>> &) -> void;
+  auto repr_open() const -> ST::string;
+  auto repr_close() const -> ST::string;
+  auto step(type_checker &, std::size_t) -> void;
+  auto type(type_checker &) -> type_t*;
+  auto step(compiler &, const std::vector<llvm::Value *> &) const -> void;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
+
+  static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<let>;
+};
+
+// (set! name value): assigns a local or an argument and yields `value`.
+struct set : node {
+  std::unique_ptr<id> var_name;
+  std::vector<std::unique_ptr<node>> value;
+
+  set(
+      std::size_t p,
+      std::unique_ptr<id> &&v,
+      std::vector<std::unique_ptr<node>> &&e
+  ) : node(p), var_name(std::move(v)), value(std::move(e)) {}
+  ~set();
+
+  auto subnodes() const -> std::vector<node *>;
+  auto slots() -> std::vector<std::unique_ptr<node> *>;
+  auto release(std::vector<std::unique_ptr<node>> &) -> void;
+  auto repr_open() const -> ST::string;
+  auto repr_close() const -> ST::string;
+  auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
+
+  static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<set>;
+};
+
+// (while cond body...): a statement.
+struct while_ : node {
+  std::vector<std::unique_ptr<node>> body;
+
+  while_(
+      std::size_t p,
+      std::vector<std::unique_ptr<node>> &&b
+  ) : node(p), body(std::move(b)) {}
+  ~while_();
+
+  auto subnodes() const -> std::vector<node *>;
+  auto slots() -> std::vector<std::unique_ptr<node> *>;
+  auto release(std::vector<std::unique_ptr<node>> &) -> void;
+  auto repr_open() const -> ST::string;
+  auto repr_close() const -> ST::string;
+  auto type(type_checker &) -> type_t*;
+  auto enter(compiler &) const -> void;
+  auto step(compiler &, const std::vector<llvm::Value *> &) const -> void;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
+
+  static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<while_>;
+};
+
+// (dotimes name count body...): runs `body` with `name` counting from 0 up
+// to `count` (exclusive); a statement.
+struct dotimes : node {
+  std::unique_ptr<id> var_name;
+  std::vector<std::unique_ptr<node>> body;
+
+  dotimes(
+      std::size_t p,
+      std::unique_ptr<id> &&v,
+      std::vector<std::unique_ptr<node>> &&b
+  ) : node(p), var_name(std::move(v)), body(std::move(b)) {}
+  ~dotimes();
+
+  auto subnodes() const -> std::vector<node *>;
+  auto slots() -> std::vector<std::unique_ptr<node> *>;
+  auto release(std::vector<std::unique_ptr<node>> &) -> void;
+  auto repr_open() const -> ST::string;
+  auto repr_close() const -> ST::string;
+  auto step(type_checker &, std::size_t) -> void;
+  auto type(type_checker &) -> type_t*;
+  auto step(compiler &, const std::vector<llvm::Value *> &) const -> void;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto copy(std::vector<std::unique_ptr<node>> &&) const -> std::unique_ptr<node>;
+  auto store(ast_writer &) const -> void;
+
+  static auto parse(parser&, const std::vector<token> &, std::size_t &) -> std::unique_ptr<dotimes>;
+};
+
 struct progn : node {
   std::vector<std::unique_ptr<node>> children;
 
   progn(
-      const token_pos &p,
+      std::size_t p,
       std::vector<std::unique_ptr<node>> &&c
   ) : node(p), children(std::move(c)) {}
+  ~progn();
 
-  auto repr() const -> ST::string;
-  auto gen(compiler &) const -> llvm::Value*;
+  auto subnodes() const -> std::vector<node *>;
+  auto slots() -> std::vector<std::unique_ptr<node> *>;
+  auto release(std::vector<std::unique_ptr<node>> &) -> void;
+  auto repr_open() const -> ST::string;
+  auto repr_close() const -> ST::string;
   auto type(type_checker &) -> type_t*;
+  auto gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
+  auto lower(vm_assembler &, const std::vector<std::uint16_t> &, std::uint16_t) const -> std::uint16_t;
+  auto store(ast_writer &) const -> void;
 };
 }
 
+#include <lisa/ast_file.hpp>
 #include <string_theory/format>
 #include <vector>
 #include <memory>
@@ -168,21 +513,27 @@ auto typed<T>::parse(parser& p, std::unique_ptr<T>&& raw, const std::vector<toke
   }
   ++i;
 
-  auto ty_name = id::parse(p, t, i);
+  auto ty_name = parse_type_name(p, t, i);
 
-  return std::make_unique<typed<T>>(t[i].pos, std::move(ty_name), std::move(raw));
+  return std::make_unique<typed<T>>(t[i].offset, std::move(ty_name), std::move(raw));
 }
 
 template<class T>
-auto typed<T>::repr() const -> ST::string {
+auto typed<T>::repr_open() const -> ST::string {
   return ST::format("{{\"kind\":\"typed\", \"ty_name\":{}, \"raw\":{}}}", this->ty_name->repr(), this->raw->repr());
 }
 
 template<class T>
-auto typed<T>::gen(compiler &) const -> llvm::Value* { return nullptr; }
+auto typed<T>::gen(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value* { return nullptr; }
 
 template<class T>
 auto typed<T>::type(type_checker &) -> type_t* { return nullptr; }
+
+template<class T>
+auto typed<T>::store(ast_writer &w) const -> void {
+  w.record.kind = ast_kind::typed;
+  w.parts = {this->ty_name.get(), this->raw.get()};
+}
 }
 
 #endif
@@ -0,0 +1,100 @@
+#include <lisa/pipeline.hpp>
+#include <lisa/spsc_queue.hpp>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using std::vector;
+template<class T>
+using uniq = std::unique_ptr<T>;
+using std::size_t;
+
+namespace lisa {
+namespace {
+constexpr size_t batch_size = 1024;
+
+struct token_batch {
+  vector<token> tokens;
+  bool last = false;
+};
+
+// `checked` is false once the parser has reported an error, after which
+// the forms are only collected.
+struct parsed_form {
+  uniq<node> ast;
+  bool checked = false;
+  bool last = false;
+};
+}
+
+auto parse_pipelined(const source &src, parser &p, type_checker &t) -> uniq<node> {
+  spsc_queue<token_batch, 64> batches;
+  spsc_queue<parsed_form, 256> forms;
+
+  std::thread lexing([&] {
+    auto l = lexer();
+    for(bool more = true; more;) {
+      token_batch b;
+      b.tokens.reserve(batch_size);
+      more = l.next_batch(src, b.tokens, batch_size);
+      b.last = !more;
+      batches.push(std::move(b));
+    }
+  });
+
+  // Tracks the nesting depth of the incoming tokens to find where each
+  // top-level form ends, and parses it from there.
+  std::thread parsing([&] {
+    p.src = &src;
+    vector<token> tokens;
+    size_t start = 0;
+    size_t scanned = 0;
+    size_t depth = 0;
+    auto emit = [&] {
+      auto i = start;
+      auto ast = p.parse(tokens, i);
+      forms.push({std::move(ast), p.errors.empty(), false});
+    };
+
+    for(bool last = false; !last;) {
+      auto b = batches.pop();
+      tokens.insert(tokens.end(), b.tokens.begin(), b.tokens.end());
+      last = b.last;
+
+      for(; scanned < tokens.size() && tokens[scanned].kind != token_kind::eof; ++scanned) {
+        if (tokens[scanned].kind == token_kind::lpar) {
+          ++depth;
+        }
+        else if (tokens[scanned].kind == token_kind::rpar && depth > 0) {
+          --depth;
+        }
+        if (depth == 0) {
+          emit();
+          start = scanned + 1;
+        }
+      }
+    }
+    if (tokens[start].kind != token_kind::eof) {
+      emit();
+    }
+    forms.push({nullptr, false, true});
+  });
+
+  vector<uniq<node>> program;
+  while(true) {
+    auto f = forms.pop();
+    if (f.last) {
+      break;
+    }
+    if (f.checked) {
+      t.check(*f.ast);
+    }
+    program.push_back(std::move(f.ast));
+  }
+  lexing.join();
+  parsing.join();
+
+  t.finish();
+  return std::make_unique<progn>(0, std::move(program));
+}
+}
@@ -0,0 +1,18 @@
+#ifndef LISA_PIPELINE
+#define LISA_PIPELINE
+
+#include <lisa/lexer.hpp>
+#include <lisa/parser.hpp>
+#include <lisa/type_checker.hpp>
+#include <memory>
+
+namespace lisa {
+// Lexes, parses and type checks `src` with the three phases running on
+// their own threads, connected by spsc_queues: the lexer hands over token
+// batches and the parser each top-level form as soon as it is closed.
+// Errors end up in `p` and `t` as with the sequential phases. Folding and
+// code generation need the whole program and still run afterwards.
+auto parse_pipelined(const source &src, parser &p, type_checker &t) -> std::unique_ptr<node>;
+}
+
+#endif
@@ -1,13 +1,21 @@
 #include <lisa/primitive.hpp>
 
 namespace lisa {
-prim_fn::prim_fn(const ST::string &name, const fn_type &t, raw_t* g) :
-  t(t), generator(g) { prim_fn_map[name] = this; }
+prim_fn::prim_fn(const ST::string &name, const fn_type &t, raw_t* g, fold_t* f) :
+  t(t), generator(g), folder(f) { prim_fn_map[name] = this; }
 
-auto prim_fn::operator()(compiler &c, const std::vector<node *> &v) const -> llvm::Value* {
+auto prim_fn::operator()(compiler &c, const std::vector<llvm::Value *> &v) const -> llvm::Value* {
   return generator(c, v);
 }
 
+auto intrinsic_fn::find(const ST::string &name, const fn_type &t) -> const intrinsic_fn* {
+  auto it = intrinsic_fn_map.find(name);
+  if (it == intrinsic_fn_map.end() || it->second.t.ret != t.ret || it->second.t.args != t.args) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
 auto prim_fn::find(const ST::string &name) -> prim_fn* {
   if (auto it = prim_fn_map.find(name); it != prim_fn_map.end()) {
     return it->second;
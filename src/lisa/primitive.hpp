@@ -3,9 +3,19 @@
 #include <lisa/type_checker.hpp>
 #include <lisa/compiler.hpp>
 #include <lisa/parser.hpp>
+#include <lisa/evaluator.hpp>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/Value.h>
 #include <unordered_map>
+#include <memory>
+#include <optional>
+#include <variant>
 #include <vector>
+#include <cstdint>
+#include <climits>
 
 namespace lisa {
 struct type;
@@ -13,101 +23,364 @@ extern type i32;
 extern type f64;
 extern type bool_;
 extern type statement;
+extern type i8;
+extern type i16;
+extern type i64;
+extern type u32;
+extern type f32;
+extern type list_;
+extern type str_;
 
 struct prim_fn {
-  using raw_t = llvm::Value* (compiler&, const std::vector<node *>&);
+  using raw_t = llvm::Value* (compiler&, const std::vector<llvm::Value *>&);
+  using fold_t = std::optional<constant> (const std::vector<constant>&);
   fn_type t;
   raw_t* generator;
+  fold_t* folder;
 
-  prim_fn(const ST::string &, const fn_type &, raw_t*);
-  auto operator()(compiler &, const std::vector<node *> &) const -> llvm::Value*;
+  prim_fn(const ST::string &, const fn_type &, raw_t*, fold_t* = nullptr);
+  auto operator()(compiler &, const std::vector<llvm::Value *> &) const -> llvm::Value*;
 
   static auto find(const ST::string &) -> prim_fn*;
 };
 
 inline std::unordered_map<ST::string, prim_fn*> prim_fn_map;
 
-inline prim_fn prim_and("and", {&bool_, {&bool_, &bool_}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+// C functions that an extern declaration maps to an LLVM intrinsic when it
+// is declared with the signature given here.
+struct intrinsic_fn {
+  llvm::Intrinsic::ID id;
+  fn_type t;
+
+  static auto find(const ST::string &, const fn_type &) -> const intrinsic_fn*;
+};
+
+inline const std::unordered_map<ST::string, intrinsic_fn> intrinsic_fn_map = {
+  {"sqrt", {llvm::Intrinsic::sqrt, {&f64, {&f64}}}},
+  {"fabs", {llvm::Intrinsic::fabs, {&f64, {&f64}}}},
+  {"floor", {llvm::Intrinsic::floor, {&f64, {&f64}}}},
+  {"ceil", {llvm::Intrinsic::ceil, {&f64, {&f64}}}},
+  {"trunc", {llvm::Intrinsic::trunc, {&f64, {&f64}}}},
+  {"round", {llvm::Intrinsic::round, {&f64, {&f64}}}},
+  {"exp", {llvm::Intrinsic::exp, {&f64, {&f64}}}},
+  {"log", {llvm::Intrinsic::log, {&f64, {&f64}}}},
+  {"sin", {llvm::Intrinsic::sin, {&f64, {&f64}}}},
+  {"cos", {llvm::Intrinsic::cos, {&f64, {&f64}}}},
+  {"pow", {llvm::Intrinsic::pow, {&f64, {&f64, &f64}}}},
+  {"fmin", {llvm::Intrinsic::minnum, {&f64, {&f64, &f64}}}},
+  {"fmax", {llvm::Intrinsic::maxnum, {&f64, {&f64, &f64}}}},
+  {"copysign", {llvm::Intrinsic::copysign, {&f64, {&f64, &f64}}}},
+  {"popcount", {llvm::Intrinsic::ctpop, {&i32, {&i32}}}},
+};
+
+inline prim_fn prim_and("and", {&bool_, {&bool_, &bool_}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateAnd(lhs, rhs, "primand");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return std::get<bool>(args[0]) && std::get<bool>(args[1]);
 });
 
-inline prim_fn prim_or("or", {&bool_, {&bool_, &bool_}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+inline prim_fn prim_or("or", {&bool_, {&bool_, &bool_}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateOr(lhs, rhs, "primor");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return std::get<bool>(args[0]) || std::get<bool>(args[1]);
 });
 
-inline prim_fn prim_not("not", {&bool_, {&bool_}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* arg = args[0]->gen(c);
+inline prim_fn prim_not("not", {&bool_, {&bool_}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* arg = args[0];
   return c.builder.CreateNot(arg, "primnot");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return !std::get<bool>(args[0]);
 });
 
-inline prim_fn prim_ieq("__ieq", {&bool_, {&i32, &i32}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+inline prim_fn prim_ieq("__ieq", {&bool_, {&i32, &i32}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateICmpEQ(lhs, rhs, "primeq");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return std::get<std::int32_t>(args[0]) == std::get<std::int32_t>(args[1]);
 });
 
-inline prim_fn prim_feq("__feq", {&bool_, {&f64, &f64}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+inline prim_fn prim_feq("__feq", {&bool_, {&f64, &f64}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateFCmpOEQ(lhs, rhs, "primeq");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return std::get<double>(args[0]) == std::get<double>(args[1]);
 });
 
-inline prim_fn prim_iadd("__iadd", {&i32, {&i32, &i32}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+inline prim_fn prim_ilt("__ilt", {&bool_, {&i32, &i32}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
+  return c.builder.CreateICmpSLT(rhs, lhs, "primlt");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return std::get<std::int32_t>(args[1]) < std::get<std::int32_t>(args[0]);
+});
+
+inline prim_fn prim_flt("__flt", {&bool_, {&f64, &f64}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
+  return c.builder.CreateFCmpOLT(rhs, lhs, "primlt");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return std::get<double>(args[1]) < std::get<double>(args[0]);
+});
+
+inline prim_fn prim_iadd("__iadd", {&i32, {&i32, &i32}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateAdd(lhs, rhs, "primadd");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  auto lhs = static_cast<std::uint32_t>(std::get<std::int32_t>(args[0]));
+  auto rhs = static_cast<std::uint32_t>(std::get<std::int32_t>(args[1]));
+  return static_cast<std::int32_t>(lhs + rhs);
 });
 
-inline prim_fn prim_isub("__isub", {&i32, {&i32, &i32}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+inline prim_fn prim_isub("__isub", {&i32, {&i32, &i32}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateSub(rhs, lhs, "primsub");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  auto lhs = static_cast<std::uint32_t>(std::get<std::int32_t>(args[0]));
+  auto rhs = static_cast<std::uint32_t>(std::get<std::int32_t>(args[1]));
+  return static_cast<std::int32_t>(rhs - lhs);
 });
 
-inline prim_fn prim_imul("__imul", {&i32, {&i32, &i32}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+inline prim_fn prim_imul("__imul", {&i32, {&i32, &i32}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateMul(lhs, rhs, "primmul");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  auto lhs = static_cast<std::uint32_t>(std::get<std::int32_t>(args[0]));
+  auto rhs = static_cast<std::uint32_t>(std::get<std::int32_t>(args[1]));
+  return static_cast<std::int32_t>(lhs * rhs);
 });
 
-inline prim_fn prim_idiv("__idiv", {&i32, {&i32, &i32}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+inline prim_fn prim_idiv("__idiv", {&i32, {&i32, &i32}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateSDiv(rhs, lhs, "primdiv");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  auto lhs = std::get<std::int32_t>(args[0]);
+  auto rhs = std::get<std::int32_t>(args[1]);
+  if (lhs == 0 || (lhs == -1 && rhs == INT32_MIN)) {
+    return std::nullopt;
+  }
+  return rhs / lhs;
 });
 
-inline prim_fn prim_fadd("__fadd", {&f64, {&f64, &f64}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+inline prim_fn prim_fadd("__fadd", {&f64, {&f64, &f64}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateFAdd(lhs, rhs, "primadd");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return std::get<double>(args[0]) + std::get<double>(args[1]);
 });
 
-inline prim_fn prim_fsub("__fsub", {&f64, {&f64, &f64}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+inline prim_fn prim_fsub("__fsub", {&f64, {&f64, &f64}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateFSub(rhs, lhs, "primsub");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return std::get<double>(args[1]) - std::get<double>(args[0]);
 });
 
-inline prim_fn prim_fmul("__fmul", {&f64, {&f64, &f64}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+inline prim_fn prim_fmul("__fmul", {&f64, {&f64, &f64}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateFMul(lhs, rhs, "primmul");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return std::get<double>(args[0]) * std::get<double>(args[1]);
 });
 
-inline prim_fn prim_fdiv("__fdiv", {&f64, {&f64, &f64}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* lhs = args[0]->gen(c);
-  auto* rhs = args[1]->gen(c);
+inline prim_fn prim_fdiv("__fdiv", {&f64, {&f64, &f64}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* lhs = args[0];
+  auto* rhs = args[1];
   return c.builder.CreateFDiv(rhs, lhs, "primdiv");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return std::get<double>(args[1]) / std::get<double>(args[0]);
+});
+
+// The operators of the other widths share the code of those of i32 and
+// f64, except for the unsigned division and comparison of u32, and are not
+// folded. Each is named after its i32 or f64 version and its type, as in
+// __iadd.i64.
+inline auto sized_name(const ST::string &base, const type &t) -> ST::string {
+  return ST::format("{}.{}", base, t.name);
+}
+
+inline auto gen_udiv(compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  return c.builder.CreateUDiv(args[1], args[0], "primdiv");
+}
+
+inline auto gen_ult(compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  return c.builder.CreateICmpULT(args[1], args[0], "primlt");
+}
+
+// (T x) converts the number x to the number type T. Integers are extended,
+// with sign unless x is a u32, or truncated; floats are rounded to the
+// nearest integer towards zero, saturating at the bounds of T.
+inline auto conversion_name(const type &to, const type &from) -> ST::string {
+  return ST::format("{}<{}>", to.name, from.name);
+}
+
+template<type* To, bool FromUnsigned>
+inline auto gen_convert(compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* v = args[0];
+  auto* from = v->getType();
+  auto* to = To->to_llvm(c.context);
+  if (from->isIntegerTy() && to->isIntegerTy()) {
+    return FromUnsigned ? c.builder.CreateZExtOrTrunc(v, to, "conv") : c.builder.CreateSExtOrTrunc(v, to, "conv");
+  }
+  if (from->isIntegerTy()) {
+    return FromUnsigned ? c.builder.CreateUIToFP(v, to, "conv") : c.builder.CreateSIToFP(v, to, "conv");
+  }
+  if (to->isIntegerTy()) {
+    auto id = To == &u32 ? llvm::Intrinsic::fptoui_sat : llvm::Intrinsic::fptosi_sat;
+    return c.builder.CreateIntrinsic(id, {to, from}, {v}, nullptr, "conv");
+  }
+  return c.builder.CreateFPCast(v, to, "conv");
+}
+
+template<type* To>
+inline auto add_conversions(std::vector<std::unique_ptr<prim_fn>> &prims) -> void {
+  for(auto* from : number_types) {
+    auto* gen = from == &u32 ? &gen_convert<To, true> : &gen_convert<To, false>;
+    prims.push_back(std::make_unique<prim_fn>(conversion_name(*To, *from), fn_type{To, {from}}, gen));
+  }
+}
+
+inline auto make_sized_prims() -> std::vector<std::unique_ptr<prim_fn>> {
+  std::vector<std::unique_ptr<prim_fn>> prims;
+  auto add = [&](const char* base, type* t, type* ret, prim_fn::raw_t* gen) {
+    prims.push_back(std::make_unique<prim_fn>(sized_name(base, *t), fn_type{ret, {t, t}}, gen));
+  };
+  for(auto* t : {&i8, &i16, &i64, &u32}) {
+    add("__iadd", t, t, prim_iadd.generator);
+    add("__isub", t, t, prim_isub.generator);
+    add("__imul", t, t, prim_imul.generator);
+    add("__idiv", t, t, t == &u32 ? &gen_udiv : prim_idiv.generator);
+    add("__ieq", t, &bool_, prim_ieq.generator);
+    add("__ilt", t, &bool_, t == &u32 ? &gen_ult : prim_ilt.generator);
+  }
+  add("__fadd", &f32, &f32, prim_fadd.generator);
+  add("__fsub", &f32, &f32, prim_fsub.generator);
+  add("__fmul", &f32, &f32, prim_fmul.generator);
+  add("__fdiv", &f32, &f32, prim_fdiv.generator);
+  add("__feq", &f32, &bool_, prim_feq.generator);
+  add("__flt", &f32, &bool_, prim_flt.generator);
+
+  add_conversions<&i8>(prims);
+  add_conversions<&i16>(prims);
+  add_conversions<&i32>(prims);
+  add_conversions<&i64>(prims);
+  add_conversions<&u32>(prims);
+  add_conversions<&f32>(prims);
+  add_conversions<&f64>(prims);
+  return prims;
+}
+
+inline const auto sized_prims = make_sized_prims();
+
+// a * b + c, fused only where the target makes that cheaper.
+inline prim_fn prim_fma("fma", {&f64, {&f64, &f64, &f64}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  return c.builder.CreateIntrinsic(llvm::Intrinsic::fmuladd, {args[0]->getType()}, args, nullptr, "primfma");
+}, [](const std::vector<constant>& args) -> std::optional<constant> {
+  return std::get<double>(args[0]) * std::get<double>(args[1]) + std::get<double>(args[2]);
 });
 
-inline prim_fn prim_return("return", {&statement, {nullptr}}, [](compiler &c, const std::vector<node *>& args) -> llvm::Value* {
-  auto* ret = args[0]->gen(c);
+inline prim_fn prim_return("return", {&statement, {nullptr}, false}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* ret = args[0];
+  c.leave();
   return c.builder.CreateRet(ret);
 });
+
+// The cell of a list, or a constant cell holding 0 and nil for the empty
+// list, so that `head` and `tail` never fault.
+inline auto cell_of(compiler &c, llvm::Value* xs) -> llvm::Value* {
+  auto* cell_t = list_.to_llvm(c.context)->getPointerElementType();
+  auto* nil = c.module.getOrInsertGlobal("lisa.nil", cell_t, [&] {
+    return new llvm::GlobalVariable(c.module, cell_t, true, llvm::GlobalValue::PrivateLinkage,
+        llvm::Constant::getNullValue(cell_t), "lisa.nil");
+  });
+  return c.builder.CreateSelect(c.builder.CreateIsNull(xs), nil, xs, "cell");
+}
+
+inline auto str_data(compiler &c, llvm::Value* s) -> llvm::Value* {
+  auto* str_t = str_.to_llvm(c.context)->getPointerElementType();
+  return c.builder.CreateGEP(str_t, s, {c.builder.getInt32(0), c.builder.getInt32(1), c.builder.getInt32(0)}, "data");
+}
+
+inline auto str_length(compiler &c, llvm::Value* s) -> llvm::Value* {
+  auto* str_t = str_.to_llvm(c.context)->getPointerElementType();
+  return c.builder.CreateLoad(c.builder.getInt64Ty(), c.builder.CreateStructGEP(str_t, s, 0), "length");
+}
+
+inline prim_fn prim_nil("nil", {&list_, {}}, [](compiler &c, const std::vector<llvm::Value *>&) -> llvm::Value* {
+  return llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(list_.to_llvm(c.context)));
+});
+
+inline prim_fn prim_cons("cons", {&list_, {&i32, &list_}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* list_t = list_.to_llvm(c.context);
+  auto* cell_t = list_t->getPointerElementType();
+  auto* cell = c.builder.CreateBitCast(c.allocate(llvm::ConstantExpr::getSizeOf(cell_t)), list_t, "cons");
+  c.builder.CreateStore(args[0], c.builder.CreateStructGEP(cell_t, cell, 0));
+  c.builder.CreateStore(args[1], c.builder.CreateStructGEP(cell_t, cell, 1));
+  return cell;
+});
+
+inline prim_fn prim_head("head", {&i32, {&list_}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* cell_t = list_.to_llvm(c.context)->getPointerElementType();
+  return c.builder.CreateLoad(c.builder.getInt32Ty(), c.builder.CreateStructGEP(cell_t, cell_of(c, args[0]), 0), "head");
+});
+
+inline prim_fn prim_tail("tail", {&list_, {&list_}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* list_t = list_.to_llvm(c.context);
+  auto* cell_t = list_t->getPointerElementType();
+  return c.builder.CreateLoad(list_t, c.builder.CreateStructGEP(cell_t, cell_of(c, args[0]), 1), "tail");
+});
+
+inline prim_fn prim_empty("empty?", {&bool_, {&list_}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  return c.builder.CreateIsNull(args[0], "empty");
+});
+
+inline prim_fn prim_str_len("str-len", {&i32, {&str_}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  return c.builder.CreateTrunc(str_length(c, args[0]), c.builder.getInt32Ty(), "strlen");
+});
+
+// (str-at s i): the byte at `i`, or 0 when `i` is out of range, which reads
+// the terminating zero instead.
+inline prim_fn prim_str_at("str-at", {&i32, {&str_, &i32}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* length = str_length(c, args[0]);
+  auto* i = c.builder.CreateSExt(args[1], c.builder.getInt64Ty());
+  auto* index = c.builder.CreateSelect(c.builder.CreateICmpULT(i, length), i, length);
+  auto* byte = c.builder.CreateLoad(c.builder.getInt8Ty(), c.builder.CreateGEP(c.builder.getInt8Ty(), str_data(c, args[0]), index));
+  return c.builder.CreateZExt(byte, c.builder.getInt32Ty(), "strat");
+});
+
+inline prim_fn prim_str_cat("str-cat", {&str_, {&str_, &str_}}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto* str_t = str_.to_llvm(c.context);
+  auto* lhs = str_length(c, args[0]);
+  auto* rhs = str_length(c, args[1]);
+  auto* length = c.builder.CreateAdd(lhs, rhs);
+  auto* block = c.allocate(c.builder.CreateAdd(length, c.builder.getInt64(sizeof(std::int64_t) + 1)));
+  auto* result = c.builder.CreateBitCast(block, str_t, "strcat");
+  c.builder.CreateStore(length, c.builder.CreateStructGEP(str_t->getPointerElementType(), result, 0));
+  auto* data = str_data(c, result);
+  c.builder.CreateMemCpy(data, llvm::MaybeAlign(1), str_data(c, args[0]), llvm::MaybeAlign(1), lhs);
+  c.builder.CreateMemCpy(c.builder.CreateGEP(c.builder.getInt8Ty(), data, lhs), llvm::MaybeAlign(1),
+      str_data(c, args[1]), llvm::MaybeAlign(1), rhs);
+  c.builder.CreateStore(c.builder.getInt8(0), c.builder.CreateGEP(c.builder.getInt8Ty(), data, length));
+  return result;
+});
+
+inline prim_fn prim_print_str("print-str", {&statement, {&str_}, false}, [](compiler &c, const std::vector<llvm::Value *>& args) -> llvm::Value* {
+  auto print = c.module.getOrInsertFunction("lisa_print_str", c.builder.getVoidTy(), str_.to_llvm(c.context));
+  c.builder.CreateCall(print, {args[0]});
+  return nullptr;
+});
 }
 
 #endif
@@ -0,0 +1,661 @@
+#include <lisa/session.hpp>
+#include <lisa/lexer.hpp>
+#include <lisa/parser.hpp>
+#include <lisa/type_checker.hpp>
+#include <lisa/evaluator.hpp>
+#include <lisa/compiler.hpp>
+#include <lisa/driver_interface.hpp>
+#include <lisa/primitive.hpp>
+#include <runtime/lisa_rt.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LazyReexports.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <string_theory/format>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_set>
+
+using std::unique_ptr;
+using std::vector;
+using ST::string;
+using ST::format;
+using tl::expected;
+using tl::make_unexpected;
+using llvm::orc::LLJIT;
+using llvm::orc::JITDylib;
+using std::unordered_map;
+using std::unordered_set;
+
+namespace lisa {
+namespace {
+auto failure(const std::string &msg) -> tl::unexpected<vector<error>> {
+  return make_unexpected(vector<error>{{0, string(msg.c_str())}});
+}
+
+auto swappable(const fn_type &fn) -> bool {
+  auto builtin = [](const type_t* t) {
+    return t && (is_integer(t) || is_float(t) || t == &bool_ || t == &statement || is_heap(t));
+  };
+  return builtin(fn.ret) && std::all_of(fn.args.cbegin(), fn.args.cend(), builtin);
+}
+
+// Parses, checks and, with `fold`, folds the code, or returns the errors of
+// the first phase that fails.
+auto front_end(const string &code, type_checker &checker, bool fold = true) -> expected<unique_ptr<node>, vector<error>> {
+  auto src = source(code);
+  auto tokens = lexer().tokenize(src);
+
+  auto p = parser();
+  auto ast = p.parse(src, tokens);
+  if (!p.errors.empty()) {
+    return make_unexpected(p.errors);
+  }
+
+  checker.type_check(*ast);
+  if (!checker.errors.empty()) {
+    return make_unexpected(checker.errors);
+  }
+
+  if (fold) {
+    evaluator(checker.fn_table).fold(*ast);
+  }
+  return ast;
+}
+
+// The body of version `n` of a def, which its stub points to.
+auto body_name(const string &name, std::size_t n) -> string {
+  return format("{}.v{}", name, n);
+}
+
+// Calls from the code of a live unit to its defs go to their stubs: every
+// swappable def is renamed to its body and its old name is left to a
+// declaration, which the stub dylib defines.
+auto route_through_stubs(llvm::Module &m, const vector<std::pair<string, fn_type>> &defs, std::size_t version) -> void {
+  for(auto &&[name, _]: defs) {
+    auto* body = m.getFunction(name.c_str());
+    auto* stub = llvm::Function::Create(body->getFunctionType(), llvm::Function::ExternalLinkage, "", m);
+    stub->copyAttributesFrom(body);
+    body->replaceAllUsesWith(stub);
+    body->setName(body_name(name, version).c_str());
+    stub->setName(name.c_str());
+  }
+}
+
+// The body of a def of a lazy unit, which its stub points to once it is
+// compiled. A def-memo already has a ".body" of its own.
+auto lazy_body_name(const string &name) -> string {
+  return format("{}.lazy", name);
+}
+
+// Where the stubs of a lazy unit go when a def cannot be compiled, which
+// checked code never gets to.
+auto lazy_failure() -> void {
+  std::fputs("lisa: a def failed to compile\n", stderr);
+  std::abort();
+}
+
+// The functions of the lambdas in a def, which are generated with it.
+auto lambdas_of(const def &d) -> vector<string> {
+  vector<string> result;
+  vector<const node *> stack{&d};
+  while(!stack.empty()) {
+    auto* n = stack.back();
+    stack.pop_back();
+    if (auto* l = dynamic_cast<const lambda *>(n); l) {
+      result.push_back(l->ty->lambda_fn);
+    }
+    for(auto* s: n->subnodes()) {
+      stack.push_back(s);
+    }
+  }
+  return result;
+}
+
+// What a def unit defines: the body of its def and the functions of its
+// lambdas, which instances of generics in other units call directly.
+auto def_interface(LLJIT &e, const def &d) -> llvm::orc::SymbolFlagsMap {
+  auto flags = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+  llvm::orc::SymbolFlagsMap symbols{{e.mangleAndIntern(lazy_body_name(d.fn_name->name).c_str()), flags}};
+  for(auto &&name: lambdas_of(d)) {
+    symbols[e.mangleAndIntern(name.c_str())] = flags;
+  }
+  return symbols;
+}
+
+// One def of a lazy unit, generated when its body is first looked up. Its
+// calls to the other defs go to their stubs, and only calls to itself are
+// direct.
+//
+// Each unit also gets the constructors and accessors of every struct, which
+// are always inlined, and keeps everything but its interface to itself.
+class def_unit : public llvm::orc::MaterializationUnit {
+public:
+  def_unit(LLJIT &e, const def &d, const node &a, const type_checker &t, const compile_options &o) :
+    MaterializationUnit(Interface(def_interface(e, d), nullptr)),
+    engine(e), fn(d), ast(a), checker(t), options(o) {}
+
+  auto getName() const -> llvm::StringRef override {
+    return "lisa-def";
+  }
+
+  auto materialize(unique_ptr<llvm::orc::MaterializationResponsibility> r) -> void override {
+    compiler c;
+    c.module.setTargetTriple(this->engine.getTargetTriple().str());
+    c.module.setDataLayout(this->engine.getDataLayout());
+    c.options = this->options;
+    c.compile(this->checker.fn_table);
+    for(auto* n: this->ast.subnodes()) {
+      if (dynamic_cast<const defstruct *>(n)) {
+        c.compile(*n);
+      }
+    }
+    c.compile(this->fn);
+    auto &name = this->fn.fn_name->name;
+    c.module.getFunction(name.c_str())->setName(lazy_body_name(name).c_str());
+
+    auto lambdas = lambdas_of(this->fn);
+    for(auto &&f: c.module.functions()) {
+      auto exported = f.getName() == lazy_body_name(name).c_str()
+        || std::find(lambdas.cbegin(), lambdas.cend(), f.getName().str().c_str()) != lambdas.cend();
+      f.setLinkage(f.isDeclaration() || exported ? llvm::GlobalValue::ExternalLinkage : llvm::GlobalValue::InternalLinkage);
+    }
+    c.optimize();
+
+    auto module = llvm::orc::ThreadSafeModule(std::move(c.owned_module), std::move(c.owned_context));
+    this->engine.getIRTransformLayer().emit(std::move(r), std::move(module));
+  }
+
+private:
+  LLJIT &engine;
+  const def &fn;
+  const node &ast;
+  const type_checker &checker;
+  compile_options options;
+
+  auto discard(const JITDylib &, const llvm::orc::SymbolStringPtr &) -> void override {}
+};
+
+// The defs of a lazy unit, with the instances of generics.
+auto defs_of(const node &ast) -> vector<const def *> {
+  vector<const def *> result;
+  for(auto* n: ast.subnodes()) {
+    if (auto* d = dynamic_cast<const def *>(n); d) {
+      result.push_back(d);
+    }
+    else if (auto* g = dynamic_cast<const generic *>(n); g) {
+      for(auto &&i: g->instances) {
+        result.push_back(static_cast<const def *>(i.get()));
+      }
+    }
+  }
+  return result;
+}
+
+auto has_loop(const def &d) -> bool {
+  vector<const node *> stack{&d};
+  while(!stack.empty()) {
+    auto* n = stack.back();
+    stack.pop_back();
+    if (dynamic_cast<const while_ *>(n) || dynamic_cast<const dotimes *>(n) || dynamic_cast<const par_reduce *>(n)) {
+      return true;
+    }
+    for(auto* s: n->subnodes()) {
+      stack.push_back(s);
+    }
+  }
+  return false;
+}
+
+// The defs predicted to be hot: those with loops, and what they call,
+// found through the call graph of the checker.
+auto hot_defs(type_checker &t, const vector<const def *> &defs) -> vector<string> {
+  unordered_set<string> compiled;
+  vector<string> stack;
+  for(auto* d: defs) {
+    compiled.insert(d->fn_name->name);
+    if (has_loop(*d)) {
+      stack.push_back(d->fn_name->name);
+    }
+  }
+  unordered_set<string> seen(stack.cbegin(), stack.cend());
+  vector<string> result;
+  while(!stack.empty()) {
+    auto name = stack.back();
+    stack.pop_back();
+    if (compiled.count(name)) {
+      result.push_back(name);
+    }
+    for(auto &&callee: t.callees[name]) {
+      if (seen.insert(callee).second) {
+        stack.push_back(callee);
+      }
+    }
+  }
+  return result;
+}
+}
+
+jit_unit::jit_unit(std::shared_ptr<LLJIT> e, JITDylib &d) : engine(std::move(e)), dylib(&d) {}
+
+jit_unit::jit_unit(jit_unit &&other) : engine(other.engine), dylib(other.dylib) {
+  other.dylib = nullptr;
+}
+
+jit_unit::~jit_unit() {
+  if (this->dylib) {
+    llvm::consumeError(this->engine->getExecutionSession().removeJITDylib(*this->dylib));
+  }
+}
+
+auto jit_unit::lookup(const string &name) const -> expected<void *, string> {
+  auto symbol = this->engine->lookup(*this->dylib, name.c_str());
+  if (!symbol) {
+    return make_unexpected(string(llvm::toString(symbol.takeError()).c_str()));
+  }
+  return reinterpret_cast<void *>(static_cast<std::uintptr_t>(symbol->getAddress()));
+}
+
+live_unit::live_unit(const session &s, LLJIT &e, JITDylib &d) :
+  owner(&s),
+  engine(&e),
+  stub_dylib(&d),
+  stubs(llvm::orc::createLocalIndirectStubsManagerBuilder(e.getTargetTriple())()) {}
+
+live_unit::~live_unit() {
+  auto &es = this->engine->getExecutionSession();
+  for(auto* d: this->versions) {
+    llvm::consumeError(es.removeJITDylib(*d));
+  }
+  llvm::consumeError(es.removeJITDylib(*this->stub_dylib));
+}
+
+// A def is only looked up once it has a body: a stub made for code that then
+// failed to link is never handed out.
+auto live_unit::lookup(const string &name) const -> expected<void *, string> {
+  std::lock_guard guard(this->lock);
+  auto stub = this->fns.count(name) ? this->stubs->findStub(name.c_str(), true) : llvm::JITEvaluatedSymbol();
+  if (!stub) {
+    return make_unexpected(format("{} is not a swappable def", name));
+  }
+  return reinterpret_cast<void *>(static_cast<std::uintptr_t>(stub.getAddress()));
+}
+
+// The new code goes to a dylib of its own, which resolves the defs it
+// calls to their stubs. It defines the stubs of its new defs itself until
+// all of it is linked; only then do they join the stub dylib, and do the
+// stubs it redefines switch. Code that fails leaves the unit as it was.
+auto live_unit::define(const string &code) -> expected<void, vector<error>> {
+  std::lock_guard guard(this->lock);
+  auto version = this->versions.size();
+
+  compiler c;
+  c.module.setTargetTriple(this->engine->getTargetTriple().str());
+  c.module.setDataLayout(this->engine->getDataLayout());
+  if (auto errors = this->owner->build(code, c, this); !errors.empty()) {
+    this->incoming.clear();
+    return make_unexpected(errors);
+  }
+
+  auto &es = this->engine->getExecutionSession();
+  JITDylib* dylib = nullptr;
+  // The message can name the dylib, so it is taken before the dylib goes.
+  auto fail = [&](llvm::Error e) {
+    auto msg = llvm::toString(std::move(e));
+    if (dylib) {
+      llvm::consumeError(es.removeJITDylib(*dylib));
+    }
+    this->incoming.clear();
+    return failure(msg);
+  };
+
+  // A stub made for code that failed is made again, since the stubs
+  // manager cannot remove it.
+  llvm::orc::SymbolMap added;
+  for(auto &&[name, _]: this->incoming) {
+    if (this->fns.count(name)) {
+      continue;
+    }
+    if (auto e = this->stubs->createStub(name.c_str(), 0, llvm::JITSymbolFlags::Exported)) {
+      return fail(std::move(e));
+    }
+    added[this->engine->mangleAndIntern(name.c_str())] = this->stubs->findStub(name.c_str(), false);
+  }
+
+  auto created = es.createJITDylib(format("{}.v{}", this->stub_dylib->getName(), version).c_str());
+  if (!created) {
+    return fail(created.takeError());
+  }
+  dylib = &*created;
+  dylib->addToLinkOrder(*this->stub_dylib);
+  dylib->addToLinkOrder(this->engine->getMainJITDylib());
+  if (!added.empty()) {
+    if (auto e = dylib->define(llvm::orc::absoluteSymbols(added))) {
+      return fail(std::move(e));
+    }
+  }
+
+  auto module = llvm::orc::ThreadSafeModule(std::move(c.owned_module), std::move(c.owned_context));
+  if (auto e = this->engine->addIRModule(*dylib, std::move(module))) {
+    return fail(std::move(e));
+  }
+  vector<llvm::JITTargetAddress> bodies;
+  for(auto &&[name, _]: this->incoming) {
+    auto body = this->engine->lookup(*dylib, body_name(name, version).c_str());
+    if (!body) {
+      return fail(body.takeError());
+    }
+    bodies.push_back(body->getAddress());
+  }
+  if (!added.empty()) {
+    if (auto e = this->stub_dylib->define(llvm::orc::absoluteSymbols(std::move(added)))) {
+      return fail(std::move(e));
+    }
+  }
+
+  this->versions.push_back(dylib);
+  for(std::size_t i = 0; i < bodies.size(); ++i) {
+    auto &[name, fn] = this->incoming[i];
+    llvm::cantFail(this->stubs->updatePointer(name.c_str(), bodies[i]));
+    this->fns[name] = fn;
+  }
+  return {};
+}
+
+lazy_unit::lazy_unit(std::shared_ptr<LLJIT> e, JITDylib &d, JITDylib &b) : engine(std::move(e)), dylib(&d), bodies(&b) {}
+
+lazy_unit::~lazy_unit() {
+  this->stopping = true;
+  for(auto &&w: this->workers) {
+    w.join();
+  }
+  auto &es = this->engine->getExecutionSession();
+  llvm::consumeError(es.removeJITDylib(*this->dylib));
+  llvm::consumeError(es.removeJITDylib(*this->bodies));
+}
+
+auto lazy_unit::lookup(const string &name) const -> expected<void *, string> {
+  auto symbol = this->engine->lookup(*this->dylib, name.c_str());
+  if (!symbol) {
+    return make_unexpected(string(llvm::toString(symbol.takeError()).c_str()));
+  }
+  return reinterpret_cast<void *>(static_cast<std::uintptr_t>(symbol->getAddress()));
+}
+
+session::session(const compile_options &o) : options(o) {
+  init_native_target();
+
+  this->triple = llvm::sys::getDefaultTargetTriple();
+  std::string msg;
+  this->target = llvm::TargetRegistry::lookupTarget(this->triple, msg);
+
+  // Each compile gets its own TargetMachine, so that threads can jit at the
+  // same time.
+  auto jit = llvm::orc::LLJITBuilder()
+    .setCompileFunctionCreator([](llvm::orc::JITTargetMachineBuilder jtmb)
+        -> llvm::Expected<unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+      return std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(jtmb));
+    })
+    .create();
+  if (!jit) {
+    this->engine_error = llvm::toString(jit.takeError()).c_str();
+    return;
+  }
+  this->engine = std::move(*jit);
+
+  // Jitted code links against the host process and the runtime that is
+  // linked into it.
+  auto &main = this->engine->getMainJITDylib();
+  auto host = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+      this->engine->getDataLayout().getGlobalPrefix());
+  if (host) {
+    main.addGenerator(std::move(*host));
+  }
+  else {
+    llvm::consumeError(host.takeError());
+  }
+  llvm::orc::SymbolMap runtime;
+  auto provide = [&](const char* name, auto* fn) {
+    runtime[this->engine->mangleAndIntern(name)] = llvm::JITEvaluatedSymbol::fromPointer(fn);
+  };
+  provide("lisa_memo_new", &lisa_memo_new);
+  provide("lisa_memo_lookup", &lisa_memo_lookup);
+  provide("lisa_memo_store", &lisa_memo_store);
+  provide("lisa_par_reduce_i32", &lisa_par_reduce_i32);
+  provide("lisa_par_reduce_f64", &lisa_par_reduce_f64);
+  provide("lisa_region_grow", &lisa_region_grow);
+  provide("lisa_region_release", &lisa_region_release);
+  provide("lisa_print_str", &lisa_print_str);
+  llvm::cantFail(main.define(llvm::orc::absoluteSymbols(std::move(runtime))));
+}
+
+session::~session() {}
+
+auto session::target_machine() const -> expected<unique_ptr<llvm::TargetMachine>, vector<error>> {
+  if (!this->target) {
+    return failure("No target is available for " + this->triple);
+  }
+  return unique_ptr<llvm::TargetMachine>(this->target->createTargetMachine(
+      this->triple, "generic", "", llvm::TargetOptions(), llvm::Reloc::PIC_));
+}
+
+// Runs every phase up to an optimized module and returns the errors of the
+// first phase that fails.
+//
+// The code of a live unit sees the defs of the unit as functions defined
+// elsewhere, and nothing is proven about the functions that call them.
+auto session::build(const string &code, compiler &c, live_unit* unit) const -> vector<error> {
+  auto checker = type_checker();
+  if (unit) {
+    checker.fn_table.insert(unit->fns.cbegin(), unit->fns.cend());
+  }
+  auto ast = front_end(code, checker, !unit);
+  if (!ast) {
+    return ast.error();
+  }
+
+  if (unit) {
+    unit->incoming.clear();
+    vector<error> errors;
+    for(auto* n: (*ast)->subnodes()) {
+      auto* d = dynamic_cast<def *>(n);
+      if (!d || !d->type_params.empty()) {
+        continue;
+      }
+      auto &name = d->fn_name->name;
+      auto &fn = checker.fn_table[name];
+      if (auto old = unit->fns.find(name); old != unit->fns.end() && (old->second.ret != fn.ret || old->second.args != fn.args)) {
+        errors.push_back({d->pos, format("{} cannot be redefined with another type", name)});
+      }
+      else if (swappable(fn)) {
+        unit->incoming.push_back({name, fn_type {fn.ret, fn.args, false, true}});
+      }
+    }
+    if (!errors.empty()) {
+      return errors;
+    }
+    for(auto &&[name, fn]: checker.fn_table) {
+      if (!prim_fn::find(name) && !(fn.external && fn.pure)) {
+        fn.readnone = fn.nounwind = fn.willreturn = fn.norecurse = false;
+      }
+    }
+    // The folder only calls pure defs, and a call to a swappable one must
+    // stay a call to reach its later versions.
+    for(auto &&[name, _]: unit->incoming) {
+      checker.fn_table[name].pure = false;
+    }
+    evaluator(checker.fn_table).fold(**ast);
+  }
+
+  c.options = this->options;
+  c.compile(checker.fn_table);
+  c.compile(**ast);
+  if (unit) {
+    route_through_stubs(c.module, unit->incoming, unit->versions.size());
+  }
+  c.optimize();
+  return {};
+}
+
+auto session::object(const string &code) const -> expected<std::string, vector<error>> {
+  auto tm = this->target_machine();
+  if (!tm) {
+    return make_unexpected(tm.error());
+  }
+
+  compiler c;
+  c.module.setTargetTriple(this->triple);
+  c.module.setDataLayout((*tm)->createDataLayout());
+  if (auto errors = this->build(code, c); !errors.empty()) {
+    return make_unexpected(errors);
+  }
+
+  return emit_object(**tm, c.module).map_error([](const string &msg) {
+    return vector<error>{{0, msg}};
+  });
+}
+
+auto session::bitcode(const string &code) const -> expected<std::string, vector<error>> {
+  auto tm = this->target_machine();
+  if (!tm) {
+    return make_unexpected(tm.error());
+  }
+
+  compiler c;
+  c.module.setTargetTriple(this->triple);
+  c.module.setDataLayout((*tm)->createDataLayout());
+  if (auto errors = this->build(code, c); !errors.empty()) {
+    return make_unexpected(errors);
+  }
+
+  std::string result;
+  llvm::raw_string_ostream os(result);
+  llvm::WriteBitcodeToFile(c.module, os);
+  os.flush();
+  return result;
+}
+
+auto session::jit(const string &code) -> expected<jit_unit, vector<error>> {
+  if (!this->engine) {
+    return failure(this->engine_error.c_str());
+  }
+
+  compiler c;
+  c.module.setTargetTriple(this->engine->getTargetTriple().str());
+  c.module.setDataLayout(this->engine->getDataLayout());
+  if (auto errors = this->build(code, c); !errors.empty()) {
+    return make_unexpected(errors);
+  }
+
+  auto &es = this->engine->getExecutionSession();
+  auto dylib = es.createJITDylib(format("unit{}", this->units++).c_str());
+  if (!dylib) {
+    return failure(llvm::toString(dylib.takeError()));
+  }
+  dylib->addToLinkOrder(this->engine->getMainJITDylib());
+
+  auto module = llvm::orc::ThreadSafeModule(std::move(c.owned_module), std::move(c.owned_context));
+  if (auto e = this->engine->addIRModule(*dylib, std::move(module))) {
+    llvm::consumeError(es.removeJITDylib(*dylib));
+    return failure(llvm::toString(std::move(e)));
+  }
+  return jit_unit(this->engine, *dylib);
+}
+
+auto session::live(const string &code) -> expected<unique_ptr<live_unit>, vector<error>> {
+  if (!this->engine) {
+    return failure(this->engine_error.c_str());
+  }
+
+  auto &es = this->engine->getExecutionSession();
+  auto dylib = es.createJITDylib(format("live{}", this->units++).c_str());
+  if (!dylib) {
+    return failure(llvm::toString(dylib.takeError()));
+  }
+  auto unit = std::make_unique<live_unit>(*this, *this->engine, *dylib);
+  if (auto defined = unit->define(code); !defined) {
+    return make_unexpected(defined.error());
+  }
+  return unit;
+}
+
+auto session::lazy(const string &code, unsigned background_threads) -> expected<unique_ptr<lazy_unit>, vector<error>> {
+  if (!this->engine) {
+    return failure(this->engine_error.c_str());
+  }
+
+  auto checker = std::make_unique<type_checker>();
+  auto ast = front_end(code, *checker);
+  if (!ast) {
+    return make_unexpected(ast.error());
+  }
+
+  auto &es = this->engine->getExecutionSession();
+  auto id = this->units++;
+  auto dylib = es.createJITDylib(format("lazy{}", id).c_str());
+  if (!dylib) {
+    return failure(llvm::toString(dylib.takeError()));
+  }
+  auto bodies = es.createJITDylib(format("lazy{}.bodies", id).c_str());
+  if (!bodies) {
+    llvm::consumeError(es.removeJITDylib(*dylib));
+    return failure(llvm::toString(bodies.takeError()));
+  }
+  bodies->addToLinkOrder(*dylib);
+  bodies->addToLinkOrder(this->engine->getMainJITDylib());
+
+  auto unit = std::make_unique<lazy_unit>(this->engine, *dylib, *bodies);
+  unit->checker = std::move(checker);
+  unit->ast = std::move(*ast);
+  auto &triple = this->engine->getTargetTriple();
+  auto call_through = llvm::orc::createLocalLazyCallThroughManager(
+      triple, es, llvm::pointerToJITTargetAddress(&lazy_failure));
+  if (!call_through) {
+    return failure(llvm::toString(call_through.takeError()));
+  }
+  unit->call_through = std::move(*call_through);
+  unit->stubs = llvm::orc::createLocalIndirectStubsManagerBuilder(triple)();
+
+  auto defs = defs_of(*unit->ast);
+  llvm::orc::SymbolAliasMap aliases;
+  for(auto* d: defs) {
+    auto &name = d->fn_name->name;
+    auto flags = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+    aliases[this->engine->mangleAndIntern(name.c_str())] = {
+      this->engine->mangleAndIntern(lazy_body_name(name).c_str()), flags};
+    if (auto e = bodies->define(std::make_unique<def_unit>(*this->engine, *d, *unit->ast, *unit->checker, this->options))) {
+      return failure(llvm::toString(std::move(e)));
+    }
+  }
+  if (auto e = dylib->define(llvm::orc::lazyReexports(*unit->call_through, *unit->stubs, *bodies, std::move(aliases)))) {
+    return failure(llvm::toString(std::move(e)));
+  }
+
+  // Each worker takes the next hot def and compiles it by looking up its
+  // body; a def that is being compiled for a call is not compiled again.
+  auto hot = std::make_shared<vector<string>>(hot_defs(*unit->checker, defs));
+  auto next = std::make_shared<std::atomic<std::size_t>>(0);
+  auto workers = std::min<std::size_t>(background_threads, hot->size());
+  for(std::size_t i = 0; i < workers; ++i) {
+    unit->workers.emplace_back([u = unit.get(), hot, next] {
+      for(auto n = (*next)++; n < hot->size() && !u->stopping; n = (*next)++) {
+        auto body = u->engine->lookup(*u->bodies, lazy_body_name((*hot)[n]).c_str());
+        if (!body) {
+          llvm::consumeError(body.takeError());
+        }
+      }
+    });
+  }
+  return unit;
+}
+}
@@ -0,0 +1,166 @@
+#ifndef LISA_SESSION
+#define LISA_SESSION
+
+#include <lisa/compiler.hpp>
+#include <lisa/type_checker.hpp>
+#include <lisa/util.hpp>
+#include <string_theory/string>
+#include <tl/expected.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+namespace llvm {
+class Target;
+class TargetMachine;
+namespace orc {
+class LLJIT;
+class JITDylib;
+class IndirectStubsManager;
+class LazyCallThroughManager;
+}
+}
+
+namespace lisa {
+// Code compiled by session::jit. It stays loaded as long as the unit lives,
+// which can be longer than the session: the unit shares the JIT with it.
+struct jit_unit {
+  std::shared_ptr<llvm::orc::LLJIT> engine;
+  llvm::orc::JITDylib* dylib;
+
+  jit_unit(std::shared_ptr<llvm::orc::LLJIT>, llvm::orc::JITDylib &);
+  jit_unit(jit_unit &&);
+  jit_unit(const jit_unit &) = delete;
+  ~jit_unit();
+
+  auto lookup(const ST::string &) const -> tl::expected<void *, ST::string>;
+
+  template<class F>
+  auto function(const ST::string &name) const -> tl::expected<F *, ST::string> {
+    return this->lookup(name).map([](void* p) { return reinterpret_cast<F *>(p); });
+  }
+};
+
+struct session;
+
+// Code compiled by session::live, whose defs can be redefined while it
+// runs. Each def is called through a stub, a jump through a pointer, by the
+// host and by the other defs alike, so a redefinition compiles only the new
+// code and then switches every def it redefines with a single store to its
+// pointer. Calls already running finish in the old code, which stays loaded
+// as long as the unit lives. In exchange, defs are not inlined or folded
+// into each other and carry no inferred attributes, since either could
+// change.
+//
+// Only defs whose arguments and result are numbers, bools, lists or strings
+// are swappable; others are private to the code that defines them.
+//
+// Redefinitions are compiled by the session, which must outlive the unit.
+struct live_unit {
+  live_unit(const session &, llvm::orc::LLJIT &, llvm::orc::JITDylib &);
+  live_unit(const live_unit &) = delete;
+  ~live_unit();
+
+  // Compiles `code`, which can call every def of the unit, and switches to
+  // the defs it defines. A def keeps the type it was first defined with.
+  // Code that fails to compile or link leaves the unit as it was.
+  auto define(const ST::string &) -> tl::expected<void, std::vector<error>>;
+
+  // The address of the stub of a def, which stays the same when it is
+  // redefined.
+  auto lookup(const ST::string &) const -> tl::expected<void *, ST::string>;
+
+  template<class F>
+  auto function(const ST::string &name) const -> tl::expected<F *, ST::string> {
+    return this->lookup(name).map([](void* p) { return reinterpret_cast<F *>(p); });
+  }
+
+private:
+  friend struct session;
+
+  const session* owner;
+  llvm::orc::LLJIT* engine;
+  llvm::orc::JITDylib* stub_dylib;
+  std::unique_ptr<llvm::orc::IndirectStubsManager> stubs;
+  // The types of the swappable defs, and those that the code being defined
+  // brings, with the names of their new bodies.
+  std::unordered_map<ST::string, fn_type> fns;
+  std::vector<std::pair<ST::string, fn_type>> incoming;
+  std::vector<llvm::orc::JITDylib *> versions;
+  mutable std::mutex lock;
+};
+
+// Code compiled by session::lazy. Only checking happens up front: each def
+// is generated, optimized and compiled when it is first called, through a
+// stub that from then on jumps straight to it, so the cost of starting
+// grows with the code that runs rather than the code that is there. Defs
+// are compiled apart and not inlined into each other. Like a jit_unit, the
+// unit shares the JIT with the session and can outlive it.
+//
+// Background threads can compile the defs predicted to be hot before they
+// are called: those that loop, and everything they call.
+struct lazy_unit {
+  lazy_unit(std::shared_ptr<llvm::orc::LLJIT>, llvm::orc::JITDylib &, llvm::orc::JITDylib &);
+  lazy_unit(const lazy_unit &) = delete;
+  ~lazy_unit();
+
+  auto lookup(const ST::string &) const -> tl::expected<void *, ST::string>;
+
+  template<class F>
+  auto function(const ST::string &name) const -> tl::expected<F *, ST::string> {
+    return this->lookup(name).map([](void* p) { return reinterpret_cast<F *>(p); });
+  }
+
+private:
+  friend struct session;
+
+  std::shared_ptr<llvm::orc::LLJIT> engine;
+  // The stubs of the defs, which are looked up, and the bodies they call.
+  llvm::orc::JITDylib* dylib;
+  llvm::orc::JITDylib* bodies;
+  std::unique_ptr<llvm::orc::LazyCallThroughManager> call_through;
+  std::unique_ptr<llvm::orc::IndirectStubsManager> stubs;
+  // What the defs are generated from when they are first called.
+  std::unique_ptr<type_checker> checker;
+  std::unique_ptr<node> ast;
+  std::vector<std::thread> workers;
+  std::atomic<bool> stopping{false};
+};
+
+// Compiles Lisa source in process. LLVM and the native target are set up
+// once; every compile gets fresh lexer-to-compiler state, which is freed as
+// a whole when it returns, so a session can be shared by many threads.
+// Errors carry byte offsets into the compiled code.
+struct session {
+  compile_options options;
+
+  explicit session(const compile_options & = {});
+  ~session();
+
+  auto object(const ST::string &) const -> tl::expected<std::string, std::vector<error>>;
+  auto bitcode(const ST::string &) const -> tl::expected<std::string, std::vector<error>>;
+  auto jit(const ST::string &) -> tl::expected<jit_unit, std::vector<error>>;
+  auto live(const ST::string &) -> tl::expected<std::unique_ptr<live_unit>, std::vector<error>>;
+  auto lazy(const ST::string &, unsigned background_threads = 0) -> tl::expected<std::unique_ptr<lazy_unit>, std::vector<error>>;
+
+private:
+  friend struct live_unit;
+
+  std::string triple;
+  const llvm::Target* target = nullptr;
+  std::shared_ptr<llvm::orc::LLJIT> engine;
+  ST::string engine_error;
+  std::atomic<std::uint64_t> units{0};
+
+  auto target_machine() const -> tl::expected<std::unique_ptr<llvm::TargetMachine>, std::vector<error>>;
+  auto build(const ST::string &, compiler &, live_unit* = nullptr) const -> std::vector<error>;
+};
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef LISA_SPSC_QUEUE
+#define LISA_SPSC_QUEUE
+
+#include <array>
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <cstddef>
+
+namespace lisa {
+// A bounded lock-free queue between exactly one producer thread and one
+// consumer thread. `head` is only written by the consumer and `tail` only by
+// the producer; they live on separate cache lines. The blocking push/pop
+// yield while the queue is full or empty.
+template<class T, std::size_t N>
+struct spsc_queue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "the capacity must be a power of two");
+
+  alignas(64) std::atomic<std::size_t> head{0};
+  alignas(64) std::atomic<std::size_t> tail{0};
+  alignas(64) std::array<T, N> slots{};
+
+  auto try_push(T &&value) -> bool {
+    auto t = this->tail.load(std::memory_order_relaxed);
+    if (t - this->head.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    this->slots[t & (N - 1)] = std::move(value);
+    this->tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  auto try_pop() -> std::optional<T> {
+    auto h = this->head.load(std::memory_order_relaxed);
+    if (h == this->tail.load(std::memory_order_acquire)) {
+      return std::nullopt;
+    }
+    std::optional<T> value(std::move(this->slots[h & (N - 1)]));
+    this->head.store(h + 1, std::memory_order_release);
+    return value;
+  }
+
+  auto push(T &&value) -> void {
+    while(!this->try_push(std::move(value))) {
+      std::this_thread::yield();
+    }
+  }
+
+  auto pop() -> T {
+    while(true) {
+      if (auto value = this->try_pop(); value) {
+        return std::move(*value);
+      }
+      std::this_thread::yield();
+    }
+  }
+};
+}
+
+#endif
@@ -3,6 +3,7 @@
 #include <lisa/parser.hpp>
 #include <string_theory/format>
 #include <algorithm>
+#include <cstdint>
 #include <iterator>
 #include <utility>
 #include <vector>
@@ -11,7 +12,9 @@ using type_t = lisa::type;
 using std::back_inserter;
 using std::transform;
 using std::vector;
-using std::pair;
+using std::unordered_map;
+using std::unordered_set;
+using std::size_t;
 using ST::string;
 using ST::format;
 
@@ -19,28 +22,409 @@ namespace lisa {
 type::type(const string &n, type::raw_t* r) : name(n), raw(r) {
   typename_map[n] = this;
 }
+type::type(const string &n, vector<string> &&names, vector<type *> &&f) :
+  name(n), raw(nullptr), field_names(std::move(names)), fields(std::move(f)) {}
+
 auto type::of_str(const string &name) -> type* {
-  return typename_map[name];
+  // a lookup only, since sessions may check programs concurrently
+  auto it = typename_map.find(name);
+  return it != typename_map.end() ? it->second : nullptr;
+}
+
+auto type::to_llvm(llvm::LLVMContext &c) const -> llvm::Type* {
+  if (this->raw) {
+    return this->raw(c);
+  }
+  vector<llvm::Type *> raw_fields;
+  transform(this->fields.cbegin(), this->fields.cend(), back_inserter(raw_fields),
+      [&](auto &&f) { return f->to_llvm(c); });
+  return llvm::StructType::get(c, raw_fields);
+}
+
+auto list_type(llvm::LLVMContext &c) -> llvm::Type* {
+  auto* cell = llvm::StructType::getTypeByName(c, "lisa.cons");
+  if (!cell) {
+    cell = llvm::StructType::create(c, "lisa.cons");
+    cell->setBody({llvm::Type::getInt32Ty(c), cell->getPointerTo()});
+  }
+  return cell->getPointerTo();
+}
+
+auto str_type(llvm::LLVMContext &c) -> llvm::Type* {
+  auto* s = llvm::StructType::getTypeByName(c, "lisa.str");
+  if (!s) {
+    s = llvm::StructType::create(c, {llvm::Type::getInt64Ty(c), llvm::ArrayType::get(llvm::Type::getInt8Ty(c), 0)}, "lisa.str");
+  }
+  return s->getPointerTo();
+}
+
+auto is_heap(const type_t* t) -> bool {
+  return t == &list_ || t == &str_;
+}
+
+auto is_integer(const type_t* t) -> bool {
+  return t == &i8 || t == &i16 || t == &i32 || t == &i64 || t == &u32;
+}
+
+auto is_float(const type_t* t) -> bool {
+  return t == &f32 || t == &f64;
+}
+
+auto fits(unsigned long long n, const type_t* t) -> bool {
+  if (is_float(t)) {
+    return true;
+  }
+  auto max = t == &i8 ? INT8_MAX
+    : t == &i16 ? INT16_MAX
+    : t == &i32 ? INT32_MAX
+    : t == &u32 ? UINT32_MAX
+    : t == &i64 ? INT64_MAX
+    : 0ull;
+  return n <= static_cast<unsigned long long>(max);
+}
+
+auto erased_fn_type(llvm::LLVMContext &c) -> llvm::Type* {
+  auto* i8p = llvm::Type::getInt8PtrTy(c);
+  return llvm::StructType::get(c, {i8p, i8p});
+}
+
+auto is_fn(const type_t* t) -> bool {
+  return t && t->result;
+}
+
+auto converts(const type_t* from, const type_t* to) -> bool {
+  return from == to || (is_fn(from) && is_fn(to) && to->lambda_fn.empty()
+      && from->params == to->params && from->result == to->result);
 }
 
 type_checker::type_checker() : fn_table(), var_table(), errors() {
   for(auto &&[name, p] : prim_fn_map) {
     fn_table[name] = p->t;
   }
+  // The dotted operators only ever take f64; + also joins strings.
+  overloads = {
+    {"+", {"__iadd", "__fadd", "str-cat"}},
+    {"-", {"__isub", "__fsub"}},
+    {"*", {"__imul", "__fmul"}},
+    {"/", {"__idiv", "__fdiv"}},
+    {"=", {"__ieq", "__feq"}},
+    {"<", {"__ilt", "__flt"}},
+    {"+.", {"__fadd"}},
+    {"-.", {"__fsub"}},
+    {"*.", {"__fmul"}},
+    {"/.", {"__fdiv"}},
+    {"=.", {"__feq"}},
+    {"<.", {"__flt"}}
+  };
+  // Every other width has its own operators, and every number type is the
+  // name of the conversions to it.
+  const std::pair<const char *, const char *> ops[] = {
+    {"+", "add"}, {"-", "sub"}, {"*", "mul"}, {"/", "div"}, {"=", "eq"}, {"<", "lt"}
+  };
+  for(auto* t : number_types) {
+    if (t != &i32 && t != &f64) {
+      for(auto &&[op, base] : ops) {
+        overloads[op].push_back(sized_name(format("__{}{}", is_float(t) ? "f" : "i", base), *t));
+      }
+    }
+    for(auto* from : number_types) {
+      overloads[t->name].push_back(conversion_name(*t, *from));
+    }
+  }
+}
+
+// The name of the instance of a generic, or of the overload of an
+// operator, for the given types.
+auto mangle(const string &name, const vector<string> &types) -> string {
+  string joined;
+  for(auto &&t : types) {
+    joined += joined.empty() ? t : "," + t;
+  }
+  return format("{}<{}>", name, joined);
+}
+
+auto names_of(const vector<type_t *> &types) -> vector<string> {
+  vector<string> result;
+  transform(types.cbegin(), types.cend(), back_inserter(result),
+      [](auto &&t) { return t ? t->name : string("nothing"); });
+  return result;
 }
 
 auto type_checker::type_check(node &ast) -> void {
-  ast.type(*this);
+  this->check(ast);
+  this->finish();
+}
+
+auto type_checker::check(node &ast) -> void {
+  struct frame {
+    node* target;
+    vector<node *> subnodes;
+    size_t done;
+  };
+  vector<frame> stack;
+  ast.enter(*this);
+  stack.push_back({&ast, ast.subnodes(), 0});
+
+  while(!stack.empty()) {
+    auto &top = stack.back();
+    if (top.done < top.subnodes.size()) {
+      auto* next = top.subnodes[top.done];
+      next->enter(*this);
+      stack.push_back({next, next->subnodes(), 0});
+      continue;
+    }
+    top.target->ty = top.target->type(*this);
+    // Lists and strings live in memory, which makes any code that handles
+    // them, even by reading a literal, not readnone.
+    if (is_heap(top.target->ty) && !this->current_fn.empty()) {
+      this->effects[this->current_fn].memory = true;
+    }
+    stack.pop_back();
+    if (!stack.empty()) {
+      auto &parent = stack.back();
+      parent.target->step(*this, ++parent.done);
+    }
+  }
+}
+
+auto type_checker::finish() -> void {
+  this->infer_purity();
+  this->infer_attributes();
+  for(auto &&[name, pos] : this->memo_fns) {
+    if (!this->fn_table[name].pure) {
+      this->errors.push_back({
+          pos, format("{} is declared with def-memo but is not pure", name)});
+    }
+  }
+}
+
+// A function is pure when every function it calls is a known, pure
+// function; impurity is propagated through the call graph to a fixed point.
+auto type_checker::infer_purity() -> void {
+  for(bool changed = true; changed;) {
+    changed = false;
+    for(auto &&[caller, called] : this->callees) {
+      auto it = this->fn_table.find(caller);
+      if (it == this->fn_table.end() || !it->second.pure) {
+        continue;
+      }
+      for(auto &&name : called) {
+        auto callee = this->fn_table.find(name);
+        if (callee == this->fn_table.end() || !callee->second.ret || !callee->second.pure) {
+          it->second.pure = false;
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+}
+
+// The attributes of the checked functions and lambdas hold for their own
+// code and are then narrowed to what holds for all their callees, to a
+// fixed point; a function that can reach itself is neither norecurse nor
+// willreturn. Primitives and intrinsics do nothing that matters, since the
+// memory of lists and strings is charged to the code that handles them,
+// and other functions, such as externs, bring what they are declared with.
+auto type_checker::infer_attributes() -> void {
+  struct facts {
+    bool readnone;
+    bool nounwind;
+    bool willreturn;
+    bool norecurse;
+  };
+
+  unordered_set<string> checked;
+  for(auto &&[name, fn] : this->fn_table) {
+    if (!fn.external && !prim_fn::find(name)) {
+      checked.insert(name);
+    }
+  }
+  for(auto &&[name, _] : this->callees) {
+    checked.insert(name);
+  }
+  for(auto &&[name, _] : this->effects) {
+    checked.insert(name);
+  }
+  checked.erase("");
+
+  auto reaches_itself = [&](const string &from) {
+    unordered_set<string> seen;
+    vector<string> stack{from};
+    while(!stack.empty()) {
+      auto name = stack.back();
+      stack.pop_back();
+      for(auto &&next : this->callees[name]) {
+        if (next == from) {
+          return true;
+        }
+        if (checked.count(next) && seen.insert(next).second) {
+          stack.push_back(next);
+        }
+      }
+    }
+    return false;
+  };
+
+  unordered_map<string, facts> proven;
+  for(auto &&name : checked) {
+    auto e = this->effects[name];
+    auto norecurse = !e.opaque && !reaches_itself(name);
+    proven[name] = {
+      !e.opaque && !e.memory,
+      !e.opaque && !e.unwinds,
+      !e.opaque && !e.loops && norecurse,
+      norecurse
+    };
+  }
+
+  auto known = [&](const string &name) -> facts {
+    if (auto it = proven.find(name); it != proven.end()) {
+      return it->second;
+    }
+    if (prim_fn::find(name)) {
+      return {true, true, true, true};
+    }
+    if (auto it = this->fn_table.find(name); it != this->fn_table.end()) {
+      auto &fn = it->second;
+      return {fn.readnone, fn.nounwind, fn.willreturn, fn.norecurse};
+    }
+    return {false, false, false, false};
+  };
+
+  for(bool changed = true; changed;) {
+    changed = false;
+    for(auto &&name : checked) {
+      auto &f = proven[name];
+      for(auto &&callee : this->callees[name]) {
+        auto g = known(callee);
+        auto narrowed = facts{
+          f.readnone && g.readnone,
+          f.nounwind && g.nounwind,
+          f.willreturn && g.willreturn,
+          f.norecurse
+        };
+        if (narrowed.readnone != f.readnone || narrowed.nounwind != f.nounwind
+            || narrowed.willreturn != f.willreturn) {
+          f = narrowed;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  for(auto &&[name, f] : proven) {
+    if (auto it = this->fn_table.find(name); it != this->fn_table.end()) {
+      it->second.readnone = f.readnone;
+      it->second.nounwind = f.nounwind;
+      it->second.willreturn = f.willreturn;
+      it->second.norecurse = f.norecurse;
+    }
+  }
 }
 
-auto type_checker::expect(const token_pos &pos, type* expected, type* given) -> void {
-  if (expected != given) {
+auto node::enter(type_checker &) -> void {}
+
+auto node::step(type_checker &, size_t) -> void {}
+
+auto type_checker::expect(std::size_t pos, type* expected, type* given) -> void {
+  // a null parameter type (as in `return`) accepts anything
+  if (expected && expected != given) {
     this->errors.push_back({
-        pos, format("Expected type {}, but found {}", expected->name, given->name)});
+        pos, format("Expected type {}, but found {}", expected->name, given ? given->name : "nothing")});
+  }
+}
+
+// Function types are made on first use, from their spelling, as in
+// "(i32 f64 -> bool)".
+auto type_checker::type_of(const string &name) -> type* {
+  if (auto it = this->structs.find(name); it != this->structs.end()) {
+    return it->second.get();
+  }
+  if (auto it = this->closures.find(name); it != this->closures.end()) {
+    return it->second.get();
+  }
+  if (auto it = this->fn_types.find(name); it != this->fn_types.end()) {
+    return it->second.get();
+  }
+  if (!name.starts_with("(")) {
+    return type::of_str(name);
+  }
+
+  auto words = name.substr(1, name.size() - 2).split(' ');
+  if (words.size() < 2 || words[words.size() - 2] != "->") {
+    return nullptr;
+  }
+  auto fn_t = std::make_unique<type_t>(name, vector<string>{}, vector<type_t *>{});
+  fn_t->raw = &erased_fn_type;
+  for (size_t i = 0; i + 2 < words.size(); ++i) {
+    auto* param = this->type_of(words[i]);
+    if (!param || param == &statement) {
+      return nullptr;
+    }
+    fn_t->params.push_back(param);
+  }
+  fn_t->result = this->type_of(words.back());
+  if (!fn_t->result) {
+    return nullptr;
+  }
+  return (this->fn_types[name] = std::move(fn_t)).get();
+}
+
+auto type_checker::bind(const string &name, type* t) -> void {
+  auto it = this->var_table.find(name);
+  this->scopes.push_back({name, it != this->var_table.end() ? it->second : nullptr});
+  this->var_table[name] = t;
+  if (!this->lambdas.empty()) {
+    ++this->lambdas.back().locals[name];
+  }
+}
+
+auto type_checker::unbind() -> void {
+  auto [name, shadowed] = this->scopes.back();
+  this->scopes.pop_back();
+  if (!this->lambdas.empty()) {
+    --this->lambdas.back().locals[name];
+  }
+  if (shadowed) {
+    this->var_table[name] = shadowed;
+  }
+  else {
+    this->var_table.erase(name);
+  }
+}
+
+// Whether `name` is a variable of the enclosing def or lambda rather than
+// one bound inside the innermost lambda.
+auto type_checker::captured(const string &name) const -> bool {
+  if (this->lambdas.empty()) {
+    return false;
+  }
+  auto it = this->lambdas.back().locals.find(name);
+  auto var = this->var_table.find(name);
+  return (it == this->lambdas.back().locals.end() || it->second == 0)
+    && var != this->var_table.end() && var->second;
+}
+
+// Records a use of the variable `name`: every lambda it is not bound in,
+// from the innermost one out, captures it.
+auto type_checker::use(const string &name) -> void {
+  auto var = this->var_table.find(name);
+  if (var == this->var_table.end() || !var->second) {
+    return;
+  }
+  for (auto l = this->lambdas.rbegin(); l != this->lambdas.rend(); ++l) {
+    if (auto it = l->locals.find(name); it != l->locals.end() && it->second > 0) {
+      return;
+    }
+    if (std::find(l->captures.begin(), l->captures.end(), name) == l->captures.end()) {
+      l->captures.push_back(name);
+    }
   }
 }
 
 auto id::type(type_checker &t) -> type_t* {
+  t.use(this->name);
   return t.var_table[this->name];
 }
 
@@ -48,71 +432,587 @@ auto boolc::type(type_checker &t) -> type_t* {
   return &bool_;
 }
 
+// A literal too large for an i32 is an i64 rather than being truncated.
 auto inum::type(type_checker &t) -> type_t* {
-  return &i32;
+  auto* ty = this->suffix.empty() ? (fits(this->number, &i32) ? &i32 : &i64) : t.type_of(this->suffix);
+  if (!is_integer(ty) && !is_float(ty)) {
+    t.errors.push_back({this->pos, format("Unknown number type {}", this->suffix)});
+    return nullptr;
+  }
+  if (!fits(this->number, ty)) {
+    t.errors.push_back({this->pos, format("{} does not fit in {}", this->number, ty->name)});
+  }
+  return ty;
 }
 
 auto fnum::type(type_checker &t) -> type_t* {
-  return &f64;
+  auto* ty = this->suffix.empty() ? &f64 : t.type_of(this->suffix);
+  if (!is_float(ty)) {
+    t.errors.push_back({this->pos, format("Unknown float type {}", this->suffix)});
+    return nullptr;
+  }
+  return ty;
 }
 
-auto def::type(type_checker &t) -> type_t* {
-  vector<type_t*> arg_t;
+// Whether `n` is a number literal without a suffix that can have the type
+// `to`: a number type its value fits in.
+auto retypable(const node &n, const type_t* to) -> bool {
+  if (auto* i = dynamic_cast<const inum *>(&n); i && i->suffix.empty()) {
+    return (is_integer(to) || is_float(to)) && fits(i->number, to);
+  }
+  if (auto* f = dynamic_cast<const fnum *>(&n); f && f->suffix.empty()) {
+    return is_float(to);
+  }
+  return false;
+}
+
+auto retype_literal(node &n, type_t* to) -> bool {
+  if (!retypable(n, to)) {
+    return false;
+  }
+  n.ty = to;
+  return true;
+}
+
+auto strc::type(type_checker &t) -> type_t* {
+  return &str_;
+}
+
+auto def::enter(type_checker &t) -> void {
+  // A def named by an operator overloads it for its argument types.
+  if (this->fn_name->is_op) {
+    vector<string> arg_names;
+    for (auto &&a : this->args) {
+      arg_names.push_back(a->ty_name->name);
+    }
+    auto &op = this->fn_name->name;
+    // Lookup takes the first match, so a later overload for the same types
+    // would never be called.
+    vector<type_t*> arg_t;
+    for (auto &&name : arg_names) {
+      arg_t.push_back(t.type_of(name));
+    }
+    auto &candidates = t.overloads[op];
+    if (std::any_of(candidates.begin(), candidates.end(), [&](auto &&name) {
+          auto fn = t.fn_table.find(name);
+          return fn != t.fn_table.end() && fn->second.args == arg_t;
+        })) {
+      string types;
+      for (auto &&name : arg_names) {
+        types += types.empty() ? name : " " + name;
+      }
+      t.errors.push_back({this->fn_name->pos, format("{} is already defined for {}", op, types)});
+    }
+    candidates.push_back(mangle(op, arg_names));
+    op = t.overloads[op].back();
+    this->fn_name->is_op = false;
+  }
+
   t.var_table.clear();
+  t.scopes.clear();
+  t.current_fn = this->fn_name->name;
 
   for (auto &&a : this->args) {
-    auto* at = type_t::of_str(a->ty_name->name);
-    t.var_table[a->raw->name] = at;
-    arg_t.push_back(at);
+    t.var_table[a->raw->name] = t.type_of(a->ty_name->name);
   }
-  for (auto &&b : this->body) {
-    b->type(t);
+}
+
+auto def::type(type_checker &t) -> type_t* {
+  vector<type_t*> arg_t;
+  for (auto &&a : this->args) {
+    arg_t.push_back(t.type_of(a->ty_name->name));
   }
 
-  auto ret_t = this->body.empty() ? &statement : this->body.back()->type(t);
+  auto ret_t = this->body.empty() ? &statement : this->body.back()->ty;
   auto fn_t = fn_type {
     ret_t,
     arg_t
   };
   t.fn_table[this->fn_name->name] = fn_t;
+  t.current_fn = "";
+
+  // Lambdas only live as long as the call that makes them.
+  if (is_fn(ret_t)) {
+    t.errors.push_back({this->body.back()->pos, format("{} cannot return a function", this->fn_name->name)});
+  }
+
+  if (this->memo) {
+    if (ret_t == &statement) {
+      t.errors.push_back({this->pos, "A def-memo function must return a value"});
+    }
+    auto not_scalar = [](type_t* ty) { return ty && (!ty->fields.empty() || is_heap(ty) || is_fn(ty)); };
+    if (not_scalar(ret_t) || std::any_of(arg_t.begin(), arg_t.end(), not_scalar)) {
+      t.errors.push_back({this->pos, "A def-memo function can only take and return i32, f64 or bool"});
+    }
+    t.memo_fns[this->fn_name->name] = this->pos;
+    // The memo table is written on every call.
+    t.effects[this->fn_name->name].memory = true;
+  }
   return &statement;
 }
 
+// Operators and generics are resolved from the argument types and the
+// call is renamed to the function they stand for. A variable holding a
+// function shadows functions of the same name.
 auto fn_call::type(type_checker &t) -> type_t* {
+  vector<type_t *> arg_t;
   for (auto &&a : this->args) {
-    a->type(t);
+    arg_t.push_back(a->ty);
   }
-  if (this->fn_name->is_op) {
-    for (auto &&[op, name] : {pair{"+",  "__iadd"},
-                                  {"-",  "__isub"},
-                                  {"*",  "__imul"},
-                                  {"/",  "__idiv"},
-                                  {"=",  "__ieq"},
-                                  {"+.", "__fadd"},
-                                  {"-.", "__fsub"},
-                                  {"*.", "__fmul"},
-                                  {"/.", "__fdiv"},
-                                  {"=.", "__feq"}}
-    ) {
-      if (this->fn_name->name == op) {
-        this->fn_name->name = name;
-        break;
+
+  if (auto var = t.var_table.find(this->fn_name->name); var != t.var_table.end() && is_fn(var->second)) {
+    auto* fn_t = var->second;
+    t.use(this->fn_name->name);
+    this->via_variable = true;
+    this->fn_name->ty = fn_t;
+    if (!fn_t->lambda_fn.empty()) {
+      t.callees[t.current_fn].insert(fn_t->lambda_fn);
+    }
+    else {
+      t.effects[t.current_fn].opaque = true;
+    }
+    if (fn_t->params.size() != this->args.size()) {
+      t.errors.push_back({this->pos, format("{} takes {} arguments, but {} were given",
+            this->fn_name->name, fn_t->params.size(), this->args.size())});
+      return fn_t->result;
+    }
+    for (size_t i = 0; i < this->args.size(); ++i) {
+      if (!converts(arg_t[i], fn_t->params[i]) && !retype_literal(*this->args[i], fn_t->params[i])) {
+        t.expect(this->args[i]->pos, fn_t->params[i], arg_t[i]);
+      }
+    }
+    return fn_t->result;
+  }
+
+  if (auto op = t.overloads.find(this->fn_name->name); op != t.overloads.end()) {
+    auto &candidates = op->second;
+    auto match = std::find_if(candidates.begin(), candidates.end(), [&](auto &&name) {
+      auto fn = t.fn_table.find(name);
+      return fn != t.fn_table.end() && fn->second.args == arg_t;
+    });
+    // Otherwise, literals can take the type of the other operands, as in
+    // (+ x 1) with an i64 x.
+    if (match == candidates.end()) {
+      match = std::find_if(candidates.begin(), candidates.end(), [&](auto &&name) {
+        auto fn = t.fn_table.find(name);
+        if (fn == t.fn_table.end() || fn->second.args.size() != arg_t.size()) {
+          return false;
+        }
+        for (size_t i = 0; i < arg_t.size(); ++i) {
+          if (arg_t[i] != fn->second.args[i] && !retypable(*this->args[i], fn->second.args[i])) {
+            return false;
+          }
+        }
+        return true;
+      });
+      if (match != candidates.end()) {
+        auto &params = t.fn_table[*match].args;
+        for (size_t i = 0; i < arg_t.size(); ++i) {
+          retype_literal(*this->args[i], params[i]);
+        }
       }
     }
+    if (match == candidates.end()) {
+      string arg_names;
+      for (auto &&n : names_of(arg_t)) {
+        arg_names += arg_names.empty() ? n : " " + n;
+      }
+      t.errors.push_back({this->fn_name->pos, format("No {} takes ({})", this->fn_name->name, arg_names)});
+      return nullptr;
+    }
+    this->fn_name->name = *match;
   }
+  else if (auto g = t.generics.find(this->fn_name->name); g != t.generics.end()) {
+    auto instance = t.instantiate(*g->second, arg_t, this->pos);
+    if (!instance) {
+      return nullptr;
+    }
+    this->fn_name->name = *instance;
+  }
+
+  t.callees[t.current_fn].insert(this->fn_name->name);
 
-  size_t i = 0;
-  for (auto &&a: this->args) {
-    t.expect(a->pos, t.fn_table[this->fn_name->name].args[i], a->type(t));
+  auto fn = t.fn_table.find(this->fn_name->name);
+  if (fn == t.fn_table.end()) {
+    t.errors.push_back({this->fn_name->pos, format("Unknown function {}", this->fn_name->name)});
+    return nullptr;
+  }
+  if (fn->second.args.size() != this->args.size()) {
+    t.errors.push_back({this->pos, format("{} takes {} arguments, but {} were given",
+          this->fn_name->name, fn->second.args.size(), this->args.size())});
+    return fn->second.ret;
+  }
+
+  for (size_t i = 0; i < this->args.size(); ++i) {
+    auto* param = fn->second.args[i];
+    if (!converts(this->args[i]->ty, param) && !(param && retype_literal(*this->args[i], param))) {
+      t.expect(this->args[i]->pos, param, this->args[i]->ty);
+    }
   }
 
-  return t.fn_table[this->fn_name->name].ret;
+  return fn->second.ret;
 }
 
-auto progn::type(type_checker &t) -> type_t* {
-  for (auto &&c : this->children) {
-    c->type(t);
+// The calls in the body of a lambda are its own, not those of the
+// function it is in, which only makes it.
+auto lambda::enter(type_checker &t) -> void {
+  this->fn_label = format("lambda.{}", ++t.lambda_count);
+  t.lambdas.emplace_back();
+  t.lambdas.back().outer_fn = t.current_fn;
+  t.current_fn = this->fn_label;
+  for (auto &&a : this->args) {
+    t.bind(a->raw->name, t.type_of(a->ty_name->name));
+  }
+}
+
+// The type of a lambda is a struct of the captured values, made a function
+// type by its signature.
+auto lambda::type(type_checker &t) -> type_t* {
+  vector<type_t *> params;
+  for (auto &&a : this->args) {
+    params.push_back(t.var_table[a->raw->name]);
+    if (!params.back()) {
+      t.errors.push_back({a->ty_name->pos, format("Unknown type {}", a->ty_name->name)});
+    }
+  }
+  for (size_t i = 0; i < this->args.size(); ++i) {
+    t.unbind();
+  }
+  this->captures = std::move(t.lambdas.back().captures);
+  t.current_fn = t.lambdas.back().outer_fn;
+  t.lambdas.pop_back();
+
+  auto* ret_t = this->body.empty() ? &statement : this->body.back()->ty;
+  if (is_heap(ret_t) || is_fn(ret_t)) {
+    t.errors.push_back({this->body.back()->pos, format("A lambda cannot return a {}", is_fn(ret_t) ? "function" : ret_t->name)});
+  }
+
+  vector<type_t *> fields;
+  for (auto &&c : this->captures) {
+    fields.push_back(t.var_table[c]);
+  }
+  auto closure = std::make_unique<type_t>(this->fn_label, vector<string>(this->captures), std::move(fields));
+  closure->params = std::move(params);
+  closure->result = ret_t ? ret_t : &statement;
+  closure->lambda_fn = this->fn_label;
+  return (t.closures[this->fn_label] = std::move(closure)).get();
+}
+
+auto generic::type(type_checker &t) -> type_t* {
+  auto &d = *this->pattern;
+  if (d.fn_name->is_op) {
+    t.errors.push_back({d.fn_name->pos, "An operator cannot be generic"});
+    return &statement;
+  }
+  for (auto &&p : d.type_params) {
+    if (t.type_of(p->name)) {
+      t.errors.push_back({p->pos, format("Type parameter {} hides the type {}", p->name, p->name)});
+      return &statement;
+    }
+    auto used = std::any_of(d.args.begin(), d.args.end(),
+        [&](auto &&a) { return a->ty_name->name == p->name; });
+    if (!used) {
+      t.errors.push_back({p->pos, format("Type parameter {} is not the type of any argument", p->name)});
+      return &statement;
+    }
+  }
+  t.generics[d.fn_name->name] = this;
+  return &statement;
+}
+
+// A type name with bound type parameters replaced, also inside a function
+// type.
+auto substitute(const string &name, const unordered_map<string, type_t *> &bound) -> string {
+  if (!name.starts_with("(")) {
+    auto it = bound.find(name);
+    return it != bound.end() ? it->second->name : name;
+  }
+  string result;
+  for (auto &&w : name.substr(1, name.size() - 2).split(' ')) {
+    auto it = bound.find(w);
+    result += (result.empty() ? "(" : " ") + (it != bound.end() ? it->second->name : w);
+  }
+  return result + ")";
+}
+
+// Binds the type parameters of the generic to the argument types and, for
+// a new combination, checks a copy of the pattern with them substituted.
+// Instances are cached by name, which lists the bound types.
+auto type_checker::instantiate(generic &g, const vector<type_t *> &args, size_t pos) -> std::optional<string> {
+  auto &d = *g.pattern;
+  auto &name = d.fn_name->name;
+  if (d.args.size() != args.size()) {
+    this->errors.push_back({pos, format("{} takes {} arguments, but {} were given",
+          name, d.args.size(), args.size())});
+    return std::nullopt;
+  }
+
+  unordered_map<string, type_t *> bound;
+  for (size_t i = 0; i < args.size(); ++i) {
+    auto &param = d.args[i]->ty_name->name;
+    auto is_param = std::any_of(d.type_params.begin(), d.type_params.end(),
+        [&](auto &&p) { return p->name == param; });
+    if (!is_param) {
+      continue;
+    }
+    if (!args[i] || args[i] == &statement) {
+      this->errors.push_back({pos, format("Cannot infer {} of {} from a statement", param, name)});
+      return std::nullopt;
+    }
+    if (auto it = bound.find(param); it != bound.end() && it->second != args[i]) {
+      this->errors.push_back({pos, format("{} of {} is both {} and {}",
+            param, name, it->second->name, args[i]->name)});
+      return std::nullopt;
+    }
+    bound[param] = args[i];
+  }
+
+  vector<string> bound_names;
+  for (auto &&p : d.type_params) {
+    bound_names.push_back(bound[p->name]->name);
+  }
+
+  // A lambda passed for a function parameter gets an instance of its own,
+  // in which calls of the parameter are direct calls of the lambda, as long
+  // as the generic has room for one more.
+  unordered_map<size_t, type_t *> specialized;
+  auto &specializations = this->specializations[name];
+  for (size_t i = 0; i < args.size() && specializations < this->max_specializations; ++i) {
+    auto &param = d.args[i]->ty_name->name;
+    if (!param.starts_with("(") || !is_fn(args[i]) || args[i]->lambda_fn.empty()) {
+      continue;
+    }
+    if (auto* fn_t = this->type_of(substitute(param, bound)); fn_t && converts(args[i], fn_t)) {
+      specialized[i] = args[i];
+      bound_names.push_back(args[i]->name);
+    }
+  }
+
+  // Without type parameters or lambdas, the instance is the def as written.
+  auto instance_name = bound_names.empty() ? name : mangle(name, bound_names);
+  if (!this->instances.insert(instance_name).second) {
+    return instance_name;
+  }
+  if (!specialized.empty()) {
+    ++specializations;
+  }
+
+  auto copy = copy_node(d);
+  if (!copy) {
+    this->errors.push_back({g.pos, format("{} cannot be instantiated", name)});
+    return std::nullopt;
+  }
+  auto &instance = static_cast<def &>(*copy);
+  instance.fn_name->name = instance_name;
+  for (size_t i = 0; i < instance.args.size(); ++i) {
+    auto &ty_name = instance.args[i]->ty_name->name;
+    if (auto it = specialized.find(i); it != specialized.end()) {
+      ty_name = it->second->name;
+    }
+    else {
+      ty_name = substitute(ty_name, bound);
+    }
+  }
+
+  // The instance is checked on its own, in the middle of the caller.
+  auto vars = std::move(this->var_table);
+  auto shadowed = std::move(this->scopes);
+  auto caller = this->current_fn;
+  this->check(instance);
+  this->var_table = std::move(vars);
+  this->scopes = std::move(shadowed);
+  this->current_fn = caller;
+
+  g.instances.push_back(std::move(copy));
+  return instance_name;
+}
+
+// Only known intrinsics are assumed to be pure.
+auto extern_::type(type_checker &t) -> type_t* {
+  auto &name = this->fn_name->name;
+  if (prim_fn::find(name)) {
+    t.errors.push_back({this->fn_name->pos, format("{} is a primitive and cannot be redeclared", name)});
+    return &statement;
+  }
+
+  auto scalar = [&](type_t* ty, const id &at) {
+    if (!ty || !ty->fields.empty() || ty == &statement || is_heap(ty) || is_fn(ty)) {
+      t.errors.push_back({at.pos, format("Extern functions can only take and return i32, f64 or bool, not {}", at.name)});
+      return false;
+    }
+    return true;
+  };
+  auto fn_t = fn_type {&statement, {}, false, true};
+  for (auto &&a : this->args) {
+    auto* arg_t = t.type_of(a->ty_name->name);
+    if (!scalar(arg_t, *a->ty_name)) {
+      return &statement;
+    }
+    fn_t.args.push_back(arg_t);
+  }
+  if (this->ret_name) {
+    fn_t.ret = t.type_of(this->ret_name->name);
+    if (!scalar(fn_t.ret, *this->ret_name)) {
+      return &statement;
+    }
   }
+  fn_t.pure = intrinsic_fn::find(name, fn_t) != nullptr;
+  fn_t.readnone = fn_t.nounwind = fn_t.willreturn = fn_t.norecurse = fn_t.pure;
+  t.fn_table[name] = fn_t;
+  return &statement;
+}
+
+// Declares the struct type with a constructor named after it and one
+// accessor per field, named <struct>-<field>.
+auto defstruct::type(type_checker &t) -> type_t* {
+  auto &name = this->struct_name->name;
+  if (typename_map.count(name) || t.structs.count(name)) {
+    t.errors.push_back({this->struct_name->pos, format("Type {} is already defined", name)});
+    return &statement;
+  }
+
+  vector<string> names;
+  vector<type_t *> fields;
+  for (auto &&f : this->fields) {
+    auto* field_t = t.type_of(f->ty_name->name);
+    if (!field_t || field_t == &statement) {
+      t.errors.push_back({f->ty_name->pos, format("Unknown type {}", f->ty_name->name)});
+      return &statement;
+    }
+    // Escape analysis does not follow values through fields, and lambdas
+    // do not outlive their call.
+    if (is_heap(field_t) || is_fn(field_t)) {
+      t.errors.push_back({f->ty_name->pos, format("A struct field cannot be a {}", field_t->name)});
+      return &statement;
+    }
+    names.push_back(f->raw->name);
+    fields.push_back(field_t);
+  }
+
+  auto &st = t.structs[name] = std::make_unique<type_t>(name, std::move(names), std::move(fields));
+  t.fn_table[name] = fn_type {st.get(), st->fields};
+  for (size_t i = 0; i < st->fields.size(); ++i) {
+    t.fn_table[format("{}-{}", name, st->field_names[i])] = fn_type {st->fields[i], {st.get()}};
+  }
+  return &statement;
+}
+
+auto let::step(type_checker &t, size_t done) -> void {
+  if (done != 1) {
+    return;
+  }
+  auto* init = this->body.front()->ty;
+  if (!init || init == &statement) {
+    t.errors.push_back({this->body.front()->pos, format("Cannot bind {} to a statement", this->var_name->name)});
+  }
+  t.bind(this->var_name->name, init);
+}
+
+auto let::type(type_checker &t) -> type_t* {
+  if (this->body.empty()) {
+    t.errors.push_back({this->pos, format("Expected a value for {}", this->var_name->name)});
+    return &statement;
+  }
+  t.unbind();
+  return this->body.size() > 1 ? this->body.back()->ty : &statement;
+}
+
+auto set::type(type_checker &t) -> type_t* {
+  if (this->value.size() != 1) {
+    t.errors.push_back({this->pos, format("Expected (set! {} value)", this->var_name->name)});
+    return nullptr;
+  }
+  auto var = t.var_table.find(this->var_name->name);
+  if (var == t.var_table.end() || !var->second) {
+    t.errors.push_back({this->var_name->pos, format("Unknown variable {}", this->var_name->name)});
+    return nullptr;
+  }
+  // A lambda has its own copy of what it captures.
+  if (t.captured(this->var_name->name)) {
+    t.errors.push_back({this->var_name->pos, format("Cannot set! {}, which the lambda captures", this->var_name->name)});
+    return nullptr;
+  }
+  // A dotimes only surely ends if its counter is left alone.
+  if (std::find(t.counters.begin(), t.counters.end(), this->var_name->name) != t.counters.end()) {
+    t.effects[t.current_fn].loops = true;
+  }
+  if (!retype_literal(*this->value.front(), var->second)) {
+    t.expect(this->value.front()->pos, var->second, this->value.front()->ty);
+  }
+  return var->second;
+}
+
+auto while_::type(type_checker &t) -> type_t* {
+  if (this->body.empty()) {
+    t.errors.push_back({this->pos, "Expected a condition"});
+  }
+  else {
+    t.expect(this->body.front()->pos, &bool_, this->body.front()->ty);
+  }
+  t.effects[t.current_fn].loops = true;
+  return &statement;
+}
+
+auto dotimes::step(type_checker &t, size_t done) -> void {
+  if (done != 1) {
+    return;
+  }
+  t.expect(this->body.front()->pos, &i32, this->body.front()->ty);
+  t.bind(this->var_name->name, &i32);
+  t.counters.push_back(this->var_name->name);
+}
+
+auto dotimes::type(type_checker &t) -> type_t* {
+  if (this->body.empty()) {
+    t.errors.push_back({this->pos, "Expected a count"});
+    return &statement;
+  }
+  t.unbind();
+  t.counters.pop_back();
+  return &statement;
+}
+
+// Checks that `name` is a user function taking `args` and returning `ret`.
+auto expect_fn(type_checker &t, const node &n, const id* name, const vector<type_t *> &args, type_t* ret) {
+  if (!name) {
+    t.errors.push_back({n.pos, "Expected a function name"});
+    return;
+  }
+  auto fn = t.fn_table.find(name->name);
+  if (fn == t.fn_table.end() || prim_fn::find(name->name)) {
+    t.errors.push_back({n.pos, format("Unknown function {}", name->name)});
+    return;
+  }
+  if (fn->second.args != args || fn->second.ret != ret) {
+    auto arg_names = args.size() == 1 ? args[0]->name : format("{} {}", args[0]->name, args[1]->name);
+    t.errors.push_back({n.pos, format("{} must take ({}) and return {}", name->name, arg_names, ret->name)});
+  }
+  t.callees[t.current_fn].insert(name->name);
+}
+
+auto par_reduce::type(type_checker &t) -> type_t* {
+  if (this->args.size() != 5) {
+    t.errors.push_back({this->pos, "Expected (par-reduce from to fn init combine)"});
+    return nullptr;
+  }
+  t.expect(this->args[0]->pos, &i32, this->args[0]->ty);
+  t.expect(this->args[1]->pos, &i32, this->args[1]->ty);
+
+  auto* elem = this->args[3]->ty;
+  if (elem != &i32 && elem != &f64) {
+    t.errors.push_back({this->args[3]->pos, "par-reduce can only reduce i32 or f64 values"});
+    return elem;
+  }
+  expect_fn(t, *this->args[2], this->fn_name(2), {&i32}, elem);
+  expect_fn(t, *this->args[4], this->fn_name(4), {elem, elem}, elem);
+  // The runtime starts threads, which may throw.
+  auto &e = t.effects[t.current_fn];
+  e.memory = true;
+  e.unwinds = true;
+  return elem;
+}
+
+auto progn::type(type_checker &t) -> type_t* {
   return &statement;
 }
 }
@@ -7,19 +7,39 @@
 #include <llvm/IR/Type.h>
 #include <string_theory/string>
 #include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <optional>
+#include <utility>
 #include <vector>
+#include <cstddef>
 
 namespace lisa {
 struct node;
+struct generic;
 struct type {
   using raw_t = llvm::Type* (llvm::LLVMContext &);
 
   ST::string name;
   raw_t* raw;
+  // The fields of a type declared with defstruct, which is represented as
+  // an LLVM literal struct; empty for the builtin types.
+  std::vector<ST::string> field_names;
+  std::vector<type *> fields;
+  // The signature of a function type. A lambda has a type of its own, whose
+  // fields are its captures and whose calls go straight to `lambda_fn`; any
+  // other function type is represented as a function and an environment
+  // pointer.
+  std::vector<type *> params;
+  type* result = nullptr;
+  ST::string lambda_fn;
 
   type(const ST::string&, raw_t*);
+  type(const ST::string&, std::vector<ST::string> &&, std::vector<type *> &&);
   static auto of_str(const ST::string &) -> type*;
 
+  auto to_llvm(llvm::LLVMContext &) const -> llvm::Type*;
+
   type(const type&) = delete;
   type(type&&) = delete;
   type& operator=(const type&) = delete;
@@ -33,20 +53,117 @@ inline type f64("f64", &llvm::Type::getDoubleTy);
 inline type bool_("bool", (type::raw_t*)(&llvm::Type::getInt1Ty));
 inline type statement("statement", &llvm::Type::getVoidTy);
 
+// The other widths of numbers. u32 is the only unsigned type: it divides,
+// compares and converts as unsigned.
+inline type i8("i8", (type::raw_t*)(&llvm::Type::getInt8Ty));
+inline type i16("i16", (type::raw_t*)(&llvm::Type::getInt16Ty));
+inline type i64("i64", (type::raw_t*)(&llvm::Type::getInt64Ty));
+inline type u32("u32", (type::raw_t*)(&llvm::Type::getInt32Ty));
+inline type f32("f32", &llvm::Type::getFloatTy);
+inline const std::vector<type *> number_types = {&i8, &i16, &i32, &i64, &u32, &f32, &f64};
+auto is_integer(const type*) -> bool;
+auto is_float(const type*) -> bool;
+// Whether an integer literal can have the number type.
+auto fits(unsigned long long, const type*) -> bool;
+
+// Lists and strings are pointers to the lisa_cons and lisa_str of the
+// runtime, allocated in regions (see lisa_rt.h); the empty list is null.
+auto list_type(llvm::LLVMContext &) -> llvm::Type*;
+auto str_type(llvm::LLVMContext &) -> llvm::Type*;
+inline type list_("list", &list_type);
+inline type str_("str", &str_type);
+auto is_heap(const type*) -> bool;
+// A function type other than a lambda's is {i8* fn, i8* env}.
+auto erased_fn_type(llvm::LLVMContext &) -> llvm::Type*;
+auto is_fn(const type*) -> bool;
+// Whether a value of type `from` can be passed where `to` is expected: the
+// types are the same, or `from` is a lambda with the signature of `to`.
+auto converts(const type* from, const type* to) -> bool;
+
 struct fn_type {
   type* ret;
   std::vector<type *> args;
+  bool pure = true;
+  bool external = false;
+  // What the call graph proves about the generated function, which it and
+  // its call sites carry as LLVM attributes: it accesses no memory its
+  // caller can see, does not unwind, returns, and does not call itself.
+  bool readnone = false;
+  bool nounwind = false;
+  bool willreturn = false;
+  bool norecurse = false;
+};
+
+// What the code of a function does by itself, apart from its calls, that
+// keeps it from being readnone, nounwind or willreturn. An opaque function
+// calls code the analysis cannot see, so nothing is proven about it.
+struct fn_effects {
+  bool memory = false;
+  bool unwinds = false;
+  bool loops = false;
+  bool opaque = false;
 };
 
 struct type_checker {
   std::unordered_map<ST::string, fn_type> fn_table;
   std::unordered_map<ST::string, type*> var_table;
+  std::unordered_map<ST::string, std::unique_ptr<type>> structs;
+  // Function types by their spelling and the types of lambdas by name.
+  std::unordered_map<ST::string, std::unique_ptr<type>> fn_types;
+  std::unordered_map<ST::string, std::unique_ptr<type>> closures;
   std::vector<error> errors;
+
+  // The functions an operator can stand for, picked by argument types, and
+  // the generics with the names of the instances made so far.
+  std::unordered_map<ST::string, std::vector<ST::string>> overloads;
+  std::unordered_map<ST::string, generic*> generics;
+  std::unordered_set<ST::string> instances;
+  // How many instances of a generic may be specialized for the lambdas
+  // passed to it; beyond that, lambdas are passed as function pointers.
+  std::size_t max_specializations = 16;
+  std::unordered_map<ST::string, std::size_t> specializations;
+
+  // For every lambda being checked, innermost last, how often each name is
+  // bound inside it, the outer variables it uses and the function it is in.
+  struct lambda_scope {
+    std::unordered_map<ST::string, std::size_t> locals;
+    std::vector<ST::string> captures;
+    ST::string outer_fn;
+  };
+  std::vector<lambda_scope> lambdas;
+  std::size_t lambda_count = 0;
+
+  // Bindings shadowed by the innermost `let`s and `dotimes`es, and the
+  // counters of the enclosing `dotimes`es.
+  std::vector<std::pair<ST::string, type*>> scopes;
+  std::vector<ST::string> counters;
+
+  // The call graph of user functions and lambdas, keyed by caller, with
+  // the effects of their own code, and the position of every def-memo so
+  // that its purity can be checked once the graph is complete.
+  ST::string current_fn;
+  std::unordered_map<ST::string, std::unordered_set<ST::string>> callees;
+  std::unordered_map<ST::string, fn_effects> effects;
+  std::unordered_map<ST::string, std::size_t> memo_fns;
+
   type_checker();
 
+  // type_check is check followed by finish; a program can also be checked
+  // one top-level form at a time before finish runs the whole-program
+  // checks.
   auto type_check(node &) -> void;
+  auto check(node &) -> void;
+  auto finish() -> void;
+  auto infer_purity() -> void;
+  auto infer_attributes() -> void;
+  auto instantiate(generic &, const std::vector<type *> &, std::size_t) -> std::optional<ST::string>;
 
-  auto expect(const token_pos&, type*, type*) -> void;
+  auto type_of(const ST::string &) -> type*;
+  auto expect(std::size_t, type*, type*) -> void;
+  auto bind(const ST::string &, type*) -> void;
+  auto unbind() -> void;
+  auto use(const ST::string &) -> void;
+  auto captured(const ST::string &) const -> bool;
 };
 }
 
@@ -3,10 +3,11 @@
 
 #include <lisa/lexer.hpp>
 #include <string_theory/string>
+#include <cstddef>
 
 namespace lisa {
 struct error {
-  token_pos pos;
+  std::size_t pos;
   ST::string msg;
 };
 }
@@ -0,0 +1,326 @@
+#include <lisa/vm.hpp>
+#include <lisa/parser.hpp>
+#include <lisa/type_checker.hpp>
+#include <string_theory/format>
+#include <algorithm>
+#include <climits>
+#include <utility>
+
+using std::unordered_map;
+using std::vector;
+using std::size_t;
+using std::uint16_t;
+using std::uint32_t;
+using std::int32_t;
+using ST::string;
+using ST::format;
+using tl::expected;
+using tl::make_unexpected;
+
+namespace lisa {
+auto vm_assembler::emit(opcode op, uint32_t a, uint32_t b, uint32_t c) -> void {
+  this->program.code.push_back(instr {
+      op,
+      static_cast<uint16_t>(a),
+      static_cast<uint16_t>(b),
+      static_cast<uint16_t>(c)
+  });
+}
+
+auto vm_assembler::reserve(size_t pos, uint32_t regs) -> bool {
+  if (regs > UINT16_MAX) {
+    this->errors.push_back({pos, "Function needs more registers than the vm backend supports"});
+    return false;
+  }
+  this->high = std::max(this->high, regs);
+  return true;
+}
+
+auto vm_assembler::lower(const node &ast) -> void {
+  auto add_def = [&](const node* n) {
+    if (auto* d = dynamic_cast<const def *>(n); d) {
+      this->program.fn_index[d->fn_name->name] = static_cast<uint16_t>(this->program.functions.size());
+      this->program.functions.push_back({d->fn_name->name, static_cast<uint16_t>(d->args.size()), 0, 0});
+    }
+  };
+  for(auto* n : ast.subnodes()) {
+    add_def(n);
+    if (auto* g = dynamic_cast<const generic *>(n); g) {
+      for(auto* i : g->subnodes()) {
+        add_def(i);
+      }
+    }
+  }
+
+  struct frame {
+    const node* target;
+    vector<node *> subnodes;
+    vector<uint16_t> values;
+    uint32_t mark;
+  };
+  vector<frame> stack;
+  ast.enter(*this);
+  stack.push_back({&ast, ast.subnodes(), {}, this->next});
+
+  while(true) {
+    auto &top = stack.back();
+    if (top.values.size() < top.subnodes.size()) {
+      auto* next = top.subnodes[top.values.size()];
+      next->enter(*this);
+      stack.push_back({next, next->subnodes(), {}, this->next});
+      continue;
+    }
+    if (!this->reserve(top.target->pos, top.mark + 1)) {
+      return;
+    }
+    auto result = top.target->lower(*this, top.values, static_cast<uint16_t>(top.mark));
+    this->next = result == top.mark ? top.mark + 1 : top.mark;
+    stack.pop_back();
+    if (stack.empty()) {
+      return;
+    }
+    stack.back().values.push_back(result);
+  }
+}
+
+auto node::enter(vm_assembler &) const -> void {}
+
+auto node::lower(vm_assembler &a, const vector<uint16_t> &, uint16_t dst) const -> uint16_t {
+  a.errors.push_back({this->pos, "This form is not supported by the vm backend"});
+  return dst;
+}
+
+auto id::lower(vm_assembler &a, const vector<uint16_t> &, uint16_t dst) const -> uint16_t {
+  if (auto it = a.var_table.find(this->name); it != a.var_table.end()) {
+    return it->second;
+  }
+  a.errors.push_back({this->pos, format("Unknown variable {}", this->name)});
+  return dst;
+}
+
+auto boolc::lower(vm_assembler &a, const vector<uint16_t> &, uint16_t dst) const -> uint16_t {
+  a.emit(opcode::load_b, dst, this->value);
+  return dst;
+}
+
+// Registers hold i32, f64 and bool values only.
+auto inum::lower(vm_assembler &a, const vector<uint16_t> &args, uint16_t dst) const -> uint16_t {
+  if (this->ty != &i32) {
+    return node::lower(a, args, dst);
+  }
+  auto bits = static_cast<uint32_t>(this->number);
+  a.emit(opcode::load_i, dst, bits & 0xffff, bits >> 16);
+  return dst;
+}
+
+auto fnum::lower(vm_assembler &a, const vector<uint16_t> &args, uint16_t dst) const -> uint16_t {
+  if (this->ty != &f64) {
+    return node::lower(a, args, dst);
+  }
+  auto index = static_cast<uint32_t>(a.program.fconsts.size());
+  a.program.fconsts.push_back(this->number);
+  a.emit(opcode::load_f, dst, index & 0xffff, index >> 16);
+  return dst;
+}
+
+auto def::enter(vm_assembler &a) const -> void {
+  auto &fn = a.program.functions[a.program.fn_index[this->fn_name->name]];
+  fn.entry = static_cast<uint32_t>(a.program.code.size());
+
+  a.var_table.clear();
+  for(size_t i = 0; i < this->args.size(); ++i) {
+    a.var_table[this->args[i]->raw->name] = static_cast<uint16_t>(i);
+  }
+  a.next = static_cast<uint32_t>(this->args.size());
+  a.high = a.next;
+}
+
+auto def::lower(vm_assembler &a, const vector<uint16_t> &body, uint16_t dst) const -> uint16_t {
+  if (body.empty()) {
+    a.emit(opcode::load_b, dst, 0);
+    a.emit(opcode::ret, dst);
+  }
+  else {
+    a.emit(opcode::ret, body.back());
+  }
+  a.program.functions[a.program.fn_index[this->fn_name->name]].regs = a.high;
+  return dst;
+}
+
+auto generic::lower(vm_assembler &, const vector<uint16_t> &, uint16_t dst) const -> uint16_t {
+  return dst;
+}
+
+// Binary primitives; `swapped` ones take their operands in reverse, like
+// their LLVM lowering in primitive.hpp.
+struct vm_binary {
+  opcode op;
+  bool swapped;
+};
+
+const unordered_map<string, vm_binary> vm_binaries = {
+  {"and", {opcode::band, false}},
+  {"or", {opcode::bor, false}},
+  {"__ieq", {opcode::ieq, false}},
+  {"__ilt", {opcode::ilt, true}},
+  {"__iadd", {opcode::iadd, false}},
+  {"__isub", {opcode::isub, true}},
+  {"__imul", {opcode::imul, false}},
+  {"__idiv", {opcode::idiv, true}},
+  {"__feq", {opcode::feq, false}},
+  {"__flt", {opcode::flt, true}},
+  {"__fadd", {opcode::fadd, false}},
+  {"__fsub", {opcode::fsub, true}},
+  {"__fmul", {opcode::fmul, false}},
+  {"__fdiv", {opcode::fdiv, true}},
+};
+
+auto fn_call::lower(vm_assembler &a, const vector<uint16_t> &args, uint16_t dst) const -> uint16_t {
+  auto &name = this->fn_name->name;
+
+  if (auto it = vm_binaries.find(name); it != vm_binaries.end()) {
+    auto [op, swapped] = it->second;
+    a.emit(op, dst, args[swapped ? 1 : 0], args[swapped ? 0 : 1]);
+    return dst;
+  }
+  if (name == "fma") {
+    // llvm.fmuladd leaves fusing to the target, so an unfused pair matches it.
+    // The product goes above the operands, since the addend may be in dst.
+    uint32_t product = a.next;
+    if (!a.reserve(this->pos, product + 1)) {
+      return dst;
+    }
+    a.emit(opcode::fmul, product, args[0], args[1]);
+    a.emit(opcode::fadd, dst, product, args[2]);
+    return dst;
+  }
+  if (name == "not") {
+    a.emit(opcode::bnot, dst, args[0]);
+    return dst;
+  }
+  if (name == "return") {
+    a.emit(opcode::ret, args[0]);
+    return dst;
+  }
+
+  auto fn = a.program.fn_index.find(name);
+  if (this->via_variable || fn == a.program.fn_index.end()) {
+    return node::lower(a, args, dst);
+  }
+
+  uint32_t base = a.next;
+  if (!a.reserve(this->pos, base + static_cast<uint32_t>(args.size()))) {
+    return dst;
+  }
+  for(size_t i = 0; i < args.size(); ++i) {
+    a.emit(opcode::move, base + i, args[i]);
+  }
+  a.emit(opcode::call, dst, fn->second, base);
+  return dst;
+}
+
+auto progn::lower(vm_assembler &, const vector<uint16_t> &, uint16_t dst) const -> uint16_t {
+  return dst;
+}
+
+#if defined(__GNUC__)
+#define LISA_VM_THREADED 1
+#endif
+
+auto vm::run(const vm_program &p, const string &name, const vector<vm_value> &args) -> expected<vm_value, string> {
+  auto it = p.fn_index.find(name);
+  if (it == p.fn_index.end()) {
+    return make_unexpected(format("Unknown function {}", name));
+  }
+
+  struct call_frame {
+    const instr* ret;
+    size_t base;
+    uint16_t dst;
+  };
+  vector<call_frame> calls;
+  auto &entry = p.functions[it->second];
+  vector<vm_value> regs(std::max<size_t>(entry.regs, args.size()) + 1);
+  std::copy(args.begin(), args.end(), regs.begin());
+
+  const instr* pc = p.code.data() + entry.entry;
+  size_t base = 0;
+  vm_value* r = regs.data();
+
+  // Every handler ends by jumping straight to the next one; without computed
+  // goto the same handlers are the cases of a switch.
+#ifdef LISA_VM_THREADED
+#define LISA_VM_LABEL(name) &&op_##name,
+  static void* const labels[] = { LISA_VM_OPS(LISA_VM_LABEL) };
+#undef LISA_VM_LABEL
+#define OP(name) op_##name:
+#define DISPATCH() goto *labels[static_cast<size_t>(pc->op)]
+#define NEXT() do { ++pc; DISPATCH(); } while(0)
+  DISPATCH();
+#else
+#define OP(name) case opcode::name:
+#define DISPATCH() continue
+#define NEXT() do { ++pc; continue; } while(0)
+  while(true) switch(pc->op) {
+#endif
+
+  OP(load_i) r[pc->a].i = static_cast<int32_t>(pc->b | (static_cast<uint32_t>(pc->c) << 16)); NEXT();
+  OP(load_f) r[pc->a].f = p.fconsts[pc->b | (static_cast<uint32_t>(pc->c) << 16)]; NEXT();
+  OP(load_b) r[pc->a].b = pc->b != 0; NEXT();
+  OP(move) r[pc->a] = r[pc->b]; NEXT();
+  OP(iadd) r[pc->a].i = static_cast<int32_t>(static_cast<uint32_t>(r[pc->b].i) + static_cast<uint32_t>(r[pc->c].i)); NEXT();
+  OP(isub) r[pc->a].i = static_cast<int32_t>(static_cast<uint32_t>(r[pc->b].i) - static_cast<uint32_t>(r[pc->c].i)); NEXT();
+  OP(imul) r[pc->a].i = static_cast<int32_t>(static_cast<uint32_t>(r[pc->b].i) * static_cast<uint32_t>(r[pc->c].i)); NEXT();
+  OP(idiv)
+    if (r[pc->c].i == 0 || (r[pc->c].i == -1 && r[pc->b].i == INT32_MIN)) {
+      return make_unexpected("Integer division overflow or by zero");
+    }
+    r[pc->a].i = r[pc->b].i / r[pc->c].i;
+    NEXT();
+  OP(ieq) r[pc->a].b = r[pc->b].i == r[pc->c].i; NEXT();
+  OP(ilt) r[pc->a].b = r[pc->b].i < r[pc->c].i; NEXT();
+  OP(fadd) r[pc->a].f = r[pc->b].f + r[pc->c].f; NEXT();
+  OP(fsub) r[pc->a].f = r[pc->b].f - r[pc->c].f; NEXT();
+  OP(fmul) r[pc->a].f = r[pc->b].f * r[pc->c].f; NEXT();
+  OP(fdiv) r[pc->a].f = r[pc->b].f / r[pc->c].f; NEXT();
+  OP(feq) r[pc->a].b = r[pc->b].f == r[pc->c].f; NEXT();
+  OP(flt) r[pc->a].b = r[pc->b].f < r[pc->c].f; NEXT();
+  OP(band) r[pc->a].b = r[pc->b].b && r[pc->c].b; NEXT();
+  OP(bor) r[pc->a].b = r[pc->b].b || r[pc->c].b; NEXT();
+  OP(bnot) r[pc->a].b = !r[pc->b].b; NEXT();
+  OP(call) {
+    if (calls.size() >= this->max_calls) {
+      return make_unexpected("Call depth exceeds the vm limit");
+    }
+    auto &callee = p.functions[pc->b];
+    calls.push_back({pc + 1, base, pc->a});
+    base += pc->c;
+    if (regs.size() < base + callee.regs + 1) {
+      regs.resize(std::max(regs.size() * 2, base + callee.regs + 1));
+    }
+    r = regs.data() + base;
+    pc = p.code.data() + callee.entry;
+    DISPATCH();
+  }
+  OP(ret) {
+    auto value = r[pc->a];
+    if (calls.empty()) {
+      return value;
+    }
+    auto caller = calls.back();
+    calls.pop_back();
+    base = caller.base;
+    r = regs.data() + base;
+    r[caller.dst] = value;
+    pc = caller.ret;
+    DISPATCH();
+  }
+
+#ifndef LISA_VM_THREADED
+  }
+#endif
+#undef OP
+#undef DISPATCH
+#undef NEXT
+}
+}
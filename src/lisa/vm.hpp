@@ -0,0 +1,80 @@
+#ifndef LISA_VM
+#define LISA_VM
+
+#include <lisa/util.hpp>
+#include <string_theory/string>
+#include <tl/expected.hpp>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace lisa {
+struct node;
+
+// Opcodes of the register bytecode. `a` is the destination register and
+// `b`/`c` the operands; binary operators compute `b op c`.
+#define LISA_VM_OPS(X) \
+  X(load_i) X(load_f) X(load_b) X(move) \
+  X(iadd) X(isub) X(imul) X(idiv) X(ieq) X(ilt) \
+  X(fadd) X(fsub) X(fmul) X(fdiv) X(feq) X(flt) \
+  X(band) X(bor) X(bnot) \
+  X(call) X(ret)
+
+enum class opcode : std::uint8_t {
+#define LISA_VM_ENUM(name) name,
+  LISA_VM_OPS(LISA_VM_ENUM)
+#undef LISA_VM_ENUM
+};
+
+struct instr {
+  opcode op;
+  std::uint16_t a;
+  std::uint16_t b;
+  std::uint16_t c;
+};
+
+union vm_value {
+  std::int32_t i;
+  double f;
+  bool b;
+};
+
+struct vm_function {
+  ST::string name;
+  std::uint16_t arity;
+  std::uint32_t regs;
+  std::uint32_t entry;
+};
+
+struct vm_program {
+  std::vector<instr> code;
+  std::vector<double> fconsts;
+  std::vector<vm_function> functions;
+  std::unordered_map<ST::string, std::uint16_t> fn_index;
+};
+
+// Lowers a checked AST to bytecode. Registers are allocated like a stack:
+// an expression computes into the first register free when it starts. A
+// call moves its arguments into consecutive registers above every live one,
+// and the callee's frame starts at the first of them.
+struct vm_assembler {
+  vm_program program;
+  std::unordered_map<ST::string, std::uint16_t> var_table;
+  std::uint32_t next = 0;
+  std::uint32_t high = 0;
+  std::vector<error> errors;
+
+  auto lower(const node &) -> void;
+  auto emit(opcode, std::uint32_t, std::uint32_t = 0, std::uint32_t = 0) -> void;
+  auto reserve(std::size_t, std::uint32_t) -> bool;
+};
+
+struct vm {
+  std::size_t max_calls = 100000;
+
+  auto run(const vm_program &, const ST::string &, const std::vector<vm_value> &) -> tl::expected<vm_value, ST::string>;
+};
+}
+
+#endif
@@ -2,59 +2,271 @@
 #include <lisa/lexer.hpp>
 #include <lisa/parser.hpp>
 #include <lisa/type_checker.hpp>
+#include <lisa/evaluator.hpp>
 #include <lisa/compiler.hpp>
+#include <lisa/vm.hpp>
+#include <lisa/pipeline.hpp>
 #include <lisa/file.hpp>
 #include <lisa/driver_interface.hpp>
+#include <lisa/ast_file.hpp>
+#include <lisa/mem_stats.hpp>
+#include <cppfs/FileHandle.h>
+#include <cppfs/FilePath.h>
+#include <cppfs/fs.h>
+#include <string_theory/format>
 #include <llvm/Support/raw_ostream.h>
+#include <cstdlib>
+#include <new>
 #include <string>
+#include <vector>
+
+// Every allocation of the process, LLVM's included, goes through these, so
+// that --mem-stats can count them.
+auto operator new(std::size_t size) -> void* {
+  auto* p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  lisa::count_alloc(p);
+  return p;
+}
+
+auto operator new(std::size_t size, std::align_val_t al) -> void* {
+  auto align = static_cast<std::size_t>(al);
+  auto* p = std::aligned_alloc(align, (size + align - 1) / align * align);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  lisa::count_alloc(p);
+  return p;
+}
+
+auto operator delete(void* p) noexcept -> void {
+  lisa::count_free(p);
+  std::free(p);
+}
+
+auto operator delete(void* p, std::align_val_t) noexcept -> void {
+  lisa::count_free(p);
+  std::free(p);
+}
+
+auto print_at(const lisa::source &src, std::size_t offset, const char* label, const ST::string &msg) {
+  auto pos = src.pos_of(offset);
+  fmt::print("{}(at {}): {}\n", label, pos.to_str().view(), msg.view());
+  fmt::print("{}\n", src.line(pos.line));
+  fmt::print("{}^\n", ST::string::fill(pos.character - 1, ' ').view());
+}
+
+auto print_errors(const lisa::source &src, const std::vector<lisa::error> &errors) {
+  for(auto &&e: errors) {
+    print_at(src, e.pos, "error", e.msg);
+  }
+}
+
+auto str_of(lisa::remark_kind kind) -> const char* {
+  switch(kind) {
+  case lisa::remark_kind::passed: return "passed";
+  case lisa::remark_kind::missed: return "missed";
+  default: return "analysis";
+  }
+}
+
+auto print_remarks(const lisa::source &src, const std::vector<lisa::remark> &remarks) {
+  for(auto &&r: remarks) {
+    print_at(src, r.pos, "remark", ST::format("{} [{}] {}", str_of(r.kind), r.pass, r.msg));
+  }
+}
+
+// Writes the remarks in the YAML layout of LLVM's -fsave-optimization-record,
+// which carries the message as the one string of Args.
+auto remarks_yaml(const lisa::source &src, const char* file, const std::vector<lisa::remark> &remarks) -> std::string {
+  auto quote = [](const ST::string &s) {
+    return fmt::format("'{}'", s.replace("'", "''").view());
+  };
+  std::string yaml;
+  for(auto &&r: remarks) {
+    auto pos = src.pos_of(r.pos);
+    auto tag = r.kind == lisa::remark_kind::passed ? "Passed"
+      : r.kind == lisa::remark_kind::missed ? "Missed"
+      : "Analysis";
+    yaml += fmt::format("--- !{}\n", tag);
+    yaml += fmt::format("Pass:            {}\n", quote(r.pass));
+    yaml += fmt::format("Name:            {}\n", quote(r.name));
+    yaml += fmt::format("DebugLoc:        {{ File: {}, Line: {}, Column: {} }}\n", quote(file), pos.line, pos.character);
+    yaml += fmt::format("Function:        {}\n", quote(r.function));
+    yaml += "Args:\n";
+    yaml += fmt::format("  - String:          {}\n", quote(r.msg));
+    yaml += "...\n";
+  }
+  return yaml;
+}
 
 auto main(int argc, const char* argv[]) -> int {
-  if (argc <= 1) {
+  auto parser = lisa::parser();
+  auto options = lisa::compile_options();
+  std::size_t eval_steps = 100000;
+  bool use_vm = false;
+  bool pipelined = false;
+  bool shared = false;
+  const char* input = nullptr;
+  const char* remarks_file = nullptr;
+  const char* ast_cache = nullptr;
+  bool print_mem_stats = false;
+  auto mem = lisa::mem_stats();
+
+  for(int i = 1; i < argc; ++i) {
+    auto arg = ST::string(argv[i]);
+    if (arg.starts_with("--max-depth=")) {
+      parser.max_depth = arg.substr(12).to_ulong_long();
+    }
+    else if (arg.starts_with("--eval-steps=")) {
+      eval_steps = arg.substr(13).to_ulong_long();
+    }
+    else if (arg.starts_with("--memo-capacity=")) {
+      options.memo_capacity = arg.substr(16).to_uint();
+    }
+    else if (arg == "--memo-policy=lru") {
+      options.memo_policy = LISA_MEMO_LRU;
+    }
+    else if (arg == "--memo-policy=fifo") {
+      options.memo_policy = LISA_MEMO_FIFO;
+    }
+    else if (arg == "--ffast-math") {
+      options.fast_math = true;
+    }
+    else if (arg == "--ffp-contract=fast") {
+      options.fp_contract = true;
+    }
+    else if (arg == "--ffp-contract=off") {
+      options.fp_contract = false;
+    }
+    else if (arg.size() == 3 && arg.starts_with("-O") && arg[2] >= '0' && arg[2] <= '3') {
+      options.opt_level = arg[2] - '0';
+    }
+    else if (arg.starts_with("-l") || arg.starts_with("-L")) {
+      options.link_args.push_back(arg);
+    }
+    else if (arg == "--backend=llvm") {
+      use_vm = false;
+    }
+    else if (arg == "--backend=vm") {
+      use_vm = true;
+    }
+    else if (arg.starts_with("--remarks=")) {
+      for(auto &&kind: arg.substr(10).split(',')) {
+        if (kind != "passed" && kind != "missed" && kind != "analysis") {
+          fmt::print("error: unknown remark kind {}, expected passed, missed or analysis\n", kind.view());
+          return 1;
+        }
+        options.remarks_passed |= kind == "passed";
+        options.remarks_missed |= kind == "missed";
+        options.remarks_analysis |= kind == "analysis";
+      }
+    }
+    else if (arg.starts_with("--remarks-yaml=")) {
+      remarks_file = argv[i] + 15;
+    }
+    else if (arg.starts_with("--ast-cache=")) {
+      ast_cache = argv[i] + 12;
+    }
+    else if (arg == "--mem-stats") {
+      print_mem_stats = true;
+      lisa::start_counting();
+    }
+    else if (arg == "--pipeline") {
+      pipelined = true;
+    }
+    else if (arg == "--emit=exe") {
+      shared = false;
+    }
+    else if (arg == "--emit=shared") {
+      shared = true;
+    }
+    else {
+      input = argv[i];
+    }
+  }
+
+  if (!input) {
     fmt::print("error: no input files\n");
     return 1;
   }
-  auto code = lisa::read_file(argv[1]);
+  auto code = lisa::read_file(input);
 
   if (!code) {
     fmt::print("error: {}\n", code.error().view());
     return 1;
   }
 
-  auto lexer = lisa::lexer();
-  auto tokens = lexer.tokenize(*code);
+  auto src = lisa::source(*code);
+  auto type_checker = lisa::type_checker();
+  std::unique_ptr<lisa::node> ast;
 
-  for(auto &&token: tokens) {
-    fmt::print("{}: \"{}\" at {}:{}\n",
-        str_of(token.kind).view(), token.raw.view(), token.pos.line, token.pos.character);
+  // The AST cache holds the tree of the last input it was written for, which
+  // is read instead of parsing the same input again.
+  bool cached = false;
+  if (ast_cache) {
+    mem.start("read_ast");
+    if (auto file = lisa::map_file(ast_cache); file) {
+      auto view = lisa::ast_view::open(file->bytes());
+      if (view && view->matches(*code)) {
+        if (auto tree = lisa::read_ast(*view); tree) {
+          ast = std::move(*tree);
+          cached = true;
+        }
+      }
+    }
   }
 
-  auto parser = lisa::parser();
-  auto ast = parser.parse(tokens);
+  if (!cached && pipelined) {
+    mem.start("parse_pipelined");
+    ast = lisa::parse_pipelined(src, parser, type_checker);
+  }
+  else if (!cached) {
+    mem.start("lexer::tokenize");
+    auto lexer = lisa::lexer();
+    auto tokens = lexer.tokenize(src);
+    mem.stop();
+
+    for(auto &&token: tokens) {
+      auto pos = src.pos_of(token.offset);
+      fmt::print("{}: \"{}\" at {}:{}\n",
+          str_of(token.kind).view(), src.text(token), pos.line, pos.character);
+    }
+
+    mem.start("parser::parse");
+    ast = parser.parse(src, tokens);
+  }
+  mem.stop();
 
   if (!parser.errors.empty()) {
-    auto lines = code->split('\n');
+    print_errors(src, parser.errors);
+    return 1;
+  }
 
-    for(auto &&e: parser.errors) {
-      fmt::print("error(at {}): {}\n", e.pos.to_str().view(), e.msg.view());
-      fmt::print("{}\n", lines[e.pos.line - 1].view());
-      fmt::print("{}^\n", ST::string::fill(e.pos.character - 1, ' ').view());
+  // The pipeline checks as it parses, and the checker changes the tree, so
+  // only a tree parsed apart is written. Other processes may have the cache
+  // mapped, so it is replaced rather than written over.
+  if (ast_cache && !cached && !pipelined) {
+    if (auto bytes = lisa::write_ast(*ast, *code); bytes) {
+      lisa::replace_file(ast_cache, *bytes);
     }
-    return 1;
   }
 
   fmt::print("{}\n", ast->repr().view());
+  if (print_mem_stats) {
+    mem.census(*ast);
+  }
 
-  auto type_checker = lisa::type_checker();
-  type_checker.type_check(*ast);
+  if (!pipelined || cached) {
+    mem.start("type_checker::type_check");
+    type_checker.type_check(*ast);
+    mem.stop();
+  }
 
   if (!type_checker.errors.empty()) {
-    auto lines = code->split('\n');
-
-    for(auto &&e: type_checker.errors) {
-      fmt::print("error(at {}): {}\n", e.pos.to_str().view(), e.msg.view());
-      fmt::print("{}\n", lines[e.pos.line - 1].view());
-      fmt::print("{}^\n", ST::string::fill(e.pos.character - 1, ' ').view());
-    }
+    print_errors(src, type_checker.errors);
     return 1;
   }
 
@@ -67,10 +279,67 @@ auto main(int argc, const char* argv[]) -> int {
     fmt::print(" ) -> {}\n", type.ret ? type.ret->name.view() : "nullptr");
   }
 
+  auto evaluator = lisa::evaluator(type_checker.fn_table);
+  evaluator.max_steps = eval_steps;
+  mem.start("evaluator::fold");
+  evaluator.fold(*ast);
+  mem.stop();
+
   fmt::print("{}\n", ast->repr().view());
+
+  if (use_vm) {
+    mem.start("vm_assembler::lower");
+    auto assembler = lisa::vm_assembler();
+    assembler.lower(*ast);
+    mem.stop();
+
+    if (!assembler.errors.empty()) {
+      print_errors(src, assembler.errors);
+      return 1;
+    }
+
+    mem.start("vm::run");
+    auto result = lisa::vm().run(assembler.program, "main", {});
+    mem.stop();
+    if (print_mem_stats) {
+      fmt::print("{}", mem.report());
+    }
+
+    if (!result) {
+      fmt::print("error: {}\n", result.error().view());
+      return 1;
+    }
+
+    // A main of statements, or with no return type, has no value to report.
+    auto ret = type_checker.fn_table["main"].ret;
+    if (!ret) {
+      return 0;
+    }
+    auto ret_name = ret->name;
+    if (ret_name == "f64") {
+      fmt::print("{}\n", result->f);
+      return 0;
+    }
+    if (ret_name == "bool") {
+      fmt::print("{}\n", result->b);
+      return result->b;
+    }
+    if (ret_name == "i32") {
+      fmt::print("{}\n", result->i);
+      return result->i;
+    }
+    return 0;
+  }
+
+  mem.start("compiler::compile");
   auto compiler = lisa::compiler();
+  compiler.options = options;
+  compiler.src = &src;
   compiler.compile(type_checker.fn_table);
   compiler.compile(*ast);
+  mem.start("compiler::optimize");
+  compiler.optimize();
+  mem.stop();
 
   std::string ir;
   llvm::raw_string_ostream ss(ir);
@@ -79,5 +348,30 @@ auto main(int argc, const char* argv[]) -> int {
   ss.flush();
   fmt::print("{}\n", ir);
 
-  lisa::make_executable("a.out", compiler);
+  // A shared library of the input foo.lisa is libfoo.so, declared by foo.h.
+  mem.start("emit");
+  auto name = ST::string(cppfs::FilePath(input).baseName().c_str());
+  auto exported = shared ? lisa::exported_fns(compiler, type_checker.fn_table) : std::vector<ST::string>();
+  auto linked = shared
+    ? lisa::make_shared_library(ST::format("lib{}.so", name), compiler, exported)
+    : lisa::make_executable("a.out", compiler);
+  mem.stop();
+
+  // Code generation adds remarks of its own, so they are reported once the
+  // object is emitted, whether or not the link then succeeded.
+  print_remarks(src, compiler.remarks);
+  if (remarks_file) {
+    cppfs::fs::open(remarks_file).writeFile(remarks_yaml(src, input, compiler.remarks));
+  }
+
+  if (!linked) {
+    fmt::print("error: {}\n", linked.error().view());
+    return 1;
+  }
+  if (shared) {
+    cppfs::fs::open(ST::format("{}.h", name).c_str()).writeFile(lisa::c_header(type_checker.fn_table, exported, name));
+  }
+  if (print_mem_stats) {
+    fmt::print("{}", mem.report());
+  }
 }
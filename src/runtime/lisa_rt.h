@@ -0,0 +1,67 @@
+#ifndef LISA_RT
+#define LISA_RT
+
+/* Entry points of the runtime that compiled Lisa programs link against.
+ * Everything here has C linkage so that generated code can declare it
+ * directly. */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Memo tables back def-memo functions. Keys are the arguments of a call
+ * widened to 64 bits, values are the widened result. */
+enum {
+  LISA_MEMO_LRU = 0,
+  LISA_MEMO_FIFO = 1
+};
+
+typedef struct lisa_memo_table lisa_memo_table;
+
+lisa_memo_table* lisa_memo_new(uint32_t arity, uint32_t capacity, uint32_t policy);
+int32_t lisa_memo_lookup(lisa_memo_table*, const uint64_t* key, uint64_t* value);
+void lisa_memo_store(lisa_memo_table*, const uint64_t* key, uint64_t value);
+
+/* par-reduce: combine(...combine(init, fn(from))..., fn(to - 1)), with the
+ * range split across a work-stealing thread pool (LISA_THREADS threads, the
+ * number of cores by default). `combine` must be associative. */
+int32_t lisa_par_reduce_i32(int32_t from, int32_t to, int32_t (*fn)(int32_t),
+    int32_t init, int32_t (*combine)(int32_t, int32_t));
+double lisa_par_reduce_f64(int32_t from, int32_t to, double (*fn)(int32_t),
+    double init, double (*combine)(double, double));
+
+/* Lists and strings live in regions: every call that builds one owns a
+ * region on its stack and releases it, with everything allocated in it, when
+ * it returns. Values that escape a call are allocated in the region of its
+ * caller instead, which the caller passes in. Generated code bump-allocates
+ * between `cur` and `end` itself and only calls lisa_region_grow when the
+ * current chunk is full. A zeroed region is empty. */
+typedef struct lisa_region {
+  void* chunks;
+  char* cur;
+  char* end;
+} lisa_region;
+
+/* An immutable cons cell; the empty list is a null pointer. */
+typedef struct lisa_cons {
+  int32_t head;
+  struct lisa_cons* tail;
+} lisa_cons;
+
+/* A string of `length` bytes, followed by a terminating zero. */
+typedef struct lisa_str {
+  int64_t length;
+  char data[];
+} lisa_str;
+
+void* lisa_region_grow(lisa_region*, uint64_t size);
+void lisa_region_release(lisa_region*);
+void lisa_print_str(const lisa_str*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
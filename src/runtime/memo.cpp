@@ -0,0 +1,107 @@
+#include <runtime/lisa_rt.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+using std::uint32_t;
+using std::uint64_t;
+using std::size_t;
+
+// A set-associative table: a key hashes to one set of `ways` slots and the
+// policy decides which slot of a full set is replaced. Slot stamps are 0 when
+// empty, otherwise the tick of the last use (LRU) or of the insertion (FIFO).
+struct lisa_memo_table {
+  uint32_t arity;
+  uint32_t sets;
+  uint32_t policy;
+  uint64_t tick;
+  uint64_t* keys;
+  uint64_t* values;
+  uint64_t* stamps;
+  std::atomic_flag lock;
+};
+
+namespace {
+constexpr uint32_t ways = 4;
+
+auto mix(uint64_t x) -> uint64_t {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+auto set_of(const lisa_memo_table* t, const uint64_t* key) -> size_t {
+  uint64_t h = t->arity;
+  for(uint32_t i = 0; i < t->arity; ++i) {
+    h = mix(h ^ key[i]);
+  }
+  return static_cast<size_t>(h & (t->sets - 1)) * ways;
+}
+
+auto same_key(const lisa_memo_table* t, size_t slot, const uint64_t* key) -> bool {
+  return std::memcmp(t->keys + slot * t->arity, key, t->arity * sizeof(uint64_t)) == 0;
+}
+
+struct guard {
+  lisa_memo_table* t;
+  guard(lisa_memo_table* t) : t(t) {
+    while(t->lock.test_and_set(std::memory_order_acquire)) {}
+  }
+  ~guard() { t->lock.clear(std::memory_order_release); }
+};
+}
+
+extern "C" {
+lisa_memo_table* lisa_memo_new(uint32_t arity, uint32_t capacity, uint32_t policy) {
+  uint32_t sets = 1;
+  while(sets * ways < capacity) {
+    sets *= 2;
+  }
+
+  auto* t = static_cast<lisa_memo_table*>(std::calloc(1, sizeof(lisa_memo_table)));
+  t->arity = arity;
+  t->sets = sets;
+  t->policy = policy;
+  t->keys = static_cast<uint64_t*>(std::calloc(size_t{sets} * ways * (arity ? arity : 1), sizeof(uint64_t)));
+  t->values = static_cast<uint64_t*>(std::calloc(size_t{sets} * ways, sizeof(uint64_t)));
+  t->stamps = static_cast<uint64_t*>(std::calloc(size_t{sets} * ways, sizeof(uint64_t)));
+  t->lock.clear();
+  return t;
+}
+
+int32_t lisa_memo_lookup(lisa_memo_table* t, const uint64_t* key, uint64_t* value) {
+  guard g(t);
+  size_t set = set_of(t, key);
+  for(size_t slot = set; slot < set + ways; ++slot) {
+    if (t->stamps[slot] != 0 && same_key(t, slot, key)) {
+      if (t->policy == LISA_MEMO_LRU) {
+        t->stamps[slot] = ++t->tick;
+      }
+      *value = t->values[slot];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void lisa_memo_store(lisa_memo_table* t, const uint64_t* key, uint64_t value) {
+  guard g(t);
+  size_t set = set_of(t, key);
+  size_t victim = set;
+  for(size_t slot = set; slot < set + ways; ++slot) {
+    if (t->stamps[slot] == 0 || same_key(t, slot, key)) {
+      victim = slot;
+      break;
+    }
+    if (t->stamps[slot] < t->stamps[victim]) {
+      victim = slot;
+    }
+  }
+
+  std::memcpy(t->keys + victim * t->arity, key, t->arity * sizeof(uint64_t));
+  t->values[victim] = value;
+  t->stamps[victim] = ++t->tick;
+}
+}
@@ -0,0 +1,220 @@
+#include <runtime/lisa_rt.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using std::int32_t;
+using std::int64_t;
+using std::size_t;
+
+namespace {
+// One par-reduce call. `remaining` counts the indices not yet reduced, so
+// the caller knows when every partial result has been recorded.
+struct job {
+  std::atomic<int64_t> remaining;
+  int64_t grain;
+
+  job(int64_t n, int64_t g) : remaining(n), grain(g) {}
+  virtual ~job() = default;
+  virtual auto run(int64_t lo, int64_t hi) -> void = 0;
+};
+
+struct task {
+  job* owner;
+  int64_t lo;
+  int64_t hi;
+};
+
+struct queue {
+  std::mutex lock;
+  std::deque<task> tasks;
+};
+
+// Each worker owns a deque: it pushes and pops at the back, thieves take
+// from the front, where the largest ranges are. Queue 0 is shared by the
+// threads outside the pool, which help with the work while they wait.
+class pool {
+public:
+  static auto get() -> pool& {
+    static pool instance;
+    return instance;
+  }
+
+  auto workers() const -> size_t { return this->threads.size(); }
+
+  auto submit(const task &t) -> void {
+    this->push(self, t);
+  }
+
+  auto help(job &j) -> void {
+    while(j.remaining.load(std::memory_order_acquire) > 0) {
+      if (auto t = this->take(self); t.owner) {
+        this->execute(t);
+      }
+      else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+private:
+  static thread_local size_t self;
+
+  std::vector<queue> queues;
+  std::vector<std::thread> threads;
+  std::mutex sleep_lock;
+  std::condition_variable wake;
+  std::atomic<size_t> queued{0};
+  bool stopping = false;
+
+  pool() : queues(thread_count() + 1) {
+    for(size_t i = 1; i < this->queues.size(); ++i) {
+      this->threads.emplace_back([this, i] { this->work(i); });
+    }
+  }
+
+  ~pool() {
+    {
+      std::lock_guard g(this->sleep_lock);
+      this->stopping = true;
+    }
+    this->wake.notify_all();
+    for(auto &&t : this->threads) {
+      t.join();
+    }
+  }
+
+  static auto thread_count() -> size_t {
+    if (auto* env = std::getenv("LISA_THREADS"); env && std::atoi(env) > 0) {
+      return static_cast<size_t>(std::atoi(env));
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  auto push(size_t q, const task &t) -> void {
+    {
+      std::lock_guard g(this->queues[q].lock);
+      this->queues[q].tasks.push_back(t);
+    }
+    this->queued.fetch_add(1, std::memory_order_release);
+    {
+      std::lock_guard g(this->sleep_lock);
+    }
+    this->wake.notify_one();
+  }
+
+  auto take(size_t q) -> task {
+    for(size_t k = 0; k < this->queues.size(); ++k) {
+      auto &victim = this->queues[(q + k) % this->queues.size()];
+      std::lock_guard g(victim.lock);
+      if (victim.tasks.empty()) {
+        continue;
+      }
+      task t;
+      if (k == 0) {
+        t = victim.tasks.back();
+        victim.tasks.pop_back();
+      }
+      else {
+        t = victim.tasks.front();
+        victim.tasks.pop_front();
+      }
+      this->queued.fetch_sub(1, std::memory_order_relaxed);
+      return t;
+    }
+    return {nullptr, 0, 0};
+  }
+
+  // Splits off the upper half until the range is small enough to run, so
+  // that idle workers have something to steal.
+  auto execute(task t) -> void {
+    while(t.hi - t.lo > t.owner->grain) {
+      auto mid = t.lo + (t.hi - t.lo) / 2;
+      this->push(self, {t.owner, mid, t.hi});
+      t.hi = mid;
+    }
+    t.owner->run(t.lo, t.hi);
+    t.owner->remaining.fetch_sub(t.hi - t.lo, std::memory_order_acq_rel);
+  }
+
+  auto work(size_t i) -> void {
+    self = i;
+    while(true) {
+      if (auto t = this->take(i); t.owner) {
+        this->execute(t);
+        continue;
+      }
+      std::unique_lock g(this->sleep_lock);
+      this->wake.wait(g, [this] {
+        return this->stopping || this->queued.load(std::memory_order_acquire) > 0;
+      });
+      if (this->stopping) {
+        return;
+      }
+    }
+  }
+};
+
+thread_local size_t pool::self = 0;
+
+template<class T>
+struct reduce_job : job {
+  T (*fn)(int32_t);
+  T (*combine)(T, T);
+  std::mutex lock;
+  std::vector<std::pair<int64_t, T>> partials;
+
+  reduce_job(int64_t n, int64_t g, T (*f)(int32_t), T (*c)(T, T)) :
+    job(n, g), fn(f), combine(c) {}
+
+  auto run(int64_t lo, int64_t hi) -> void override {
+    T acc = this->fn(static_cast<int32_t>(lo));
+    for(auto i = lo + 1; i < hi; ++i) {
+      acc = this->combine(acc, this->fn(static_cast<int32_t>(i)));
+    }
+    std::lock_guard g(this->lock);
+    this->partials.emplace_back(lo, acc);
+  }
+};
+
+// Partial results are combined in index order, so `combine` only has to be
+// associative.
+template<class T>
+auto par_reduce(int32_t from, int32_t to, T (*fn)(int32_t), T init, T (*combine)(T, T)) -> T {
+  if (from >= to) {
+    return init;
+  }
+  auto& p = pool::get();
+  int64_t n = int64_t{to} - from;
+  int64_t grain = std::max<int64_t>(1, n / static_cast<int64_t>((p.workers() + 1) * 8));
+
+  reduce_job<T> j(n, grain, fn, combine);
+  p.submit({&j, from, to});
+  p.help(j);
+
+  std::sort(j.partials.begin(), j.partials.end(),
+      [](auto &&a, auto &&b) { return a.first < b.first; });
+  T acc = init;
+  for(auto &&[lo, value] : j.partials) {
+    acc = combine(acc, value);
+  }
+  return acc;
+}
+}
+
+extern "C" {
+int32_t lisa_par_reduce_i32(int32_t from, int32_t to, int32_t (*fn)(int32_t), int32_t init, int32_t (*combine)(int32_t, int32_t)) {
+  return par_reduce(from, to, fn, init, combine);
+}
+
+double lisa_par_reduce_f64(int32_t from, int32_t to, double (*fn)(int32_t), double init, double (*combine)(double, double)) {
+  return par_reduce(from, to, fn, init, combine);
+}
+}
@@ -0,0 +1,91 @@
+#include <runtime/lisa_rt.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+using std::uint64_t;
+using std::size_t;
+
+// A region is a list of chunks, the newest first. Chunks of the default
+// size are kept in a per-thread pool when their region is released, so a
+// call that allocates only takes the slow path to malloc the first few times.
+namespace {
+struct chunk {
+  chunk* next;
+  size_t capacity;
+};
+
+constexpr size_t chunk_size = 64 * 1024;
+constexpr size_t max_pooled = 64;
+
+struct pool {
+  chunk* free = nullptr;
+  size_t size = 0;
+
+  ~pool() {
+    while(this->free) {
+      auto* next = this->free->next;
+      std::free(this->free);
+      this->free = next;
+    }
+  }
+};
+
+thread_local pool spare;
+
+auto take(size_t capacity) -> chunk* {
+  if (capacity == chunk_size && spare.free) {
+    auto* c = spare.free;
+    spare.free = c->next;
+    --spare.size;
+    return c;
+  }
+  auto* c = static_cast<chunk*>(std::malloc(sizeof(chunk) + capacity));
+  if (!c) {
+    std::fputs("lisa: out of memory\n", stderr);
+    std::abort();
+  }
+  c->capacity = capacity;
+  return c;
+}
+
+auto give_back(chunk* c) -> void {
+  if (c->capacity == chunk_size && spare.size < max_pooled) {
+    c->next = spare.free;
+    spare.free = c;
+    ++spare.size;
+    return;
+  }
+  std::free(c);
+}
+}
+
+extern "C" {
+void* lisa_region_grow(lisa_region* r, uint64_t size) {
+  auto* c = take(std::max<size_t>(chunk_size, size));
+  c->next = static_cast<chunk*>(r->chunks);
+  r->chunks = c;
+
+  auto* data = reinterpret_cast<char*>(c + 1);
+  r->cur = data + size;
+  r->end = data + c->capacity;
+  return data;
+}
+
+void lisa_region_release(lisa_region* r) {
+  auto* c = static_cast<chunk*>(r->chunks);
+  while(c) {
+    auto* next = c->next;
+    give_back(c);
+    c = next;
+  }
+  r->chunks = nullptr;
+  r->cur = nullptr;
+  r->end = nullptr;
+}
+
+void lisa_print_str(const lisa_str* s) {
+  std::fwrite(s->data, 1, static_cast<size_t>(s->length), stdout);
+}
+}